@@ -0,0 +1,274 @@
+// Micro-benchmarks of the native code, loaded into Bash as the `abbench'
+// builtin (enable -f libab4-bench.so abbench) so that the code which works
+// on shell variables can be measured as well. The results are printed as
+// JSON, and compared against the results of an earlier run if given.
+#include "abbench.hpp"
+
+#include "abconfig.h"
+#include "abnativefunctions.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <nlohmann/json.hpp>
+
+extern "C" {
+#include "bashincludes.h"
+}
+
+using json = nlohmann::json;
+using bench_clock = std::chrono::steady_clock;
+
+// a batch of operations is timed at once, and is at least this long
+constexpr double bench_min_batch_ns = 10e6;
+constexpr size_t bench_min_samples = 5;
+constexpr size_t bench_max_samples = 1000;
+
+struct BenchStats {
+  size_t iterations;
+  size_t samples;
+  double median_ns;
+  double min_ns;
+  double mean_ns;
+};
+
+static double run_batch(const BenchCase &bench, const size_t n) {
+  const auto start = bench_clock::now();
+  bench.run(n);
+  return std::chrono::duration<double, std::nano>(bench_clock::now() - start)
+      .count();
+}
+
+static BenchStats run_case(const BenchCase &bench, const double min_time_ns) {
+  // grow the batches until they are long enough to be timed accurately
+  size_t n = 1;
+  double elapsed = run_batch(bench, n);
+  while (elapsed < bench_min_batch_ns) {
+    const double scale =
+        elapsed > 0 ? std::min(10.0, 1.2 * bench_min_batch_ns / elapsed)
+                    : 10.0;
+    n = std::max(n + 1, static_cast<size_t>(n * scale));
+    elapsed = run_batch(bench, n);
+  }
+  std::vector<double> samples{};
+  double total = 0;
+  while (samples.size() < bench_max_samples &&
+         (samples.size() < bench_min_samples || total < min_time_ns)) {
+    const double batch = run_batch(bench, n);
+    samples.push_back(batch / n);
+    total += batch;
+  }
+  std::sort(samples.begin(), samples.end());
+  const size_t count = samples.size();
+  const double median = count % 2 ? samples[count / 2]
+                                   : (samples[count / 2 - 1] +
+                                      samples[count / 2]) /
+                                         2;
+  return {n * count, count, median, samples.front(),
+          total / static_cast<double>(n * count)};
+}
+
+// The cases slower than in the baseline by more than tolerance percent.
+static json find_regressions(const json &results, const json &baseline,
+                             const double tolerance) {
+  json regressions = json::array();
+  const auto previous = baseline.find("results");
+  if (previous == baseline.end() || !previous->is_array())
+    return regressions;
+  for (const auto &result : results) {
+    const auto name = result.value("name", "");
+    const auto it = std::find_if(
+        previous->begin(), previous->end(),
+        [&](const json &entry) { return entry.value("name", "") == name; });
+    if (it == previous->end())
+      continue;
+    const double before = it->value("median_ns", 0.0);
+    const double now = result.value("median_ns", 0.0);
+    if (before <= 0 || now <= before * (1 + tolerance / 100))
+      continue;
+    regressions.push_back({{"name", name},
+                           {"baseline_median_ns", before},
+                           {"median_ns", now},
+                           {"ratio", now / before}});
+  }
+  return regressions;
+}
+
+static std::vector<BenchCase> all_cases() {
+  std::vector<BenchCase> cases{};
+  bench_elf_cases(cases);
+  bench_spiral_cases(cases);
+  bench_pm_cases(cases);
+  bench_serialize_cases(cases);
+  bench_threadpool_cases(cases);
+  bench_logger_cases(cases);
+  return cases;
+}
+
+/**
+ * Runs the native micro-benchmarks.
+ * Usage: abbench [-l] [-f <filter>] [-t <ms>] [-o <file>]
+ *                [-b <baseline> [-r <percent>]]
+ *   -l: list the benchmarks
+ *   -f: only run the benchmarks whose name contains filter
+ *   -t: run each benchmark for at least this long (default: 200)
+ *   -o: write the results to the file instead of stdout
+ *   -b: fail if a benchmark is slower than in the results of an earlier run
+ *   -r: tolerated slowdown against the baseline (default: 25)
+ */
+static int abbench_builtin(WORD_LIST *list) {
+  bool list_only = false;
+  std::string filter{};
+  std::string output{};
+  std::string baseline_path{};
+  double min_time_ms = 200;
+  double tolerance = 25;
+  reset_internal_getopt();
+  int opt = 0;
+  while ((opt = internal_getopt(list, const_cast<char *>("lf:t:o:b:r:"))) !=
+         -1) {
+    switch (opt) {
+    case 'l':
+      list_only = true;
+      break;
+    case 'f':
+      filter = list_optarg;
+      break;
+    case 't':
+      min_time_ms = strtod(list_optarg, nullptr);
+      break;
+    case 'o':
+      output = list_optarg;
+      break;
+    case 'b':
+      baseline_path = list_optarg;
+      break;
+    case 'r':
+      tolerance = strtod(list_optarg, nullptr);
+      break;
+    default:
+      builtin_usage();
+      return EX_USAGE;
+    }
+  }
+  if (min_time_ms <= 0 || tolerance < 0) {
+    builtin_usage();
+    return EX_USAGE;
+  }
+  auto *logger = get_logger();
+  // keep stdout parseable
+  if (output.empty())
+    logger->setLogLevel(LogLevel::Warning);
+
+  json baseline{};
+  if (!baseline_path.empty()) {
+    std::ifstream file(baseline_path);
+    baseline = json::parse(file, nullptr, false);
+    if (!file.is_open() || baseline.is_discarded()) {
+      logger->errorf("Unable to read the baseline from {0}", baseline_path);
+      return 1;
+    }
+  }
+
+  int ret = 0;
+  json results = json::array();
+  for (const auto &bench : all_cases()) {
+    if (bench.name.find(filter) == std::string::npos)
+      continue;
+    if (list_only) {
+      std::cout << bench.name << '\n';
+      continue;
+    }
+    if (bench.setup && !bench.setup()) {
+      logger->errorf("{0}: setup failed", bench.name);
+      ret = 1;
+      continue;
+    }
+    const auto stats = run_case(bench, min_time_ms * 1e6);
+    if (bench.teardown)
+      bench.teardown();
+    json result{{"name", bench.name},
+                {"iterations", stats.iterations},
+                {"samples", stats.samples},
+                {"median_ns", stats.median_ns},
+                {"min_ns", stats.min_ns},
+                {"mean_ns", stats.mean_ns}};
+    if (bench.bytes > 0) {
+      result["bytes"] = bench.bytes;
+      result["mib_per_s"] = bench.bytes / stats.median_ns * 1e9 / 1048576;
+    }
+    logger->infof("{0}: {1:.1f} ns/op", bench.name, stats.median_ns);
+    results.push_back(std::move(result));
+  }
+  if (list_only)
+    return 0;
+
+  json report{{"version", ab_version},
+              {"arch", native_arch_name},
+              {"compiler", __VERSION__},
+#ifdef AB_INSTRUMENT
+              {"instrumented", true},
+#else
+              {"instrumented", false},
+#endif
+              {"time", static_cast<int64_t>(time(nullptr))},
+              {"min_time_ms", min_time_ms},
+              {"results", results}};
+  if (!baseline_path.empty()) {
+    const auto regressions = find_regressions(results, baseline, tolerance);
+    for (const auto &regression : regressions) {
+      logger->errorf("{0}: {1:.1f} ns/op, {2:.2f}x slower than the baseline",
+                     regression["name"].get<std::string>(),
+                     regression["median_ns"].get<double>(),
+                     regression["ratio"].get<double>());
+      ret = 1;
+    }
+    report["baseline"] = {{"version", baseline.value("version", "")},
+                          {"tolerance_percent", tolerance},
+                          {"regressions", regressions}};
+  }
+
+  if (output.empty()) {
+    std::cout << report.dump(2) << std::endl;
+    return ret;
+  }
+  std::ofstream file(output, std::ios::trunc);
+  file << report.dump(2) << '\n';
+  file.close();
+  if (file.fail()) {
+    logger->errorf("Unable to write to {0}: {1}", output, strerror(errno));
+    return 1;
+  }
+  return ret;
+}
+
+extern "C" {
+int abbench_builtin_load([[maybe_unused]] char *name) {
+  logger = reinterpret_cast<Logger *>(new PlainLogger());
+  return 1;
+}
+
+void abbench_builtin_unload([[maybe_unused]] char *name) {
+  delete get_logger();
+  logger = nullptr;
+}
+
+char *abbench_doc[] = {
+    const_cast<char *>("Runs the micro-benchmarks of the native code of "
+                       "autobuild and prints the results as JSON."),
+    nullptr};
+
+struct builtin abbench_struct = {
+    const_cast<char *>("abbench"),
+    abbench_builtin,
+    BUILTIN_ENABLED,
+    abbench_doc,
+    const_cast<char *>("abbench [-l] [-f filter] [-t ms] [-o file] "
+                       "[-b baseline [-r percent]]"),
+    nullptr,
+};
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// A micro-benchmark of the native code. run(n) performs n operations, and the
+// time per operation is reported. bytes is the size of the input of an
+// operation, reported as throughput when it is not 0.
+struct BenchCase {
+  std::string name;
+  uint64_t bytes;
+  std::function<void(size_t)> run;
+  // optional, called before the first run (returning false fails the case)
+  // and after the last one
+  std::function<bool()> setup;
+  std::function<void()> teardown;
+};
+
+// Keeps the compiler from optimizing away the computation of value.
+template <typename T> inline void bench_keep(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+void bench_elf_cases(std::vector<BenchCase> &cases);
+void bench_spiral_cases(std::vector<BenchCase> &cases);
+void bench_pm_cases(std::vector<BenchCase> &cases);
+void bench_serialize_cases(std::vector<BenchCase> &cases);
+void bench_threadpool_cases(std::vector<BenchCase> &cases);
+void bench_logger_cases(std::vector<BenchCase> &cases);
@@ -0,0 +1,412 @@
+#include "abbench.hpp"
+
+#include "abnativeelf.hpp"
+#include "abserialize.hpp"
+#include "abspiral.hpp"
+#include "logger.hpp"
+#include "pm.hpp"
+#include "threadpool.hpp"
+
+#include <atomic>
+#include <cstring>
+#include <elf.h>
+#include <iostream>
+#include <memory>
+#include <streambuf>
+#include <unordered_set>
+
+extern "C" {
+#include "bashincludes.h"
+}
+
+// defined in abspiral_data.cpp
+extern size_t lut_lookup(const char *soname, const uint32_t **provides);
+
+// ELF, archive and bitcode corpus
+
+class ElfWriter {
+public:
+  // the sections are written in order, with the section headers at the end
+  size_t add_section(const char *name, const uint32_t type,
+                     const std::string &data, const uint64_t entsize = 0,
+                     const uint32_t link = 0) {
+    while (m_data.size() % 8)
+      m_data += '\0';
+    Elf64_Shdr shdr{};
+    shdr.sh_name = m_shstrtab.size();
+    shdr.sh_type = type;
+    shdr.sh_offset = m_data.size();
+    shdr.sh_size = data.size();
+    // 8-byte aligned notes have a different layout
+    shdr.sh_addralign = type == SHT_NOTE ? 4 : 8;
+    shdr.sh_entsize = entsize;
+    shdr.sh_link = link;
+    m_shstrtab += name;
+    m_shstrtab += '\0';
+    m_data += data;
+    m_sections.push_back(shdr);
+    return m_sections.size() - 1;
+  }
+
+  std::string finish(const uint16_t type) {
+    const size_t shstrndx = add_section(".shstrtab", SHT_STRTAB, {});
+    m_sections[shstrndx].sh_size = m_shstrtab.size();
+    m_data += m_shstrtab;
+    while (m_data.size() % 8)
+      m_data += '\0';
+    Elf64_Ehdr ehdr{};
+    memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr.e_ident[EI_DATA] = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+                                ? ELFDATA2LSB
+                                : ELFDATA2MSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_type = type;
+    ehdr.e_machine = EM_X86_64;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+    ehdr.e_shentsize = sizeof(Elf64_Shdr);
+    ehdr.e_shnum = m_sections.size();
+    ehdr.e_shoff = m_data.size();
+    ehdr.e_shstrndx = shstrndx;
+    memcpy(&m_data[0], &ehdr, sizeof(ehdr));
+    m_data.append(reinterpret_cast<const char *>(m_sections.data()),
+                  m_sections.size() * sizeof(Elf64_Shdr));
+    return std::move(m_data);
+  }
+
+private:
+  std::string m_data = std::string(sizeof(Elf64_Ehdr), '\0');
+  std::string m_shstrtab{'\0'};
+  std::vector<Elf64_Shdr> m_sections{Elf64_Shdr{}};
+};
+
+template <typename T> static std::string as_bytes(const T *data, size_t n) {
+  return {reinterpret_cast<const char *>(data), n * sizeof(T)};
+}
+
+// A shared library (or object file) with the sections read by
+// identify_binary_data(): SONAME and NEEDED entries, a build ID, code, and
+// optionally debug info.
+static std::string make_elf(const uint16_t type, const size_t needed,
+                            const size_t text_size, const bool debug_info) {
+  ElfWriter elf{};
+  if (type == ET_DYN) {
+    std::string dynstr{'\0'};
+    std::vector<Elf64_Dyn> dynamic{};
+    dynamic.push_back({DT_SONAME, {dynstr.size()}});
+    dynstr += "libab4bench.so.1";
+    dynstr += '\0';
+    for (size_t i = 0; i < needed; i++) {
+      dynamic.push_back({DT_NEEDED, {dynstr.size()}});
+      dynstr += "libab4dep" + std::to_string(i) + ".so.1";
+      dynstr += '\0';
+    }
+    dynamic.push_back({DT_NULL, {0}});
+    const size_t dynstr_index = elf.add_section(".dynstr", SHT_STRTAB, dynstr);
+    elf.add_section(".dynamic", SHT_DYNAMIC,
+                    as_bytes(dynamic.data(), dynamic.size()),
+                    sizeof(Elf64_Dyn), dynstr_index);
+  }
+  Elf64_Nhdr nhdr{4, 20, NT_GNU_BUILD_ID};
+  std::string note = as_bytes(&nhdr, 1) + std::string("GNU\0", 4);
+  for (uint8_t i = 0; i < 20; i++)
+    note += static_cast<char>(i * 13);
+  elf.add_section(".note.gnu.build-id", SHT_NOTE, note);
+  elf.add_section(".text", SHT_PROGBITS, std::string(text_size, '\x90'));
+  if (debug_info) {
+    for (const char *name : {".debug_info", ".debug_line", ".debug_str"})
+      elf.add_section(name, SHT_PROGBITS, std::string(text_size / 2, '\0'));
+  }
+  return elf.finish(type);
+}
+
+static std::string make_archive(const std::string &member) {
+  char header[61]{};
+  snprintf(header, sizeof(header), "%-16s%-12s%-6s%-6s%-8s%-10zu`\n",
+           "bench.o/", "0", "0", "0", "644", member.size());
+  return std::string("!<arch>\n") + header + member;
+}
+
+static std::string make_bitcode(const size_t size) {
+  std::string bitcode("BC\xC0\xDE", 4);
+  bitcode.resize(size, '\x35');
+  return bitcode;
+}
+
+struct CorpusFile {
+  std::string data;
+  BinaryType type;
+};
+
+static BenchCase identify_case(std::string name,
+                               std::vector<CorpusFile> corpus) {
+  auto files = std::make_shared<std::vector<CorpusFile>>(std::move(corpus));
+  uint64_t bytes = 0;
+  for (const auto &file : *files)
+    bytes += file.data.size();
+  bytes /= files->size();
+  return {std::move(name), bytes,
+          [files](const size_t n) {
+            for (size_t i = 0; i < n; i++) {
+              const auto &file = (*files)[i % files->size()].data;
+              const auto result =
+                  identify_binary_data(file.data(), file.size());
+              bench_keep(result.bin_type);
+            }
+          },
+          // the corpus must take the intended code paths
+          [files] {
+            for (const auto &file : *files) {
+              if (identify_binary_data(file.data.data(), file.data.size())
+                      .bin_type != file.type)
+                return false;
+            }
+            return true;
+          },
+          {}};
+}
+
+void bench_elf_cases(std::vector<BenchCase> &cases) {
+  const auto library = make_elf(ET_DYN, 8, 64 * 1024, false);
+  const auto library_debug = make_elf(ET_DYN, 8, 64 * 1024, true);
+  const auto object = make_elf(ET_REL, 0, 16 * 1024, true);
+  const auto archive = make_archive(object);
+  const auto bitcode = make_bitcode(16 * 1024);
+  cases.push_back(identify_case("elf/identify-shared",
+                                {{library, BinaryType::Dynamic}}));
+  cases.push_back(identify_case("elf/identify-shared-debug",
+                                {{library_debug, BinaryType::Dynamic}}));
+  cases.push_back(identify_case("elf/identify-object",
+                                {{object, BinaryType::Relocatable}}));
+  cases.push_back(
+      identify_case("elf/identify-archive", {{archive, BinaryType::Static}}));
+  cases.push_back(
+      identify_case("elf/identify-bitcode", {{bitcode, BinaryType::LLVM_IR}}));
+  // roughly the mix of a library package
+  std::vector<CorpusFile> mixed{};
+  for (int i = 0; i < 6; i++)
+    mixed.push_back({i % 2 ? library : library_debug, BinaryType::Dynamic});
+  mixed.push_back({object, BinaryType::Relocatable});
+  mixed.push_back({object, BinaryType::Relocatable});
+  mixed.push_back({archive, BinaryType::Static});
+  mixed.push_back({bitcode, BinaryType::LLVM_IR});
+  cases.push_back(identify_case("elf/identify-mixed", std::move(mixed)));
+}
+
+// Spiral
+
+static const std::vector<std::string> bench_sonames{
+    "libc.so.6",     "libz.so.1",        "libssl.so.3",
+    "libstdc++.so.6", "libglib-2.0.so.0", "libQt5Core.so.5",
+    "libgtk-3.so.0", "libX11.so.6",      "libcurl.so.4",
+};
+
+void bench_spiral_cases(std::vector<BenchCase> &cases) {
+  // the sonames found in the LUT, which depends on the generated data
+  auto hits = std::make_shared<std::vector<std::string>>();
+  cases.push_back({"spiral/lut-lookup-hit", 0,
+                   [hits](const size_t n) {
+                     const uint32_t *provides = nullptr;
+                     for (size_t i = 0; i < n; i++) {
+                       const auto &soname = (*hits)[i % hits->size()];
+                       bench_keep(lut_lookup(soname.c_str(), &provides));
+                     }
+                   },
+                   [hits] {
+                     hits->clear();
+                     const uint32_t *provides = nullptr;
+                     for (const auto &soname : bench_sonames) {
+                       if (lut_lookup(soname.c_str(), &provides) > 0)
+                         hits->push_back(soname);
+                     }
+                     return !hits->empty();
+                   },
+                   {}});
+  cases.push_back({"spiral/lut-lookup-miss", 0, [](const size_t n) {
+                     const uint32_t *provides = nullptr;
+                     for (size_t i = 0; i < n; i++) {
+                       bench_keep(lut_lookup(i % 2 ? "libab4bench.so.1"
+                                                   : "libab4bench-missing.so",
+                                             &provides));
+                     }
+                   }});
+  // what a package with a dozen libraries asks for, half of them with an
+  // architecture suffix
+  std::vector<std::string> sonames{};
+  for (size_t i = 0; i < bench_sonames.size(); i++)
+    sonames.push_back(i % 2 ? bench_sonames[i] + ":amd64" : bench_sonames[i]);
+  sonames.emplace_back("libab4bench.so.1");
+  cases.push_back({"spiral/from-sonames", 0, [sonames](const size_t n) {
+                     for (size_t i = 0; i < n; i++) {
+                       std::unordered_set<std::string> provides{};
+                       spiral_from_sonames(sonames, provides);
+                       bench_keep(provides.size());
+                     }
+                   }});
+}
+
+// Package manager
+
+void bench_pm_cases(std::vector<BenchCase> &cases) {
+  static const std::vector<std::string> versions{
+      "glibc>=2.37",        "gcc-runtime",       "python-3<=3.12.0",
+      "openssl==1:3.1.4-1", "qt-5>=5.15.10+git", "linux-kernel<<6.6",
+      "zlib>>1.2",          "libab4bench",
+  };
+  cases.push_back({"pm/deb-version", 0, [](const size_t n) {
+                     for (size_t i = 0; i < n; i++) {
+                       bench_keep(autobuild_to_deb_version(
+                           versions[i % versions.size()]));
+                     }
+                   }});
+}
+
+// Serialization of the shell variables
+
+static BenchCase serialize_array_case(const size_t elements) {
+  const std::string name = "__ABBENCH_ARRAY_" + std::to_string(elements);
+  // "element-000000"
+  const uint64_t bytes = elements * 14;
+  return {"serialize/array-" + std::to_string(elements), bytes,
+          [name](const size_t n) {
+            const std::vector<std::string> variables{name};
+            for (size_t i = 0; i < n; i++)
+              bench_keep(autobuild_serialized_variables(variables));
+          },
+          [name, elements] {
+            auto *var =
+                make_new_array_variable(const_cast<char *>(name.c_str()));
+            if (!var)
+              return false;
+            auto *var_a = array_cell(var);
+            char element[32]{};
+            for (size_t i = 0; i < elements; i++) {
+              snprintf(element, sizeof(element), "element-%06zu", i);
+              array_insert(var_a, static_cast<arrayind_t>(i), element);
+            }
+            return true;
+          },
+          [name] { unbind_variable(name.c_str()); }};
+}
+
+void bench_serialize_cases(std::vector<BenchCase> &cases) {
+  cases.push_back(serialize_array_case(1000));
+  cases.push_back(serialize_array_case(100000));
+  // the variables of a typical defines file
+  constexpr size_t scalars = 100;
+  auto names = std::make_shared<std::vector<std::string>>();
+  for (size_t i = 0; i < scalars; i++)
+    names->push_back("__ABBENCH_SCALAR_" + std::to_string(i));
+  cases.push_back({"serialize/scalars-" + std::to_string(scalars), scalars * 64,
+                   [names](const size_t n) {
+                     for (size_t i = 0; i < n; i++)
+                       bench_keep(autobuild_serialized_variables(*names));
+                   },
+                   [names] {
+                     const std::string value(64, 'v');
+                     for (const auto &name : *names) {
+                       if (!bind_variable(name.c_str(),
+                                          const_cast<char *>(value.c_str()), 0))
+                         return false;
+                     }
+                     return true;
+                   },
+                   [names] {
+                     for (const auto &name : *names)
+                       unbind_variable(name.c_str());
+                   }});
+}
+
+// Thread pool, an operation is a task which spins for some iterations, the
+// pool being started and stopped once per batch of tasks
+
+static uint64_t spin(uint64_t state, const size_t iterations) {
+  for (size_t i = 0; i < iterations; i++) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+  }
+  return state;
+}
+
+static BenchCase threadpool_case(const size_t iterations) {
+  return {"threadpool/spin-" + std::to_string(iterations), 0,
+          [iterations](const size_t n) {
+            std::atomic<uint64_t> sink{0};
+            ThreadPool<uint64_t, void> pool{[&](uint64_t &seed) {
+              sink.fetch_add(spin(seed + 1, iterations),
+                             std::memory_order_relaxed);
+            }};
+            for (size_t i = 0; i < n; i++)
+              pool.enqueue(uint64_t{i});
+            pool.wait_for_completion();
+            bench_keep(sink.load());
+          }};
+}
+
+void bench_threadpool_cases(std::vector<BenchCase> &cases) {
+  for (const size_t iterations : {0, 1000, 100000})
+    cases.push_back(threadpool_case(iterations));
+}
+
+// Loggers, writing to a discarded stdout
+
+class NullStreamBuf final : public std::streambuf {
+protected:
+  int overflow(const int ch) override { return ch; }
+  std::streamsize xsputn(const char *, const std::streamsize n) override {
+    return n;
+  }
+};
+
+class DiscardStdout {
+public:
+  DiscardStdout() : m_previous{std::cout.rdbuf(&m_buf)} {}
+  ~DiscardStdout() { std::cout.rdbuf(m_previous); }
+
+private:
+  NullStreamBuf m_buf;
+  std::streambuf *m_previous;
+};
+
+static const std::string bench_message =
+    "Stripping /usr/lib/libab4bench.so.1 (64 KiB)";
+
+template <typename L> static BenchCase logger_info_case(std::string name) {
+  return {std::move(name), bench_message.size(), [](const size_t n) {
+            const DiscardStdout discard{};
+            L logger{};
+            for (size_t i = 0; i < n; i++)
+              logger.info(bench_message);
+          }};
+}
+
+static BenchCase logger_debugf_case(std::string name, const LogLevel level) {
+  return {std::move(name), bench_message.size(), [level](const size_t n) {
+            const DiscardStdout discard{};
+            PlainLogger logger{};
+            logger.setLogLevel(level);
+            for (size_t i = 0; i < n; i++)
+              logger.debugf("Stripping {0} ({1} KiB)",
+                            "/usr/lib/libab4bench.so.1", i);
+          }};
+}
+
+void bench_logger_cases(std::vector<BenchCase> &cases) {
+  cases.push_back(logger_info_case<PlainLogger>("logger/plain-info"));
+  cases.push_back(logger_info_case<ColorfulLogger>("logger/colorful-info"));
+  cases.push_back(logger_info_case<JsonLogger>("logger/json-info"));
+  cases.push_back({"logger/json-fields", bench_message.size(),
+                   [](const size_t n) {
+                     const DiscardStdout discard{};
+                     JsonLogger logger{};
+                     const LogFields fields{{"bytes", 65536}, {"us", 1200}};
+                     for (size_t i = 0; i < n; i++)
+                       logger.logFields(LogLevel::Info, bench_message, fields);
+                   }});
+  cases.push_back(logger_debugf_case("logger/debugf", LogLevel::Debug));
+  // formatting is skipped below the log level
+  cases.push_back(
+      logger_debugf_case("logger/debugf-filtered", LogLevel::Warning));
+}
@@ -0,0 +1,417 @@
+// Generates a synthetic PKGDIR to benchmark the post-build stages with, see
+// bench-pkgdir.sh. The tree is the same for the same counts and seed, apart
+// from the ELF files which are copied from the given seed binaries (with a
+// build ID unique to each copy).
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <elf.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using json = nlohmann::json;
+
+struct EntryKind {
+  const char *name;
+  // share of the entries when only the total is given, per thousand
+  unsigned int weight;
+};
+
+// the mix of a large library package
+static const EntryKind entry_kinds[] = {
+    {"libs", 20},     {"exes", 10},      {"archives", 10}, {"la", 10},
+    {"pdb", 2},       {"man", 100},      {"info", 5},      {"symlinks", 40},
+    {"hardlinks", 10}, {"data", 793},
+};
+constexpr size_t entry_kind_count = std::size(entry_kinds);
+// data files per directory
+constexpr size_t data_per_directory = 1000;
+
+enum EntryKindIndex {
+  Libs,
+  Exes,
+  Archives,
+  La,
+  Pdb,
+  Man,
+  Info,
+  Symlinks,
+  Hardlinks,
+  Data,
+};
+
+struct GenContext {
+  std::string root;
+  uint64_t seed;
+  uint64_t state;
+  size_t counts[entry_kind_count];
+  size_t created;
+  uint64_t bytes;
+  std::string library;
+  std::string executable;
+};
+
+static uint64_t gen_random(GenContext &context) {
+  // xorshift64*
+  context.state ^= context.state >> 12;
+  context.state ^= context.state << 25;
+  context.state ^= context.state >> 27;
+  return context.state * 0x2545F4914F6CDD1DULL;
+}
+
+static bool make_directories(const std::string &path) {
+  for (size_t pos = path.find('/', 1); pos != std::string::npos;
+       pos = path.find('/', pos + 1)) {
+    if (mkdir(path.substr(0, pos).c_str(), 0755) != 0 && errno != EEXIST)
+      return false;
+  }
+  return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+static bool write_file(GenContext &context, const std::string &relative,
+                       const std::string &content, const mode_t mode) {
+  const std::string path = context.root + "/" + relative;
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                      mode);
+  if (fd < 0) {
+    perror(path.c_str());
+    return false;
+  }
+  const char *data = content.data();
+  size_t size = content.size();
+  while (size > 0) {
+    const ssize_t ret = write(fd, data, size);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0) {
+      perror(path.c_str());
+      close(fd);
+      return false;
+    }
+    data += ret;
+    size -= ret;
+  }
+  close(fd);
+  // not affected by the umask
+  chmod(path.c_str(), mode);
+  context.created++;
+  context.bytes += content.size();
+  return true;
+}
+
+static std::string filler_text(GenContext &context, const size_t min_size,
+                               const size_t max_size) {
+  static const char *words[] = {"autobuild", "package", "library", "option",
+                                "default",   "file",    "build",   "see",
+                                "manual",    "the",     "of",      "to"};
+  const size_t size = min_size + gen_random(context) % (max_size - min_size);
+  std::string text{};
+  text.reserve(size + 16);
+  while (text.size() < size) {
+    text += words[gen_random(context) % std::size(words)];
+    text += (gen_random(context) % 12) ? ' ' : '\n';
+  }
+  text += '\n';
+  return text;
+}
+
+template <typename Ehdr, typename Shdr, typename Nhdr>
+static bool patch_build_id(std::string &elf, const uint64_t id) {
+  if (elf.size() < sizeof(Ehdr))
+    return false;
+  Ehdr ehdr{};
+  memcpy(&ehdr, elf.data(), sizeof(ehdr));
+  for (size_t i = 0; i < ehdr.e_shnum; i++) {
+    const size_t offset = ehdr.e_shoff + i * sizeof(Shdr);
+    if (offset + sizeof(Shdr) > elf.size())
+      return false;
+    Shdr shdr{};
+    memcpy(&shdr, elf.data() + offset, sizeof(shdr));
+    if (shdr.sh_type != SHT_NOTE || shdr.sh_offset + shdr.sh_size > elf.size())
+      continue;
+    // the notes are 4-byte aligned
+    size_t pos = shdr.sh_offset;
+    const size_t end = shdr.sh_offset + shdr.sh_size;
+    while (pos + sizeof(Nhdr) <= end) {
+      Nhdr nhdr{};
+      memcpy(&nhdr, elf.data() + pos, sizeof(nhdr));
+      const size_t desc = pos + sizeof(Nhdr) + ((nhdr.n_namesz + 3) & ~3u);
+      if (nhdr.n_type == NT_GNU_BUILD_ID && nhdr.n_descsz >= sizeof(id) &&
+          desc + nhdr.n_descsz <= end) {
+        for (size_t j = 0; j < sizeof(id); j++)
+          elf[desc + j] ^= static_cast<char>(id >> (j * 8));
+        return true;
+      }
+      pos = desc + ((nhdr.n_descsz + 3) & ~3u);
+    }
+  }
+  return false;
+}
+
+// A copy of the seed binary, with a build ID of its own so that the debug
+// symbols are saved to different files.
+static std::string unique_elf(const std::string &seed, const uint64_t id) {
+  std::string elf{seed};
+  if (elf.size() > EI_CLASS && elf[EI_CLASS] == ELFCLASS32)
+    patch_build_id<Elf32_Ehdr, Elf32_Shdr, Elf32_Nhdr>(elf, id);
+  else
+    patch_build_id<Elf64_Ehdr, Elf64_Shdr, Elf64_Nhdr>(elf, id);
+  return elf;
+}
+
+static bool read_seed(const char *path, std::string &content) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) {
+    perror(path);
+    return false;
+  }
+  content.assign(std::istreambuf_iterator<char>(file),
+                 std::istreambuf_iterator<char>());
+  if (content.size() < SELFMAG || memcmp(content.data(), ELFMAG, SELFMAG)) {
+    fprintf(stderr, "%s: not an ELF file\n", path);
+    return false;
+  }
+  return true;
+}
+
+static std::string data_path(const size_t index) {
+  return "usr/share/ab4-bench/" + std::to_string(index / data_per_directory) +
+         "/data" + std::to_string(index) + ".txt";
+}
+
+static bool gen_tree(GenContext &context) {
+  const size_t *counts = context.counts;
+  for (const char *directory :
+       {"usr/bin", "usr/lib/ab4-bench", "usr/share/man/man1",
+        "usr/share/man/man3", "usr/share/man/man5", "usr/share/man/man8",
+        "usr/share/info", "usr/share/ab4-bench"}) {
+    if (!make_directories(context.root + "/" + directory)) {
+      perror(directory);
+      return false;
+    }
+  }
+  uint64_t build_id = 1;
+  for (size_t i = 0; i < counts[Libs]; i++) {
+    if (!write_file(context, "usr/lib/libab4gen" + std::to_string(i) +
+                                 ".so.1.0.0",
+                    unique_elf(context.library, build_id++), 0755))
+      return false;
+  }
+  for (size_t i = 0; i < counts[Exes]; i++) {
+    if (!write_file(context, "usr/bin/ab4gen" + std::to_string(i),
+                    unique_elf(context.executable, build_id++), 0755))
+      return false;
+  }
+  for (size_t i = 0; i < counts[Archives]; i++) {
+    char header[61]{};
+    const std::string member = filler_text(context, 512, 4096);
+    snprintf(header, sizeof(header), "%-16s%-12s%-6s%-6s%-8s%-10zu`\n",
+             "ab4gen.o/", "0", "0", "0", "644", member.size());
+    if (!write_file(context, "usr/lib/libab4gen" + std::to_string(i) + ".a",
+                    std::string("!<arch>\n") + header + member, 0644))
+      return false;
+  }
+  for (size_t i = 0; i < counts[La]; i++) {
+    const std::string name = "libab4gen" + std::to_string(i);
+    if (!write_file(context, "usr/lib/" + name + ".la",
+                    "# " + name + ".la - a libtool library file\n"
+                    "dlname='" + name + ".so.1'\n"
+                    "library_names='" + name + ".so.1.0.0 " + name +
+                        ".so.1 " + name + ".so'\n"
+                    "old_library='" + name + ".a'\n"
+                    "libdir='/usr/lib'\n",
+                    0644))
+      return false;
+  }
+  for (size_t i = 0; i < counts[Pdb]; i++) {
+    if (!write_file(context,
+                    "usr/lib/ab4-bench/ab4gen" + std::to_string(i) + ".pdb",
+                    "Microsoft C/C++ MSF 7.00\r\n\x1a" "DS" +
+                        filler_text(context, 1024, 8192),
+                    0644))
+      return false;
+  }
+  static const char sections[] = {'1', '3', '5', '8'};
+  for (size_t i = 0; i < counts[Man]; i++) {
+    const char section = sections[i % std::size(sections)];
+    const std::string name = "ab4gen" + std::to_string(i);
+    if (!write_file(context,
+                    std::string("usr/share/man/man") + section + "/" + name +
+                        "." + section,
+                    ".TH " + name + " " + section + "\n.SH NAME\n" + name +
+                        "\n.SH DESCRIPTION\n" +
+                        filler_text(context, 1024, 8192),
+                    0644))
+      return false;
+  }
+  for (size_t i = 0; i < counts[Info]; i++) {
+    if (!write_file(context,
+                    "usr/share/info/ab4gen" + std::to_string(i) + ".info",
+                    "This is ab4gen.info.\n\n\x1f\nFile: ab4gen.info\n" +
+                        filler_text(context, 4096, 32768),
+                    0644))
+      return false;
+  }
+  for (size_t i = 0; i < counts[Data]; i++) {
+    const std::string path = data_path(i);
+    if (i % data_per_directory == 0 &&
+        !make_directories(context.root + "/" +
+                          path.substr(0, path.rfind('/')))) {
+      perror(path.c_str());
+      return false;
+    }
+    if (!write_file(context, path, filler_text(context, 64, 4096), 0644))
+      return false;
+  }
+  // the links point to the libraries and executables, or to the data files
+  // in packages without any
+  for (size_t i = 0; i < counts[Symlinks]; i++) {
+    std::string link{};
+    std::string target{};
+    if (counts[Libs] > 0) {
+      const std::string name = "libab4gen" + std::to_string(i % counts[Libs]);
+      // libfoo.so.1 and libfoo.so, then more aliases
+      const size_t round = i / counts[Libs];
+      link = "usr/lib/" + name +
+             (round == 0   ? ".so.1"
+              : round == 1 ? ".so"
+                           : ".so.alias" + std::to_string(round));
+      target = name + ".so.1.0.0";
+    } else if (counts[Data] > 0) {
+      link = "usr/share/ab4-bench/link" + std::to_string(i);
+      // relative to usr/share/ab4-bench
+      target = data_path(i % counts[Data]).substr(20);
+    } else {
+      break;
+    }
+    if (symlink(target.c_str(), (context.root + "/" + link).c_str()) != 0) {
+      perror(link.c_str());
+      return false;
+    }
+    context.created++;
+  }
+  for (size_t i = 0; i < counts[Hardlinks]; i++) {
+    std::string link{};
+    std::string target{};
+    if (counts[Exes] > 0) {
+      link = "usr/bin/ab4gen-alias" + std::to_string(i);
+      target = "usr/bin/ab4gen" + std::to_string(i % counts[Exes]);
+    } else if (counts[Data] > 0) {
+      link = "usr/share/ab4-bench/hardlink" + std::to_string(i);
+      target = data_path(i % counts[Data]);
+    } else {
+      break;
+    }
+    if (::link((context.root + "/" + target).c_str(),
+               (context.root + "/" + link).c_str()) != 0) {
+      perror(link.c_str());
+      return false;
+    }
+    context.created++;
+  }
+  return true;
+}
+
+static void gen_usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [-n <entries>] [-s <seed>] [-l <library>] "
+          "[-e <executable>] <pkgdir> [<kind>=<count>...]\n"
+          "Kinds:",
+          argv0);
+  for (const auto &kind : entry_kinds)
+    fprintf(stderr, " %s", kind.name);
+  fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[]) {
+  GenContext context{};
+  context.seed = 1;
+  size_t total = 0;
+  const char *library = nullptr;
+  const char *executable = nullptr;
+  bool explicit_count[entry_kind_count]{};
+  for (int i = 1; i < argc; i++) {
+    const bool has_value = (i + 1) < argc;
+    if (strcmp(argv[i], "-n") == 0 && has_value) {
+      total = strtoull(argv[++i], nullptr, 10);
+      continue;
+    }
+    if (strcmp(argv[i], "-s") == 0 && has_value) {
+      context.seed = strtoull(argv[++i], nullptr, 10);
+      continue;
+    }
+    if (strcmp(argv[i], "-l") == 0 && has_value) {
+      library = argv[++i];
+      continue;
+    }
+    if (strcmp(argv[i], "-e") == 0 && has_value) {
+      executable = argv[++i];
+      continue;
+    }
+    const char *equal = strchr(argv[i], '=');
+    if (!equal) {
+      if (!context.root.empty()) {
+        gen_usage(argv[0]);
+        return 2;
+      }
+      context.root = argv[i];
+      continue;
+    }
+    const std::string name(argv[i], equal - argv[i]);
+    size_t kind = 0;
+    while (kind < entry_kind_count && name != entry_kinds[kind].name)
+      kind++;
+    if (kind == entry_kind_count) {
+      fprintf(stderr, "Unknown kind of entries: %s\n", name.c_str());
+      gen_usage(argv[0]);
+      return 2;
+    }
+    context.counts[kind] = strtoull(equal + 1, nullptr, 10);
+    explicit_count[kind] = true;
+  }
+  if (context.root.empty()) {
+    gen_usage(argv[0]);
+    return 2;
+  }
+  for (size_t kind = 0; kind < entry_kind_count; kind++) {
+    if (!explicit_count[kind])
+      context.counts[kind] = total * entry_kinds[kind].weight / 1000;
+  }
+  if ((context.counts[Libs] > 0 || context.counts[Exes] > 0) &&
+      (!library || !executable)) {
+    fprintf(stderr, "Seed binaries (-l and -e) are needed for ELF files\n");
+    return 2;
+  }
+  if (library && !read_seed(library, context.library))
+    return 1;
+  if (executable && !read_seed(executable, context.executable))
+    return 1;
+
+  // xorshift needs a state other than 0
+  context.state = context.seed * 2 + 1;
+  if (!make_directories(context.root)) {
+    perror(context.root.c_str());
+    return 1;
+  }
+  if (!gen_tree(context))
+    return 1;
+
+  json counts = json::object();
+  for (size_t kind = 0; kind < entry_kind_count; kind++)
+    counts[entry_kinds[kind].name] = context.counts[kind];
+  const json summary{{"pkgdir", context.root},
+                     {"seed", context.seed},
+                     {"entries", context.created},
+                     {"bytes", context.bytes},
+                     {"counts", counts}};
+  printf("%s\n", summary.dump().c_str());
+  return 0;
+}
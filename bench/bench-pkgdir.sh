@@ -0,0 +1,166 @@
+#!/bin/bash
+##bench-pkgdir.sh: Times the post-build stages against synthetic PKGDIRs
+##@copyright GPL-2.0+
+#
+# Usage: bench-pkgdir.sh -a <libautobuild.so> -g <ab4-pkgdir-gen>
+#            [-o <results>] [-w <workdir>] [-s <seed>] [-t <stage>]...
+#            <entries>...
+#
+# For each number of entries, a PKGDIR is generated by ab4-pkgdir-gen, and
+# each stage is run against a fresh copy of it:
+#
+#   filters: proc/51-filters.sh (all the filters, ELF included)
+#   qa:      proc/75-qa-post-build.sh
+#   elf:     abelf_copy_dbg_parallel over the PKGDIR manifest, as called by
+#            filters/80-elf.sh
+#
+# The wall time of the stages is saved as JSON (pkgdir-scaling.json by
+# default), and their output to <workdir>/<stage>-<entries>.log. The ELF
+# files are copied from small binaries built with $CC, or from
+# $ABBENCH_LIB_SEED and $ABBENCH_EXE_SEED.
+
+bench_usage() {
+	sed -n '5,7s/^# //p' "${BASH_SOURCE[0]}" >&2
+	exit 2
+}
+
+_ab_lib=
+_gen=
+_output="$PWD/pkgdir-scaling.json"
+_work=
+_seed=1
+_stages=()
+while getopts 'a:g:o:w:s:t:' _opt; do
+	case "$_opt" in
+		a) _ab_lib="$(realpath "$OPTARG")" ;;
+		g) _gen="$(realpath "$OPTARG")" ;;
+		o) _output="$(realpath "$OPTARG")" ;;
+		w) _work="$OPTARG" ;;
+		s) _seed="$OPTARG" ;;
+		t) _stages+=("$OPTARG") ;;
+		*) bench_usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+if [ -z "$_ab_lib" ] || [ -z "$_gen" ] || (($# == 0)); then
+	bench_usage
+fi
+if ((${#_stages[@]} == 0)); then
+	_stages=(filters qa elf)
+fi
+
+AB="${AB:-$(realpath "$(dirname "${BASH_SOURCE[0]}")/..")}"
+export AB
+enable -f "$_ab_lib" autobuild || exit 1
+
+_keep_work=1
+if [ -z "$_work" ]; then
+	_work="$(mktemp -d)" || exit 1
+	_keep_work=0
+fi
+mkdir -p "$_work" || exit 1
+_work="$(realpath "$_work")"
+
+# ELF seeds, with debug info so that there is something to split
+if [ -z "$ABBENCH_LIB_SEED" ] || [ -z "$ABBENCH_EXE_SEED" ]; then
+	abinfo "Building the ELF seeds with ${CC:-cc} ..."
+	cat > "$_work"/seed.c << 'EOF'
+int ab4bench_seed(int x) { return x * 3 + 1; }
+int main(void) { return ab4bench_seed(0) != 1; }
+EOF
+	"${CC:-cc}" -g -O2 -fPIC -shared -Wl,--build-id \
+		-o "$_work"/libseed.so "$_work"/seed.c \
+		|| abdie "Unable to build the ELF seeds, set ABBENCH_LIB_SEED and ABBENCH_EXE_SEED instead."
+	"${CC:-cc}" -g -O2 -Wl,--build-id -o "$_work"/seed "$_work"/seed.c \
+		|| abdie "Unable to build the ELF seeds, set ABBENCH_LIB_SEED and ABBENCH_EXE_SEED instead."
+	ABBENCH_LIB_SEED="$_work"/libseed.so
+	ABBENCH_EXE_SEED="$_work"/seed
+fi
+
+# The environment the stages expect, as set up by proc/01-core-defines.sh
+SRCDIR="$_work"
+PKGDIR="$_work/abdist"
+SYMDIR="$_work/abdist-dbg"
+export SRCDIR PKGDIR SYMDIR
+shopt -s expand_aliases extglob globstar nullglob
+load_strict "$AB"/lib/default-paths.sh
+load_strict "$AB"/lib/default-defines.sh
+load_strict "$AB"/lib/builtin.sh
+. "$AB"/proc/20-register-funcs.sh
+
+bench_stage_filters() {
+	. "$AB"/proc/51-filters.sh
+}
+
+bench_stage_qa() {
+	. "$AB"/proc/75-qa-post-build.sh
+}
+
+bench_stage_elf() {
+	local _elf_path=()
+	abmanifest_build "$PKGDIR" || return 1
+	for p in "${BIN_DIRS[@]}"; do
+		if [ -d "$PKGDIR/$p" ]; then
+			_elf_path+=("$PKGDIR/$p")
+		fi
+	done
+	abelf_copy_dbg_parallel "${_elf_path[@]}" "$SYMDIR"
+}
+
+# microseconds since the epoch
+bench_now() {
+	echo "${EPOCHREALTIME/[.,]/}"
+}
+
+_failed=0
+_results=()
+for _entries in "$@"; do
+	_pristine="$_work/pristine-$_entries"
+	rm -rf "$_pristine"
+	abinfo "Generating a PKGDIR with $_entries entries ..."
+	_start="$(bench_now)"
+	_tree="$("$_gen" -n "$_entries" -s "$_seed" \
+		-l "$ABBENCH_LIB_SEED" -e "$ABBENCH_EXE_SEED" "$_pristine")" \
+		|| abdie "Failed to generate the PKGDIR: $?."
+	_generate_us=$(($(bench_now) - _start))
+
+	_stage_results=()
+	for _stage in "${_stages[@]}"; do
+		if ! ab_typecheck -f "bench_stage_$_stage"; then
+			abdie "Unknown stage: $_stage"
+		fi
+		rm -rf "$PKGDIR" "$SYMDIR" "$SRCDIR"/abqaerr.log "$SRCDIR"/abqawarn.log
+		cp -a "$_pristine" "$PKGDIR" || abdie "Failed to copy the PKGDIR: $?."
+		abinfo "Running $_stage against $_entries entries ..."
+		_start="$(bench_now)"
+		# abdie exits the subshell only
+		( cd "$PKGDIR" && "bench_stage_$_stage" ) \
+			> "$_work/$_stage-$_entries.log" 2>&1
+		_status=$?
+		_elapsed_us=$(($(bench_now) - _start))
+		if ((_status != 0)); then
+			abwarn "$_stage failed against $_entries entries with status $_status, see $_work/$_stage-$_entries.log"
+			_failed=1
+		fi
+		_remaining="$(find "$PKGDIR" -mindepth 1 | wc -l)"
+		_stage_results+=("{\"stage\":\"$_stage\",\"us\":$_elapsed_us,\"status\":$_status,\"entries_after\":$_remaining}")
+		abinfo "$_stage: $((_elapsed_us / 1000)) ms"
+	done
+	rm -rf "$_pristine" "$PKGDIR" "$SYMDIR"
+
+	IFS=,
+	_results+=("{\"entries\":$_entries,\"generate_us\":$_generate_us,\"tree\":$_tree,\"stages\":[${_stage_results[*]}]}")
+	unset IFS
+done
+
+IFS=,
+printf '{"seed":%s,"nproc":%s,"results":[%s]}\n' \
+	"$_seed" "$(nproc)" "${_results[*]}" > "$_output"
+unset IFS
+abinfo "Results saved to $_output"
+
+# the logs tell why a stage failed
+if ((!_keep_work && !_failed)); then
+	rm -rf "$_work"
+fi
+exit "$_failed"
@@ -59,6 +59,48 @@ def parse_ubuntu_contents(
         parse_contents_chunk(file_str, out)
 
 
+def t64_alias(package: str) -> Optional[str]:
+    # Package names can't just be t64 and considered a suffix, a suffixed
+    # package name should always have a length of >= 4.
+    if len(package) >= 4 and package.endswith('t64'):
+        return package[:-3]
+    return None
+
+
+def write_lut(lut: Dict[str, Set[str]], target_path: Path):
+    # Expand the t64 aliases and de-duplicate package names at generation time,
+    # so that the runtime lookup only needs to read the pre-split indices.
+    provides: Dict[str, List[str]] = dict()
+    for key, packages in lut.items():
+        expanded = set(packages)
+        for pkg in packages:
+            alias = t64_alias(pkg)
+            if alias is not None:
+                expanded.add(alias)
+        provides[key] = sorted(expanded)
+    pool = sorted({pkg for v in provides.values() for pkg in v})
+    pool_index = {pkg: idx for (idx, pkg) in enumerate(pool)}
+    # Sort by bytes to keep the output reproducible
+    keys = sorted(provides.keys(), key=lambda k: k.encode('utf-8'))
+    offset = 0
+    indices: List[str] = []
+    entries: List[str] = []
+    for key in keys:
+        pkgs = provides[key]
+        indices.append(''.join(['{},'.format(pool_index[pkg]) for pkg in pkgs]))
+        entries.append('{{"{}",{},{}}},'.format(key, offset, len(pkgs)))
+        offset += len(pkgs)
+    with open(target_path, 'w') as target_file:
+        target_file.write('// Generated Spiral LUT, do not edit.\n')
+        target_file.write('constexpr const char *spiral_packages[] = {\n')
+        target_file.write('\n'.join(['"{}",'.format(pkg) for pkg in pool]))
+        target_file.write('\n};\nconstexpr uint32_t spiral_provides[] = {\n')
+        target_file.write('\n'.join(indices))
+        target_file.write('\n};\nconstexpr SpiralLutEntry spiral_sonames[] = {\n')
+        target_file.write('\n'.join(entries))
+        target_file.write('\n};\n')
+
+
 if __name__ == '__main__':
     target_path = Path(os.path.dirname(__file__)) / 'data' / 'lut_sonames.cpp.inc'
     logger.info('target path: {}'.format(target_path))
@@ -66,6 +108,4 @@ if __name__ == '__main__':
     for c in CODENAMES:
         parse_ubuntu_contents(c, output)
     logging.info('{} entries found, saving to {}'.format(len(output), target_path))
-    csv = '\n'.join(['{{"{}","{}"}},'.format(k, ','.join([pkg for pkg in v])) for (k, v) in output.items()])
-    with open(target_path, 'w') as target_file:
-        target_file.write(csv)
+    write_lut(output, target_path)
@@ -2,11 +2,14 @@
 ##filter/perl_local: Removes perllocal.pod.
 ##@copyright GPL-2.0+
 filter_perl(){
+	local __perl_files=()
 	abinfo "Removed perllocal.pod."
-	find "$PKGDIR" -name perllocal.pod -delete
+	abmanifest_query -v __perl_files -n perllocal.pod
+	rm -df -- "${__perl_files[@]}"
 
 	abinfo "Removed .packlist."
-	find "$PKGDIR" -name .packlist -delete
+	abmanifest_query -v __perl_files -n .packlist
+	rm -df -- "${__perl_files[@]}"
 }
 
 ab_register_filter perl
@@ -4,9 +4,11 @@
 filter_mancompress() {
 	if bool "$ABMANCOMPRESS"; then
 		local __mancomp_todo=()
+		local __mancomp_pages=()
 
 		if [ -d "$PKGDIR"/usr/share/man ]; then
-			for i in "$PKGDIR"/usr/share/man/**/*.*; do
+			abmanifest_query -v __mancomp_pages -n '*.*' "$PKGDIR"/usr/share/man
+			for i in "${__mancomp_pages[@]}"; do
 				if [[ $i == *.gz || $i == *.bz2 || $i = *.zst || $i == *.xz ]]; then
 					continue
 				fi
@@ -33,7 +35,7 @@ filter_mancompress() {
 			fi
 		fi
 
-		unset __mancomp_todo __mancomp_lnk
+		unset __mancomp_todo __mancomp_pages __mancomp_lnk
 	fi
 }
 
@@ -2,14 +2,17 @@
 ##filter/elf/lib_archives.sh: Kills *.a / *.la
 ##@copyright GPL-2.0+
 filter_lib_archives() {
+	local __archives=()
 	if bool "$NOLIBTOOL"; then
 		abinfo "Purging libtool archives from build tree."
-		find "$PKGDIR" -name '*.la' -delete || abwarn ".la purge: $?"
+		abmanifest_query -v __archives -n '*.la' || abwarn ".la purge: $?"
+		rm -df -- "${__archives[@]}" || abwarn ".la purge: $?"
 	fi
 
 	if bool "$NOSTATIC"; then
 		abinfo "Purging static libraries from build tree."
-		find "$PKGDIR" -name '*.a' -delete || abwarn ".a purge: $?"
+		abmanifest_query -v __archives -n '*.a' || abwarn ".a purge: $?"
+		rm -df -- "${__archives[@]}" || abwarn ".a purge: $?"
 	fi
 }
 
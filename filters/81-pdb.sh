@@ -3,10 +3,12 @@
 ##@copyright GPL-2.0+
 
 filter_pdb() {
+	local __pdb_files=()
 	for p in ${BIN_DIRS[@]}; do
         i="$PKGDIR"/"$p"
 	    if [ -d "$i" ]; then
-            for f in `find "$i" -type f -name "*.pdb"`; do
+            abmanifest_query -v __pdb_files -t f -n "*.pdb" "$i"
+            for f in "${__pdb_files[@]}"; do
                 if bool "$ABSPLITDBG"; then
                     path="${f#"$PKGDIR"}"
                     abinfo "Saving Program Database file $f ..."
@@ -0,0 +1,543 @@
+#include "abbuildlog.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <poll.h>
+#include <string_view>
+#include <unistd.h>
+
+#ifdef HAS_ZSTD
+#include <zstd.h>
+#endif
+
+using json = nlohmann::json;
+
+// the index keeps this many entries of each kind, the rest is only counted
+constexpr size_t build_log_max_entries = 500;
+// lines kept before an error, for the excerpt
+constexpr size_t build_log_context_lines = 4;
+// lines longer than this are truncated in the index (not in the log)
+constexpr size_t build_log_max_line = 1024;
+constexpr size_t build_log_excerpt_errors = 5;
+// incomplete lines are written to the log once they get this long
+constexpr size_t build_log_max_pending = 64 * 1024;
+
+struct BuildLogCapture {
+  // the shell which started the capture
+  pid_t owner;
+  pid_t collector;
+  // the original stdout and stderr of the shell
+  int saved_stdout;
+  int saved_stderr;
+  // closed by the collector when it exits
+  int done_fd;
+  std::string log_path;
+  std::string index_path;
+};
+
+static BuildLogCapture *capture = nullptr;
+
+enum class LogLineKind { None, Warning, Error };
+
+static std::string strip_ansi_escapes(std::string_view line) {
+  std::string result{};
+  result.reserve(line.size());
+  for (size_t i = 0; i < line.size(); i++) {
+    if (line[i] == '\x1b' && i + 1 < line.size() && line[i + 1] == '[') {
+      i += 2;
+      while (i < line.size() && !(line[i] >= '@' && line[i] <= '~'))
+        i++;
+      continue;
+    }
+    if (line[i] == '\r')
+      continue;
+    result += line[i];
+  }
+  return result;
+}
+
+static inline bool contains(std::string_view line, std::string_view needle) {
+  return line.find(needle) != std::string_view::npos;
+}
+
+static inline bool starts_with(std::string_view line, std::string_view prefix) {
+  return line.substr(0, prefix.size()) == prefix;
+}
+
+static LogLineKind classify_log_line(std::string_view line) {
+  // compiler and linker diagnostics, build tools giving up, and the
+  // diagnostics of abdie
+  constexpr std::string_view error_patterns[] = {
+      ": error:",
+      ": fatal error:",
+      "undefined reference to ",
+      "make: *** ",
+      "]: *** ",
+      "ninja: build stopped",
+      "CMake Error",
+      "Traceback (most recent call last)",
+      "error: command exited with",
+      "command raised an error here",
+      "): In function `",
+      "autobuild encountered an error",
+  };
+  constexpr std::string_view warning_patterns[] = {
+      ": warning:",
+      "CMake Warning",
+  };
+  if (starts_with(line, "error:") || starts_with(line, "error[") ||
+      starts_with(line, "ERROR:"))
+    return LogLineKind::Error;
+  for (const auto &pattern : error_patterns) {
+    if (contains(line, pattern))
+      return LogLineKind::Error;
+  }
+  if (starts_with(line, "warning:") || starts_with(line, "warning["))
+    return LogLineKind::Warning;
+  for (const auto &pattern : warning_patterns) {
+    if (contains(line, pattern))
+      return LogLineKind::Warning;
+  }
+  return LogLineKind::None;
+}
+
+static std::atomic<bool> collector_stopping{false};
+
+static void collector_stop_handler(int) { collector_stopping = true; }
+
+static bool write_all_fd(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    const ssize_t ret = write(fd, data, size);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += ret;
+    size -= ret;
+  }
+  return true;
+}
+
+// the standard output and error of the build, captured separately
+enum LogStreamId { LogStdout = 0, LogStderr = 1, LogStreamCount };
+
+class LogCollector {
+public:
+  LogCollector(const int tee_fds[LogStreamCount], FILE *output)
+      : m_output(output) {
+    for (int i = 0; i < LogStreamCount; i++)
+      m_streams[i].tee_fd = tee_fds[i];
+#ifdef HAS_ZSTD
+    m_cctx = ZSTD_createCCtx();
+    ZSTD_CCtx_setParameter(m_cctx, ZSTD_c_compressionLevel, 3);
+    m_out_buffer.resize(ZSTD_CStreamOutSize());
+#endif
+  }
+
+  ~LogCollector() {
+#ifdef HAS_ZSTD
+    ZSTD_freeCCtx(m_cctx);
+#endif
+  }
+
+  // The output is passed through to the original stream right away, but
+  // written to the log line by line, so that the lines of the two streams
+  // are not mixed up in the log.
+  void feed(const LogStreamId id, const char *data, const size_t size) {
+    LogStream &stream = m_streams[id];
+    const std::string_view prefix{build_log_marker_prefix};
+    size_t tee_start = 0;
+    for (size_t i = 0; i < size; i++) {
+      const char c = data[i];
+      if (stream.line.empty() && !stream.line_truncated && c == prefix[0]) {
+        // possibly a stage marker, hold it back from the original streams
+        tee(stream, data + tee_start, i - tee_start);
+        stream.in_marker = true;
+      }
+      stream.pending += c;
+      if (c == '\n') {
+        if (stream.in_marker)
+          tee_start = i + 1;
+        end_line(stream);
+        continue;
+      }
+      if (stream.line.size() < build_log_max_line)
+        stream.line += c;
+      else
+        stream.line_truncated = true;
+      if (stream.in_marker && stream.line.size() <= prefix.size() &&
+          prefix.substr(0, stream.line.size()) != stream.line) {
+        // not a marker after all, pass through what was held back
+        tee(stream, stream.line.data(), stream.line.size());
+        stream.in_marker = false;
+        tee_start = i + 1;
+      }
+      // very long lines (e.g. progress bars redrawn with \r) are written
+      // out in parts
+      if (stream.pending.size() >= build_log_max_pending)
+        write_pending(stream);
+    }
+    if (!stream.in_marker)
+      tee(stream, data + tee_start, size - tee_start);
+  }
+
+  bool finish() {
+    for (auto &stream : m_streams) {
+      if (!stream.line.empty() || stream.line_started)
+        end_line(stream);
+    }
+    return write_log(nullptr, 0, true) && m_log_ok;
+  }
+
+  json index(const std::string &log_path) const {
+    json stages = json::array();
+    for (const auto &stage : m_stages) {
+      stages.push_back({{"name", stage.text},
+                        {"line", stage.line},
+                        {"offset", stage.offset}});
+    }
+    return {{"log", log_path},
+#ifdef HAS_ZSTD
+            {"compression", "zstd"},
+#else
+            {"compression", "none"},
+#endif
+            {"bytes", m_offset},
+            {"lines", m_line_number},
+            {"stages", std::move(stages)},
+            {"errors_total", m_errors_total},
+            {"warnings_total", m_warnings_total},
+            {"errors", entries_to_json(m_errors)},
+            {"warnings", entries_to_json(m_warnings)}};
+  }
+
+private:
+  struct LogStream {
+    int tee_fd{-1};
+    // the part of the current line not written to the log yet
+    std::string pending{};
+    // the current line (up to build_log_max_line), for the index
+    std::string line{};
+    bool line_truncated{false};
+    bool in_marker{false};
+    // a part of the current line has been written to the log already
+    bool line_started{false};
+    uint64_t line_offset{0};
+  };
+
+  struct Entry {
+    size_t line;
+    uint64_t offset;
+    std::string stage;
+    std::string text;
+    std::vector<std::string> context;
+  };
+
+  static json entries_to_json(const std::vector<Entry> &entries) {
+    json array = json::array();
+    for (const auto &entry : entries) {
+      json item = {{"line", entry.line},
+                   {"offset", entry.offset},
+                   {"stage", entry.stage},
+                   {"text", entry.text}};
+      if (!entry.context.empty())
+        item["context"] = entry.context;
+      array.push_back(std::move(item));
+    }
+    return array;
+  }
+
+  static void tee(LogStream &stream, const char *data, size_t size) {
+    // the output is still written to the log if the original streams are
+    // gone
+    if (size > 0 && stream.tee_fd >= 0 &&
+        !write_all_fd(stream.tee_fd, data, size))
+      stream.tee_fd = -1;
+  }
+
+  void write_pending(LogStream &stream) {
+    if (!stream.line_started) {
+      stream.line_offset = m_offset;
+      stream.line_started = true;
+    }
+    if (!write_log(stream.pending.data(), stream.pending.size(), false))
+      m_log_ok = false;
+    m_offset += stream.pending.size();
+    stream.pending.clear();
+  }
+
+  void end_line(LogStream &stream) {
+    write_pending(stream);
+    m_line_number++;
+    if (stream.in_marker && starts_with(stream.line, build_log_marker_prefix)) {
+      m_stage = stream.line.substr(strlen(build_log_marker_prefix));
+      m_stages.push_back(
+          Entry{m_line_number, stream.line_offset, {}, m_stage, {}});
+    } else {
+      std::string text = strip_ansi_escapes(stream.line);
+      switch (classify_log_line(text)) {
+      case LogLineKind::Error:
+        m_errors_total++;
+        if (m_errors.size() < build_log_max_entries)
+          m_errors.push_back(Entry{m_line_number, stream.line_offset, m_stage,
+                                   text,
+                                   {m_context.begin(), m_context.end()}});
+        break;
+      case LogLineKind::Warning:
+        m_warnings_total++;
+        if (m_warnings.size() < build_log_max_entries)
+          m_warnings.push_back(
+              Entry{m_line_number, stream.line_offset, m_stage, text, {}});
+        break;
+      case LogLineKind::None:
+        break;
+      }
+      m_context.push_back(std::move(text));
+      if (m_context.size() > build_log_context_lines)
+        m_context.pop_front();
+    }
+    stream.line.clear();
+    stream.line_truncated = false;
+    stream.in_marker = false;
+    stream.line_started = false;
+  }
+
+  bool write_log(const char *data, size_t size, const bool end) {
+    if (!m_output)
+      return false;
+#ifdef HAS_ZSTD
+    ZSTD_inBuffer input{data, size, 0};
+    for (;;) {
+      ZSTD_outBuffer output{m_out_buffer.data(), m_out_buffer.size(), 0};
+      const size_t remaining = ZSTD_compressStream2(
+          m_cctx, &output, &input, end ? ZSTD_e_end : ZSTD_e_continue);
+      if (ZSTD_isError(remaining))
+        return false;
+      if (output.pos > 0 &&
+          fwrite(m_out_buffer.data(), 1, output.pos, m_output) != output.pos)
+        return false;
+      if (end ? remaining == 0 : input.pos == input.size)
+        break;
+    }
+    return true;
+#else
+    (void)end;
+    return size == 0 || fwrite(data, 1, size, m_output) == size;
+#endif
+  }
+
+  LogStream m_streams[LogStreamCount];
+  FILE *m_output;
+  bool m_log_ok{true};
+#ifdef HAS_ZSTD
+  ZSTD_CCtx *m_cctx;
+  std::vector<char> m_out_buffer;
+#endif
+  // uncompressed bytes written to the log so far
+  uint64_t m_offset{0};
+  size_t m_line_number{0};
+  std::string m_stage{};
+  std::deque<std::string> m_context{};
+  std::vector<Entry> m_stages{};
+  std::vector<Entry> m_errors{};
+  std::vector<Entry> m_warnings{};
+  size_t m_errors_total{0};
+  size_t m_warnings_total{0};
+};
+
+[[noreturn]] static void
+build_log_collector(const int in_fds[LogStreamCount],
+                    const int tee_fds[LogStreamCount],
+                    const std::string &log_path,
+                    const std::string &index_path) {
+  // interrupting the build must not lose its output, the collector stops
+  // once the shell is gone or asks it to
+  signal(SIGINT, SIG_IGN);
+  signal(SIGQUIT, SIG_IGN);
+  signal(SIGHUP, SIG_IGN);
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGTERM, SIG_DFL);
+  signal(SIGCHLD, SIG_DFL);
+  struct sigaction action {};
+  action.sa_handler = collector_stop_handler;
+  sigaction(SIGUSR1, &action, nullptr);
+  sigset_t unblock{};
+  sigemptyset(&unblock);
+  sigprocmask(SIG_SETMASK, &unblock, nullptr);
+
+  FILE *output = fopen(log_path.c_str(), "we");
+  LogCollector collector{tee_fds, output};
+  std::vector<char> buffer(64 * 1024);
+  pollfd pfds[LogStreamCount]{};
+  for (int i = 0; i < LogStreamCount; i++)
+    pfds[i] = pollfd{in_fds[i], POLLIN, 0};
+  int open_streams = LogStreamCount;
+  bool draining = false;
+  while (open_streams > 0) {
+    if (!draining && collector_stopping) {
+      // take what is left without waiting for the other writers (e.g.
+      // daemons started by the build) to go away
+      for (const auto &pfd : pfds) {
+        if (pfd.fd >= 0)
+          fcntl(pfd.fd, F_SETFL, fcntl(pfd.fd, F_GETFL) | O_NONBLOCK);
+      }
+      draining = true;
+    }
+    if (!draining && poll(pfds, LogStreamCount, 200) <= 0)
+      continue;
+    for (int i = 0; i < LogStreamCount; i++) {
+      if (pfds[i].fd < 0 || (!draining && !pfds[i].revents))
+        continue;
+      const ssize_t ret = read(pfds[i].fd, buffer.data(), buffer.size());
+      if (ret < 0 && errno == EINTR)
+        continue;
+      if (ret > 0) {
+        collector.feed(static_cast<LogStreamId>(i), buffer.data(), ret);
+        continue;
+      }
+      // closed, or nothing left while draining; a negative fd is ignored by
+      // poll()
+      pfds[i].fd = -1;
+      open_streams--;
+    }
+  }
+  const bool log_ok = collector.finish();
+  if (output)
+    fclose(output);
+  std::ofstream index_file(index_path, std::ios::trunc);
+  auto index = collector.index(log_path);
+  index["complete"] = log_ok;
+  index_file << index.dump() << '\n';
+  index_file.close();
+  _exit(log_ok ? 0 : 1);
+}
+
+bool build_log_start(const std::string &log_base) {
+  if (capture)
+    return true;
+#ifdef HAS_ZSTD
+  const std::string log_path = log_base + ".zst";
+#else
+  const std::string log_path = log_base;
+#endif
+  const std::string index_path = log_base + ".index.json";
+  // the two streams are captured separately, so that the original stderr
+  // still gets the standard error of the build
+  int out_pipe[2]{-1, -1};
+  int err_pipe[2]{-1, -1};
+  int done_pipe[2]{-1, -1};
+  if (pipe2(out_pipe, O_CLOEXEC) != 0)
+    return false;
+  if (pipe2(err_pipe, O_CLOEXEC) != 0) {
+    close(out_pipe[0]);
+    close(out_pipe[1]);
+    return false;
+  }
+  if (pipe2(done_pipe, O_CLOEXEC) != 0) {
+    for (const int fd : {out_pipe[0], out_pipe[1], err_pipe[0], err_pipe[1]})
+      close(fd);
+    return false;
+  }
+  // kept away from the low file descriptors used by the scripts
+  const int saved_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 64);
+  const int saved_stderr = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 64);
+  fflush(nullptr);
+  std::cout.flush();
+  const pid_t pid = fork();
+  if (pid == 0) {
+    close(out_pipe[1]);
+    close(err_pipe[1]);
+    close(done_pipe[0]);
+    const int in_fds[LogStreamCount]{out_pipe[0], err_pipe[0]};
+    const int tee_fds[LogStreamCount]{saved_stdout, saved_stderr};
+    build_log_collector(in_fds, tee_fds, log_path, index_path);
+  }
+  close(out_pipe[0]);
+  close(err_pipe[0]);
+  close(done_pipe[1]);
+  if (pid < 0) {
+    close(out_pipe[1]);
+    close(err_pipe[1]);
+    close(done_pipe[0]);
+    close(saved_stdout);
+    close(saved_stderr);
+    return false;
+  }
+  dup2(out_pipe[1], STDOUT_FILENO);
+  dup2(err_pipe[1], STDERR_FILENO);
+  close(out_pipe[1]);
+  close(err_pipe[1]);
+  capture = new BuildLogCapture{getpid(),    pid,      saved_stdout,
+                                saved_stderr, done_pipe[0], log_path,
+                                index_path};
+  return true;
+}
+
+bool build_log_active() { return capture != nullptr; }
+
+void build_log_mark(const std::string &stage) {
+  if (!capture)
+    return;
+  fflush(nullptr);
+  std::cout.flush();
+  const std::string marker = build_log_marker_prefix + stage + "\n";
+  write_all_fd(STDOUT_FILENO, marker.data(), marker.size());
+}
+
+static void read_build_log_index(BuildLogSummary &summary) {
+  std::ifstream file(summary.index_path);
+  if (!file.is_open())
+    return;
+  const json index = json::parse(file, nullptr, false);
+  if (index.is_discarded())
+    return;
+  summary.errors = index.value("errors_total", 0);
+  summary.warnings = index.value("warnings_total", 0);
+  const auto errors = index.find("errors");
+  if (errors == index.end() || !errors->is_array())
+    return;
+  size_t count = 0;
+  for (const auto &error : *errors) {
+    if (count++ >= build_log_excerpt_errors)
+      break;
+    const auto context = error.find("context");
+    if (context != error.end() && context->is_array()) {
+      for (const auto &line : *context) {
+        summary.excerpt.emplace_back(line.get<std::string>());
+      }
+    }
+    summary.excerpt.emplace_back(error.value("text", ""));
+  }
+}
+
+bool build_log_stop(BuildLogSummary &summary) {
+  // only the shell which started the capture stops it, not its subshells
+  if (!capture || getpid() != capture->owner)
+    return false;
+  fflush(nullptr);
+  std::cout.flush();
+  dup2(capture->saved_stdout, STDOUT_FILENO);
+  dup2(capture->saved_stderr, STDERR_FILENO);
+  close(capture->saved_stdout);
+  close(capture->saved_stderr);
+  kill(capture->collector, SIGUSR1);
+  // the collector has no children, the pipe is closed when it exits
+  char c = 0;
+  while (read(capture->done_fd, &c, 1) < 0 && errno == EINTR) {
+  }
+  close(capture->done_fd);
+  summary = BuildLogSummary{capture->log_path, capture->index_path, 0, 0, {}};
+  read_build_log_index(summary);
+  delete capture;
+  capture = nullptr;
+  return true;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Native capture of the build output (ABCAPTURELOG=1).
+//
+// The standard output and error of the shell (and so of every command of the
+// build) are redirected into two pipes, read by a collector process which
+// passes the output through to the original streams, compresses it on the fly
+// (zstd, if available) and indexes the error and warning lines. The lines of
+// the two streams are written to the log whole, in the order they end. The index is
+// a small JSON file next to the log, so the failure excerpt is available
+// without decompressing or scanning the whole log again.
+//
+// Stage markers are written in-band, as lines starting with
+// build_log_marker_prefix, and are not passed through.
+constexpr const char *build_log_marker_prefix = "\x1e" "AB4STAGE ";
+
+struct BuildLogSummary {
+  std::string log_path;
+  std::string index_path;
+  size_t errors;
+  size_t warnings;
+  // the first error lines, along with the lines right before them
+  std::vector<std::string> excerpt;
+};
+
+// log_base is the path of the log without the compression suffix.
+bool build_log_start(const std::string &log_base);
+bool build_log_active();
+void build_log_mark(const std::string &stage);
+// Restores the standard streams and waits for the collector to finish the
+// log. Returns false if the capture was not active.
+bool build_log_stop(BuildLogSummary &summary);
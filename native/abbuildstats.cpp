@@ -0,0 +1,262 @@
+#include "abbuildstats.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <fcntl.h>
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+
+// the slowest ELF files kept in a record
+constexpr size_t buildstats_max_elf_files = 256;
+// memory kept free when choosing the number of jobs, in percent
+constexpr int64_t buildstats_memory_headroom = 10;
+
+static bool make_parent_directories(const std::string &path) {
+  for (size_t pos = path.find('/', 1); pos != std::string::npos;
+       pos = path.find('/', pos + 1)) {
+    const std::string directory = path.substr(0, pos);
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST)
+      return false;
+  }
+  return true;
+}
+
+static std::string relative_to(const std::string &path,
+                               const std::string &root) {
+  if (root.empty() || path.compare(0, root.size(), root) != 0)
+    return path;
+  // "$PKGDIR-dbg/foo" is not under "$PKGDIR"
+  if (path.size() > root.size() && path[root.size()] != '/' &&
+      root.back() != '/')
+    return path;
+  size_t start = root.size();
+  while (start < path.size() && path[start] == '/')
+    start++;
+  // e.g. "$PKGDIR/usr/lib//libfoo.so"
+  std::string relative{};
+  relative.reserve(path.size() - start);
+  for (size_t i = start; i < path.size(); i++) {
+    if (path[i] == '/' && !relative.empty() && relative.back() == '/')
+      continue;
+    relative += path[i];
+  }
+  return relative;
+}
+
+static json build_record(const BuildStatsPackage &pkg,
+                         const std::vector<TraceEvent> &events,
+                         const std::string &pkgdir, const bool failed) {
+  json stages = json::array();
+  std::vector<const TraceEvent *> elf_files{};
+  int64_t cgroup_peak = -1;
+  int64_t anon_peak = -1;
+  int64_t max_rss_kb = -1;
+  int64_t end_us = 0;
+  for (const auto &event : events) {
+    end_us = std::max(end_us, event.start_us + event.duration_us);
+    if (event.category == "elf") {
+      elf_files.push_back(&event);
+      continue;
+    }
+    if (!event.has_usage)
+      continue;
+    cgroup_peak = std::max(cgroup_peak, event.usage.cgroup_memory_peak);
+    anon_peak = std::max(anon_peak, event.usage.cgroup_anon_peak);
+    max_rss_kb = std::max(max_rss_kb, event.usage.max_rss_kb);
+    stages.push_back({{"category", event.category},
+                      {"name", event.name},
+                      {"wall_us", event.duration_us},
+                      {"user_us", event.usage.user_us},
+                      {"system_us", event.usage.system_us},
+                      {"max_rss_kb", event.usage.max_rss_kb},
+                      {"cgroup_memory_peak", event.usage.cgroup_memory_peak},
+                      {"cgroup_anon_peak", event.usage.cgroup_anon_peak}});
+  }
+  std::sort(elf_files.begin(), elf_files.end(),
+            [](const TraceEvent *a, const TraceEvent *b) {
+              return a->duration_us > b->duration_us;
+            });
+  int64_t elf_us = 0;
+  int64_t elf_bytes = 0;
+  for (const auto *event : elf_files) {
+    if (event->bytes <= 0)
+      continue;
+    elf_us += event->duration_us;
+    elf_bytes += event->bytes;
+  }
+  if (elf_files.size() > buildstats_max_elf_files)
+    elf_files.resize(buildstats_max_elf_files);
+  json elf = json::array();
+  for (const auto *event : elf_files) {
+    elf.push_back({{"path", relative_to(event->name, pkgdir)},
+                   {"bytes", event->bytes},
+                   {"us", event->duration_us}});
+  }
+  return {{"time", static_cast<int64_t>(time(nullptr))},
+          {"package", pkg.name},
+          {"version", pkg.version},
+          {"arch", pkg.arch},
+          {"threads", pkg.threads},
+          {"jobs", pkg.jobs},
+          {"status", failed ? "failure" : "success"},
+          {"wall_us", end_us},
+          {"cgroup_memory_peak", cgroup_peak},
+          {"cgroup_anon_peak", anon_peak},
+          {"max_rss_kb", max_rss_kb},
+          {"stages", std::move(stages)},
+          {"elf_total_us", elf_us},
+          {"elf_total_bytes", elf_bytes},
+          {"elf", std::move(elf)}};
+}
+
+bool buildstats_append(const std::string &store, const BuildStatsPackage &pkg,
+                       const std::vector<TraceEvent> &events,
+                       const std::string &pkgdir, const bool failed) {
+  if (!make_parent_directories(store))
+    return false;
+  const std::string line =
+      build_record(pkg, events, pkgdir, failed).dump() + '\n';
+  const int fd =
+      open(store.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return false;
+  // concurrent builds append whole lines
+  flock(fd, LOCK_EX);
+  bool ok = true;
+  const char *data = line.data();
+  size_t size = line.size();
+  while (size > 0) {
+    const ssize_t ret = write(fd, data, size);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0) {
+      ok = false;
+      break;
+    }
+    data += ret;
+    size -= ret;
+  }
+  flock(fd, LOCK_UN);
+  close(fd);
+  return ok;
+}
+
+BuildHistory buildstats_load(const std::string &store,
+                             const std::string &package,
+                             const size_t max_builds) {
+  BuildHistory history{0, -1, {}, 0};
+  std::ifstream file(store);
+  if (!file.is_open())
+    return history;
+  // cheap filter, only the records of the package are parsed
+  const std::string needle = "\"package\":" + json(package).dump();
+  std::deque<json> records{};
+  std::string line{};
+  while (std::getline(file, line)) {
+    if (line.find(needle) == std::string::npos)
+      continue;
+    json record = json::parse(line, nullptr, false);
+    if (record.is_discarded() || record.value("package", "") != package)
+      continue;
+    records.emplace_back(std::move(record));
+    if (records.size() > max_builds)
+      records.pop_front();
+  }
+  history.builds = records.size();
+  for (const auto &record : records) {
+    const int64_t jobs = std::max<int64_t>(
+        record.value("jobs", record.value("threads", 1)), 1);
+    // the peak of the anonymous memory of this build only: memory.peak
+    // includes the page cache, and (unless it could be reset) the memory of
+    // whatever ran in the cgroup before
+    const int64_t anon_peak = record.value("cgroup_anon_peak", -1);
+    const int64_t max_rss_kb = record.value("max_rss_kb", -1);
+    // the cgroup peak is shared by all the jobs, and a job needs at least as
+    // much as the largest process
+    int64_t job_kb = -1;
+    if (anon_peak > 0)
+      job_kb = anon_peak / 1024 / jobs;
+    if (max_rss_kb > job_kb)
+      job_kb = max_rss_kb;
+    history.job_memory_kb = std::max(history.job_memory_kb, job_kb);
+  }
+  // ELF costs from the latest build which processed any
+  for (auto it = records.rbegin(); it != records.rend(); ++it) {
+    const auto elf = it->find("elf");
+    if (elf == it->end() || !elf->is_array() || elf->empty())
+      continue;
+    for (const auto &file : *elf) {
+      history.elf_cost_us[file.value("path", "")] = file.value("us", 0);
+    }
+    const int64_t total_bytes = it->value("elf_total_bytes", 0);
+    if (total_bytes > 0)
+      history.elf_us_per_byte =
+          static_cast<double>(it->value("elf_total_us", 0)) / total_bytes;
+    break;
+  }
+  return history;
+}
+
+static int64_t read_meminfo_kb(const char *key) {
+  FILE *file = fopen("/proc/meminfo", "re");
+  if (!file)
+    return -1;
+  char line[128]{};
+  long long value = -1;
+  const size_t key_len = strlen(key);
+  while (fgets(line, sizeof(line), file)) {
+    if (strncmp(line, key, key_len) == 0) {
+      if (sscanf(line + key_len, "%lld", &value) != 1)
+        value = -1;
+      break;
+    }
+  }
+  fclose(file);
+  return value;
+}
+
+static int64_t read_cgroup_memory_limit_kb() {
+  std::ifstream cgroup("/proc/self/cgroup");
+  std::string line{};
+  while (std::getline(cgroup, line)) {
+    if (line.compare(0, 3, "0::") != 0)
+      continue;
+    std::ifstream limit("/sys/fs/cgroup" + line.substr(3) + "/memory.max");
+    int64_t bytes = -1;
+    // "max" if there is no limit
+    if (limit >> bytes)
+      return bytes / 1024;
+    return -1;
+  }
+  return -1;
+}
+
+int64_t buildstats_available_memory_kb() {
+  const int64_t available = read_meminfo_kb("MemAvailable:");
+  const int64_t limit = read_cgroup_memory_limit_kb();
+  if (available < 0)
+    return limit;
+  if (limit < 0)
+    return available;
+  return std::min(available, limit);
+}
+
+int buildstats_suggest_jobs(const BuildHistory &history, const int threads,
+                            const int64_t available_kb) {
+  if (history.job_memory_kb <= 0 || available_kb <= 0 || threads <= 1)
+    return threads;
+  const int64_t usable_kb =
+      available_kb * (100 - buildstats_memory_headroom) / 100;
+  const int64_t jobs = usable_kb / history.job_memory_kb;
+  return static_cast<int>(
+      std::max<int64_t>(1, std::min<int64_t>(jobs, threads)));
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "abtrace.hpp"
+
+// Local history of the builds (ABSTATS=1), one JSON record per line appended
+// to ABSTATSDB (buildstats_default_store by default). Each record holds the
+// package, the number of threads and of jobs used, the duration and resource usage of
+// the stages, and the slowest ELF files (relative to PKGDIR), so that later
+// builds of the same package can pick a memory-safe number of jobs and
+// process the expensive ELF files first.
+constexpr const char *buildstats_default_store =
+    "/var/lib/autobuild/buildstats.jsonl";
+
+struct BuildStatsPackage {
+  std::string name;
+  std::string version;
+  std::string arch;
+  int threads;
+  // the jobs the build tools actually ran with (-j of MAKEFLAGS), which may
+  // be fewer than threads
+  int jobs;
+};
+
+// Appends the record of a build, built from the events of trace_finish().
+bool buildstats_append(const std::string &store, const BuildStatsPackage &pkg,
+                       const std::vector<TraceEvent> &events,
+                       const std::string &pkgdir, bool failed);
+
+struct BuildHistory {
+  size_t builds;
+  // the memory a single job needed in the worst of these builds, -1 if
+  // unknown
+  int64_t job_memory_kb;
+  // ELF processing time by path relative to PKGDIR, from the latest build
+  std::unordered_map<std::string, int64_t> elf_cost_us;
+  // average ELF processing time per byte, for the files not seen before
+  double elf_us_per_byte;
+};
+
+// Loads the latest (at most max_builds) records of the package.
+BuildHistory buildstats_load(const std::string &store,
+                             const std::string &package,
+                             size_t max_builds = 5);
+// The memory available to the build: the smaller of MemAvailable and the
+// limit of its cgroup, -1 if unknown.
+int64_t buildstats_available_memory_kb();
+// The number of jobs which should fit in available_kb, at most threads.
+int buildstats_suggest_jobs(const BuildHistory &history, int threads,
+                            int64_t available_kb);
@@ -0,0 +1,113 @@
+#include "abbundle.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+constexpr std::string_view script_bundle_magic = "AB4BUNDLE 2\n";
+
+static std::unique_ptr<ScriptBundle> script_bundle{};
+
+static bool read_whole_file(const std::string &path, std::string &out) {
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  struct stat st {};
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return false;
+  }
+  out.resize(st.st_size);
+  size_t offset = 0;
+  while (offset < out.size()) {
+    const ssize_t ret = read(fd, &out[offset], out.size() - offset);
+    if (ret <= 0)
+      break;
+    offset += ret;
+  }
+  close(fd);
+  out.resize(offset);
+  return offset == static_cast<size_t>(st.st_size);
+}
+
+std::unique_ptr<ScriptBundle> ScriptBundle::open(const std::string &ab_path) {
+  auto bundle = std::unique_ptr<ScriptBundle>(new ScriptBundle());
+  if (!read_whole_file(ab_path + "/" + script_bundle_name, bundle->m_buffer))
+    return nullptr;
+  const std::string_view buffer{bundle->m_buffer};
+  if (buffer.substr(0, script_bundle_magic.size()) != script_bundle_magic)
+    return nullptr;
+  size_t pos = script_bundle_magic.size();
+  while (pos < buffer.size()) {
+    const size_t eol = buffer.find('\n', pos);
+    if (eol == std::string_view::npos)
+      return nullptr;
+    const std::string header{buffer.substr(pos, eol - pos)};
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    int path_offset = 0;
+    if (sscanf(header.c_str(), "%" SCNu64 " %" SCNd64 " %n", &size, &mtime,
+               &path_offset) != 2 ||
+        path_offset <= 0 || static_cast<size_t>(path_offset) >= header.size())
+      return nullptr;
+    pos = eol + 1;
+    if (size > buffer.size() - pos)
+      return nullptr;
+    const Entry entry{buffer.substr(pos, size), static_cast<time_t>(mtime),
+                      EntryState::Unchecked};
+    bundle->m_entries.emplace(ab_path + "/" + header.substr(path_offset),
+                              entry);
+    pos += size;
+  }
+  return bundle;
+}
+
+const std::string_view *ScriptBundle::find(const std::string &filename) const {
+  const auto found = m_entries.find(filename);
+  if (found == m_entries.end())
+    return nullptr;
+  const Entry &entry = found->second;
+  // the installed scripts are still authoritative, skip the bundled copy if
+  // the script has been modified; the scripts are validated and then sourced,
+  // so remember the result instead of checking the file on every lookup
+  if (entry.state == EntryState::Unchecked) {
+    struct stat st {};
+    const bool unmodified =
+        stat(filename.c_str(), &st) == 0 &&
+        static_cast<size_t>(st.st_size) == entry.contents.size() &&
+        st.st_mtim.tv_sec == entry.mtime;
+    entry.state = unmodified ? EntryState::Valid : EntryState::Modified;
+  }
+  if (entry.state != EntryState::Valid)
+    return nullptr;
+  return &entry.contents;
+}
+
+int script_bundle_write(const std::string &output,
+                        const std::vector<ScriptBundleEntry> &entries) {
+  std::ofstream file(output, std::ios::binary | std::ios::trunc);
+  if (!file.is_open())
+    return 1;
+  file << script_bundle_magic;
+  for (const auto &entry : entries) {
+    file << entry.contents.size() << ' ' << static_cast<int64_t>(entry.mtime)
+         << ' ' << entry.path << '\n'
+         << entry.contents;
+  }
+  file.close();
+  return file.fail() ? 1 : 0;
+}
+
+void script_bundle_load(const std::string &ab_path) {
+  script_bundle = ScriptBundle::open(ab_path);
+}
+
+const std::string_view *script_bundle_find(const char *filename) {
+  if (!script_bundle)
+    return nullptr;
+  return script_bundle->find(filename);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Script bundle: a single image containing the pre-validated scripts shipped
+// with autobuild (proc/, lib/, arch/, templates/ and filters/), generated at
+// install time by ab4-bundle.
+//
+// Format:
+//   AB4BUNDLE 2\n
+//   <size> <mtime sec> <path relative to $AB>\n<contents>...
+//
+// Each script keeps its own entry, so the scripts are still sourced one by
+// one under their original file names and line numbers. Only the seconds of
+// the modification times are recorded, as tar and dpkg-deb do not preserve
+// the sub-second part.
+constexpr const char *script_bundle_name = "scripts.bundle";
+
+struct ScriptBundleEntry {
+  std::string path;
+  std::string contents;
+  time_t mtime;
+};
+
+class ScriptBundle {
+public:
+  // Reads the bundle with a single read, returns nullptr if the bundle does
+  // not exist or is malformed.
+  static std::unique_ptr<ScriptBundle> open(const std::string &ab_path);
+  // Returns the contents of the script if it is bundled and the script on
+  // the disk has not been modified since the bundle was generated. Each
+  // script is checked once, the following lookups use the result.
+  const std::string_view *find(const std::string &filename) const;
+
+private:
+  enum class EntryState : uint8_t { Unchecked, Valid, Modified };
+  struct Entry {
+    std::string_view contents;
+    time_t mtime;
+    mutable EntryState state;
+  };
+
+  std::string m_buffer;
+  // absolute path of the script -> bundled script
+  std::unordered_map<std::string, Entry> m_entries;
+};
+
+int script_bundle_write(const std::string &output,
+                        const std::vector<ScriptBundleEntry> &entries);
+
+// Loads the bundle installed in the autobuild directory, used by
+// autobuild_load_file() afterwards.
+void script_bundle_load(const std::string &ab_path);
+const std::string_view *script_bundle_find(const char *filename);
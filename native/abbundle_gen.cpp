@@ -0,0 +1,110 @@
+// ab4-bundle: collects the scripts shipped with autobuild into a single
+// pre-validated image (see abbundle.hpp), run at install time.
+#include "abbundle.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+// same check as autobuild_load_file(filename, true), using the bash parser
+// with the options autobuild enables before loading the scripts
+static bool gen_validate_script(const std::string &path) {
+  const char *argv[] = {"bash", "-O", "extglob", "-n", path.c_str(), nullptr};
+  pid_t pid = 0;
+  if (posix_spawnp(&pid, "bash", nullptr, nullptr,
+                   const_cast<char *const *>(argv), environ) != 0) {
+    fprintf(stderr, "Unable to run bash to validate %s\n", path.c_str());
+    return false;
+  }
+  int status = 0;
+  if (waitpid(pid, &status, 0) < 0)
+    return false;
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static int gen_collect_dir(const std::string &root, const std::string &dir,
+                           std::vector<ScriptBundleEntry> &entries) {
+  const std::string full_dir = root + "/" + dir;
+  DIR *handle = opendir(full_dir.c_str());
+  if (!handle) {
+    fprintf(stderr, "Unable to open %s\n", full_dir.c_str());
+    return 1;
+  }
+  std::vector<std::string> names{};
+  while (const dirent *entry = readdir(handle)) {
+    const size_t len = strlen(entry->d_name);
+    if (entry->d_name[0] == '.' || len < 4 ||
+        strcmp(entry->d_name + len - 3, ".sh") != 0)
+      continue;
+    names.emplace_back(entry->d_name);
+  }
+  closedir(handle);
+  std::sort(names.begin(), names.end());
+
+  for (const auto &name : names) {
+    const std::string path = full_dir + "/" + name;
+    struct stat st {};
+    if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+      continue;
+    if (!gen_validate_script(path)) {
+      fprintf(stderr, "%s contains syntax errors\n", path.c_str());
+      return 1;
+    }
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+      fprintf(stderr, "Unable to open %s\n", path.c_str());
+      return 1;
+    }
+    ScriptBundleEntry entry{dir + "/" + name, {}, st.st_mtim.tv_sec};
+    entry.contents.assign(std::istreambuf_iterator<char>(file),
+                          std::istreambuf_iterator<char>());
+    if (entry.contents.size() != static_cast<size_t>(st.st_size)) {
+      fprintf(stderr, "Unable to read %s\n", path.c_str());
+      return 1;
+    }
+    entries.emplace_back(std::move(entry));
+  }
+  return 0;
+}
+
+static void gen_usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s -C <autobuild directory> <subdirectory>...\n",
+          argv0);
+}
+
+int main(int argc, char *argv[]) {
+  const char *root = nullptr;
+  std::vector<std::string> dirs{};
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-C") == 0 && (i + 1) < argc) {
+      root = argv[++i];
+      continue;
+    }
+    dirs.emplace_back(argv[i]);
+  }
+  if (!root || dirs.empty()) {
+    gen_usage(argv[0]);
+    return 2;
+  }
+
+  std::vector<ScriptBundleEntry> entries{};
+  for (const auto &dir : dirs) {
+    if (gen_collect_dir(root, dir, entries) != 0)
+      return 1;
+  }
+  const std::string output = std::string{root} + "/" + script_bundle_name;
+  fprintf(stderr, "%zu scripts bundled, saving to %s\n", entries.size(),
+          output.c_str());
+  if (script_bundle_write(output, entries) != 0) {
+    fprintf(stderr, "Unable to write %s\n", output.c_str());
+    return 1;
+  }
+  return 0;
+}
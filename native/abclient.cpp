@@ -0,0 +1,91 @@
+// ab4-client: submits the build in the current directory to a warm build
+// server started with `autobuild -S <socket>`, and exits with the exit status
+// of the build.
+#include "abserver.hpp"
+
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+extern char **environ;
+
+static void client_usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s -s <socket> [-a <arch>]\n", argv0);
+}
+
+int main(int argc, char *argv[]) {
+  const char *socket_path = nullptr;
+  BuildRequest request{};
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "s:a:")) != -1) {
+    switch (opt) {
+    case 's':
+      socket_path = optarg;
+      break;
+    case 'a':
+      request.arch = optarg;
+      break;
+    default:
+      client_usage(argv[0]);
+      return 2;
+    }
+  }
+  if (!socket_path || optind != argc) {
+    client_usage(argv[0]);
+    return 2;
+  }
+
+  char cwd[PATH_MAX]{};
+  if (!getcwd(cwd, sizeof(cwd))) {
+    fprintf(stderr, "Unable to get the current directory: %s\n",
+            strerror(errno));
+    return 1;
+  }
+  request.cwd = cwd;
+  for (char **env = environ; *env; env++) {
+    request.env.emplace_back(*env);
+  }
+
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path is too long: %s\n", socket_path);
+    return 1;
+  }
+  strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+  const int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0 ||
+      connect(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+    fprintf(stderr, "Unable to connect to %s: %s\n", socket_path,
+            strerror(errno));
+    return 1;
+  }
+  // the build writes to our standard streams directly
+  const int fds[3]{STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  if (build_request_send(sock, build_request_encode(request), fds) != 0) {
+    fprintf(stderr, "Unable to send the build request: %s\n",
+            strerror(errno));
+    return 1;
+  }
+  int32_t status = 0;
+  size_t received = 0;
+  while (received < sizeof(status)) {
+    const ssize_t ret =
+        recv(sock, reinterpret_cast<char *>(&status) + received,
+             sizeof(status) - received, 0);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    if (ret <= 0) {
+      fprintf(stderr, "Build server closed the connection unexpectedly\n");
+      return 1;
+    }
+    received += ret;
+  }
+  close(sock);
+  return status;
+}
@@ -0,0 +1,116 @@
+#include "abfileindex.hpp"
+
+#include <cstring>
+#include <dirent.h>
+#include <memory>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static inline bool same_mtime(const struct timespec &a,
+                              const struct timespec &b) {
+  return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+FileIndex::FileIndex(const char *root)
+    : m_root(root), m_exists(false), m_directories(), m_entries(),
+      m_linked_dirs() {
+  struct stat st {};
+  if (stat(m_root.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+    return;
+  m_exists = true;
+  scan(m_root, {});
+}
+
+void FileIndex::scan(const std::string &dir, const std::string &prefix) {
+  // recorded before the listing, so that changes made during the scan
+  // invalidate the index
+  struct stat dir_st {};
+  if (stat(dir.c_str(), &dir_st) != 0)
+    return;
+  m_directories.push_back({dir, dir_st.st_dev, dir_st.st_ino, dir_st.st_mtim});
+  DIR *handle = opendir(dir.c_str());
+  if (!handle)
+    return;
+  while (const dirent *entry = readdir(handle)) {
+    const char *name = entry->d_name;
+    if (name[0] == '.' &&
+        (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+      continue;
+    const std::string path = dir + "/" + name;
+    std::string relative_path = prefix + name;
+    struct stat st {};
+    if (lstat(path.c_str(), &st) != 0)
+      continue;
+    if (S_ISLNK(st.st_mode)) {
+      // same semantics as access(F_OK): follow the symlinks and skip the
+      // dangling ones, but do not descend into the linked directories
+      if (stat(path.c_str(), &st) != 0)
+        continue;
+      if (S_ISDIR(st.st_mode))
+        m_linked_dirs.emplace(relative_path);
+    } else if (S_ISDIR(st.st_mode)) {
+      scan(path, relative_path + "/");
+    }
+    m_entries.emplace(std::move(relative_path));
+  }
+  closedir(handle);
+}
+
+bool FileIndex::is_valid() const {
+  struct stat st {};
+  if (stat(m_root.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+    return !m_exists;
+  if (!m_exists)
+    return false;
+  for (const auto &dir : m_directories) {
+    if (stat(dir.path.c_str(), &st) != 0 || st.st_dev != dir.dev ||
+        st.st_ino != dir.ino || !same_mtime(st.st_mtim, dir.mtime))
+      return false;
+  }
+  return true;
+}
+
+bool FileIndex::exists(const std::string &path) const {
+  if (!m_linked_dirs.empty()) {
+    // the contents of the linked directories are looked up on the disk
+    for (size_t slash = path.find('/'); slash != std::string::npos;
+         slash = path.find('/', slash + 1)) {
+      if (m_linked_dirs.count(path.substr(0, slash))) {
+        const auto full_path = m_root + "/" + path;
+        return access(full_path.c_str(), F_OK) == 0;
+      }
+    }
+  }
+  return m_entries.find(path) != m_entries.end();
+}
+
+bool FileIndex::is_indexable(const std::string &path) {
+  // only plain relative paths are recorded in the index
+  if (path.empty() || path.front() == '/' || path.back() == '/')
+    return false;
+  size_t start = 0;
+  while (start <= path.size()) {
+    size_t end = path.find('/', start);
+    if (end == std::string::npos)
+      end = path.size();
+    const size_t len = end - start;
+    if (len == 0 || (len == 1 && path[start] == '.') ||
+        (len == 2 && path[start] == '.' && path[start + 1] == '.'))
+      return false;
+    start = end + 1;
+  }
+  return true;
+}
+
+static std::unique_ptr<FileIndex> file_index{};
+// whether file_index was checked since the stage started
+static bool file_index_checked = false;
+
+const FileIndex &autobuild_file_index() {
+  if (!file_index || (!file_index_checked && !file_index->is_valid()))
+    file_index = std::make_unique<FileIndex>("autobuild");
+  file_index_checked = true;
+  return *file_index;
+}
+
+void autobuild_file_index_expire() { file_index_checked = false; }
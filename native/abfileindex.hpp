@@ -0,0 +1,47 @@
+#pragma once
+
+#include <ctime>
+#include <string>
+#include <sys/types.h>
+#include <unordered_set>
+#include <vector>
+
+// In-memory listing of a directory tree (the autobuild/ directory of a
+// package), used to answer existence queries without probing the file
+// system for each candidate path.
+class FileIndex {
+public:
+  explicit FileIndex(const char *root);
+  // whether the index still reflects the directories on the disk
+  bool is_valid() const;
+  // whether the path (relative to the root) exists
+  bool exists(const std::string &path) const;
+  // whether the path can be looked up in the index
+  static bool is_indexable(const std::string &path);
+
+private:
+  void scan(const std::string &dir, const std::string &prefix);
+
+  struct IndexedDirectory {
+    std::string path;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+  };
+
+  std::string m_root;
+  bool m_exists;
+  // the root and its subdirectories, any change to their entries changes
+  // their modification time
+  std::vector<IndexedDirectory> m_directories;
+  std::unordered_set<std::string> m_entries;
+  // symlinks to directories, not descended into
+  std::unordered_set<std::string> m_linked_dirs;
+};
+
+// Returns the index of the autobuild/ directory in the current working
+// directory. The index is checked against the disk on the first lookup after
+// autobuild_file_index_expire() only, and re-scanned if it is out of date.
+const FileIndex &autobuild_file_index();
+// Called before each stage, which sees autobuild/ as it was when it started.
+void autobuild_file_index_expire();
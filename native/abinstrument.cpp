@@ -0,0 +1,264 @@
+#include "abinstrument.hpp"
+
+#ifdef AB_INSTRUMENT
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <nlohmann/json.hpp>
+#include <utility>
+#include <vector>
+
+using json = nlohmann::json;
+
+constexpr size_t subsystem_count =
+    static_cast<size_t>(InstrumentSubsystem::Count);
+constexpr size_t site_count = static_cast<size_t>(InstrumentSite::Count);
+// samples kept per queue, and the minimum interval between two of them
+constexpr size_t queue_max_samples = 4096;
+constexpr int64_t queue_sample_interval_us = 10000;
+
+static const char *subsystem_name(const InstrumentSubsystem subsystem) {
+  switch (subsystem) {
+  case InstrumentSubsystem::Other:
+    return "other";
+  case InstrumentSubsystem::Elf:
+    return "elf";
+  case InstrumentSubsystem::Spiral:
+    return "spiral";
+  case InstrumentSubsystem::Serialize:
+    return "serialize";
+  case InstrumentSubsystem::Templates:
+    return "templates";
+  case InstrumentSubsystem::Logger:
+    return "logger";
+  case InstrumentSubsystem::Count:
+    break;
+  }
+  return "unknown";
+}
+
+static const char *site_name(const InstrumentSite site) {
+  switch (site) {
+  case InstrumentSite::ThreadPoolQueue:
+    return "threadpool_queue";
+  case InstrumentSite::GuardedSet:
+    return "guarded_set";
+  case InstrumentSite::LoggerIO:
+    return "logger_io";
+  case InstrumentSite::Count:
+    break;
+  }
+  return "unknown";
+}
+
+struct AllocationCounters {
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> bytes;
+  std::atomic<int64_t> live_bytes;
+  std::atomic<int64_t> peak_bytes;
+};
+
+struct MutexCounters {
+  std::atomic<uint64_t> acquisitions;
+  std::atomic<uint64_t> contentions;
+  std::atomic<int64_t> wait_ns;
+  std::atomic<int64_t> max_wait_ns;
+};
+
+struct QueueCounters {
+  std::mutex mutex;
+  size_t max_depth;
+  int64_t last_sample_us;
+  size_t last_depth;
+  // (microseconds since the library was loaded, depth)
+  std::vector<std::pair<int64_t, size_t>> samples;
+};
+
+// zero-initialized before any allocation happens
+static AllocationCounters allocations[subsystem_count];
+static MutexCounters mutexes[site_count];
+static QueueCounters *queues[site_count];
+static std::chrono::steady_clock::time_point epoch =
+    std::chrono::steady_clock::now();
+static thread_local InstrumentSubsystem current_subsystem =
+    InstrumentSubsystem::Other;
+
+static inline void atomic_max(std::atomic<int64_t> &target,
+                              const int64_t value) {
+  int64_t previous = target.load(std::memory_order_relaxed);
+  while (previous < value &&
+         !target.compare_exchange_weak(previous, value,
+                                       std::memory_order_relaxed)) {
+  }
+}
+
+InstrumentScope::InstrumentScope(const InstrumentSubsystem subsystem)
+    : m_previous(current_subsystem) {
+  current_subsystem = subsystem;
+}
+
+InstrumentScope::~InstrumentScope() { current_subsystem = m_previous; }
+
+// Each allocation is prefixed with a header holding its size and subsystem,
+// so that it is accounted to the right subsystem when freed on another
+// thread or in another scope. The header keeps the alignment of malloc().
+struct alignas(alignof(std::max_align_t)) AllocationHeader {
+  size_t size;
+  InstrumentSubsystem subsystem;
+};
+
+static void *instrumented_allocate(const size_t size) noexcept {
+  auto *header = static_cast<AllocationHeader *>(
+      malloc(sizeof(AllocationHeader) + size));
+  if (!header)
+    return nullptr;
+  header->size = size;
+  header->subsystem = current_subsystem;
+  auto &counters = allocations[static_cast<size_t>(header->subsystem)];
+  counters.count.fetch_add(1, std::memory_order_relaxed);
+  counters.bytes.fetch_add(size, std::memory_order_relaxed);
+  atomic_max(counters.peak_bytes,
+             counters.live_bytes.fetch_add(size, std::memory_order_relaxed) +
+                 static_cast<int64_t>(size));
+  return header + 1;
+}
+
+static void instrumented_free(void *ptr) noexcept {
+  if (!ptr)
+    return;
+  auto *header = static_cast<AllocationHeader *>(ptr) - 1;
+  allocations[static_cast<size_t>(header->subsystem)].live_bytes.fetch_sub(
+      header->size, std::memory_order_relaxed);
+  free(header);
+}
+
+void *operator new(const size_t size) {
+  void *ptr = instrumented_allocate(size);
+  if (!ptr)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+void *operator new[](const size_t size) { return operator new(size); }
+
+void *operator new(const size_t size, const std::nothrow_t &) noexcept {
+  return instrumented_allocate(size);
+}
+
+void *operator new[](const size_t size, const std::nothrow_t &) noexcept {
+  return instrumented_allocate(size);
+}
+
+void operator delete(void *ptr) noexcept { instrumented_free(ptr); }
+void operator delete[](void *ptr) noexcept { instrumented_free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { instrumented_free(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { instrumented_free(ptr); }
+void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+  instrumented_free(ptr);
+}
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+  instrumented_free(ptr);
+}
+
+void instrument_mutex_wait(const InstrumentSite site, const bool contended,
+                           const int64_t wait_ns) {
+  auto &counters = mutexes[static_cast<size_t>(site)];
+  counters.acquisitions.fetch_add(1, std::memory_order_relaxed);
+  if (!contended)
+    return;
+  counters.contentions.fetch_add(1, std::memory_order_relaxed);
+  counters.wait_ns.fetch_add(wait_ns, std::memory_order_relaxed);
+  atomic_max(counters.max_wait_ns, wait_ns);
+}
+
+static QueueCounters &queue_counters(const InstrumentSite site) {
+  static std::once_flag once{};
+  std::call_once(once, [] {
+    for (auto &queue : queues) {
+      queue = new QueueCounters{{}, 0, -queue_sample_interval_us, 0, {}};
+      queue->samples.reserve(queue_max_samples);
+    }
+  });
+  return *queues[static_cast<size_t>(site)];
+}
+
+void instrument_queue_depth(const InstrumentSite site, const size_t depth) {
+  auto &queue = queue_counters(site);
+  const int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+                          std::chrono::steady_clock::now() - epoch)
+                          .count();
+  std::lock_guard<std::mutex> guard(queue.mutex);
+  queue.max_depth = std::max(queue.max_depth, depth);
+  if (depth == queue.last_depth ||
+      now - queue.last_sample_us < queue_sample_interval_us ||
+      queue.samples.size() >= queue_max_samples)
+    return;
+  queue.samples.emplace_back(now, depth);
+  queue.last_sample_us = now;
+  queue.last_depth = depth;
+}
+
+std::string instrument_dump() {
+  json allocation_stats = json::object();
+  for (size_t i = 0; i < subsystem_count; i++) {
+    const auto &counters = allocations[i];
+    allocation_stats[subsystem_name(static_cast<InstrumentSubsystem>(i))] = {
+        {"count", counters.count.load(std::memory_order_relaxed)},
+        {"bytes", counters.bytes.load(std::memory_order_relaxed)},
+        {"live_bytes", counters.live_bytes.load(std::memory_order_relaxed)},
+        {"peak_bytes", counters.peak_bytes.load(std::memory_order_relaxed)}};
+  }
+  json mutex_stats = json::object();
+  json queue_stats = json::object();
+  for (size_t i = 0; i < site_count; i++) {
+    const auto site = static_cast<InstrumentSite>(i);
+    const auto &counters = mutexes[i];
+    mutex_stats[site_name(site)] = {
+        {"acquisitions", counters.acquisitions.load(std::memory_order_relaxed)},
+        {"contentions", counters.contentions.load(std::memory_order_relaxed)},
+        {"wait_ns", counters.wait_ns.load(std::memory_order_relaxed)},
+        {"max_wait_ns", counters.max_wait_ns.load(std::memory_order_relaxed)}};
+    auto &queue = queue_counters(site);
+    std::lock_guard<std::mutex> guard(queue.mutex);
+    if (queue.max_depth == 0)
+      continue;
+    json samples = json::array();
+    for (const auto &sample : queue.samples) {
+      samples.push_back({sample.first, sample.second});
+    }
+    queue_stats[site_name(site)] = {{"max_depth", queue.max_depth},
+                                    {"samples", std::move(samples)}};
+  }
+  return json{{"allocations", std::move(allocation_stats)},
+              {"mutexes", std::move(mutex_stats)},
+              {"queues", std::move(queue_stats)}}
+      .dump();
+}
+
+void instrument_reset() {
+  for (auto &counters : allocations) {
+    counters.count.store(0, std::memory_order_relaxed);
+    counters.bytes.store(0, std::memory_order_relaxed);
+    // the live bytes are still live
+    counters.peak_bytes.store(
+        counters.live_bytes.load(std::memory_order_relaxed),
+        std::memory_order_relaxed);
+  }
+  for (size_t i = 0; i < site_count; i++) {
+    auto &counters = mutexes[i];
+    counters.acquisitions.store(0, std::memory_order_relaxed);
+    counters.contentions.store(0, std::memory_order_relaxed);
+    counters.wait_ns.store(0, std::memory_order_relaxed);
+    counters.max_wait_ns.store(0, std::memory_order_relaxed);
+    auto &queue = queue_counters(static_cast<InstrumentSite>(i));
+    std::lock_guard<std::mutex> guard(queue.mutex);
+    queue.max_depth = 0;
+    queue.last_depth = 0;
+    queue.last_sample_us = -queue_sample_interval_us;
+    queue.samples.clear();
+  }
+}
+
+#endif
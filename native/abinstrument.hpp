@@ -0,0 +1,103 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+// Optional instrumentation of the native code (-DAB4_INSTRUMENT=ON, which
+// defines AB_INSTRUMENT), dumped with the abinstrument_dump builtin:
+//
+// - allocation count and bytes (total, live and peak) per subsystem, the
+//   subsystem of a thread being set with AB_INSTRUMENT_SCOPE()
+// - acquisitions, contentions and wait time of the instrumented mutexes
+// - depth of the instrumented queues over time
+//
+// Without AB_INSTRUMENT, the scopes expand to nothing and the instrumented
+// mutexes are plain std::mutex.
+
+enum class InstrumentSubsystem : uint8_t {
+  Other,
+  Elf,
+  Spiral,
+  Serialize,
+  Templates,
+  Logger,
+  Count,
+};
+
+enum class InstrumentSite : uint8_t {
+  ThreadPoolQueue,
+  GuardedSet,
+  LoggerIO,
+  Count,
+};
+
+#ifdef AB_INSTRUMENT
+
+class InstrumentScope {
+public:
+  explicit InstrumentScope(InstrumentSubsystem subsystem);
+  ~InstrumentScope();
+  InstrumentScope(const InstrumentScope &) = delete;
+  InstrumentScope &operator=(const InstrumentScope &) = delete;
+
+private:
+  InstrumentSubsystem m_previous;
+};
+
+#define AB_INSTRUMENT_CONCAT_(a, b) a##b
+#define AB_INSTRUMENT_CONCAT(a, b) AB_INSTRUMENT_CONCAT_(a, b)
+#define AB_INSTRUMENT_SCOPE(subsystem)                                         \
+  const InstrumentScope AB_INSTRUMENT_CONCAT(ab_instrument_scope_, __LINE__) { \
+    InstrumentSubsystem::subsystem                                             \
+  }
+
+void instrument_mutex_wait(InstrumentSite site, bool contended,
+                           int64_t wait_ns);
+void instrument_queue_depth(InstrumentSite site, size_t depth);
+// The counters as JSON.
+std::string instrument_dump();
+void instrument_reset();
+
+template <InstrumentSite site> class InstrumentedMutex {
+public:
+  InstrumentedMutex() = default;
+  InstrumentedMutex(const InstrumentedMutex &) = delete;
+  InstrumentedMutex &operator=(const InstrumentedMutex &) = delete;
+
+  void lock() {
+    if (m_mutex.try_lock()) {
+      instrument_mutex_wait(site, false, 0);
+      return;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    m_mutex.lock();
+    instrument_mutex_wait(
+        site, true,
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count());
+  }
+  bool try_lock() { return m_mutex.try_lock(); }
+  void unlock() { m_mutex.unlock(); }
+
+private:
+  std::mutex m_mutex;
+};
+
+// std::condition_variable only works with std::mutex
+using InstrumentedConditionVariable = std::condition_variable_any;
+
+#else
+
+#define AB_INSTRUMENT_SCOPE(subsystem) ((void)0)
+
+template <InstrumentSite site> using InstrumentedMutex = std::mutex;
+using InstrumentedConditionVariable = std::condition_variable;
+
+static inline void instrument_queue_depth(InstrumentSite, size_t) {}
+
+#endif
@@ -1,61 +1,87 @@
 #include <fstream>
+#include <memory>
 #include <nlohmann/json.hpp>
 
 #include "abjsondata.hpp"
 
 using json = nlohmann::json;
 
-std::vector<std::string>
-jsondata_get_exported_vars(const std::string &ab_path) {
-  const std::string exported_vars_path = ab_path + "/sets/exports.json";
-  std::ifstream exported_vars_file(exported_vars_path);
-  json exported_vars_json = json::parse(exported_vars_file);
+// Parsed contents of the sets/*.json files. The data never changes during
+// the lifetime of the process, so it is only parsed once.
+struct JsonDataCache {
+  std::string ab_path;
   std::vector<std::string> exported_vars;
-  exported_vars.reserve(64);
-  for (json::iterator it = exported_vars_json.begin();
-       it != exported_vars_json.end(); ++it) {
+  std::unordered_map<std::string, std::string> arch_targets;
+  // architecture name -> groups containing the architecture
+  std::unordered_map<std::string, std::vector<std::string>> arch_groups;
+};
+
+static std::unique_ptr<JsonDataCache> jsondata_cache{};
+
+static json jsondata_parse_file(const std::string &path) {
+  std::ifstream file(path);
+  return json::parse(file);
+}
+
+static std::unique_ptr<JsonDataCache>
+jsondata_load(const std::string &ab_path) {
+  auto cache = std::make_unique<JsonDataCache>();
+  cache->ab_path = ab_path;
+
+  const json exported_vars_json =
+      jsondata_parse_file(ab_path + "/sets/exports.json");
+  cache->exported_vars.reserve(64);
+  for (auto it = exported_vars_json.begin(); it != exported_vars_json.end();
+       ++it) {
     const auto inner_array =
         it.value().template get<std::vector<std::string>>();
-    exported_vars.insert(exported_vars.end(), inner_array.begin(),
-                         inner_array.end());
+    cache->exported_vars.insert(cache->exported_vars.end(),
+                                inner_array.begin(), inner_array.end());
+  }
+
+  const json arch_targets =
+      jsondata_parse_file(ab_path + "/sets/arch_targets.json");
+  for (auto it = arch_targets.begin(); it != arch_targets.end(); ++it) {
+    cache->arch_targets.emplace(it.key(),
+                                it.value().template get<std::string>());
+  }
+
+  const json arch_groups =
+      jsondata_parse_file(ab_path + "/sets/arch_groups.json");
+  for (auto it = arch_groups.begin(); it != arch_groups.end(); ++it) {
+    const auto &group_name = it.key();
+    for (const auto &arch_value : it.value()) {
+      cache->arch_groups[arch_value.template get<std::string>()].push_back(
+          group_name);
+    }
   }
 
-  return exported_vars;
+  return cache;
 }
 
-std::unordered_map<std::string, std::string>
-jsondata_get_arch_targets(const std::string &ab_path) {
-  // read targets
-  const auto arch_targets_path = ab_path + "/sets/arch_targets.json";
-  std::ifstream targets_file(arch_targets_path);
-  json arch_targets = json::parse(targets_file);
-  auto arch_target_var = std::unordered_map<std::string, std::string>{};
-  for (json::iterator it = arch_targets.begin(); it != arch_targets.end();
-       ++it) {
-    arch_target_var.emplace(it.key(), it.value().template get<std::string>());
+static const JsonDataCache &jsondata_get_cache(const std::string &ab_path) {
+  if (!jsondata_cache || jsondata_cache->ab_path != ab_path) {
+    jsondata_cache = jsondata_load(ab_path);
   }
-  return arch_target_var;
+  return *jsondata_cache;
+}
+
+const std::vector<std::string> &
+jsondata_get_exported_vars(const std::string &ab_path) {
+  return jsondata_get_cache(ab_path).exported_vars;
+}
+
+const std::unordered_map<std::string, std::string> &
+jsondata_get_arch_targets(const std::string &ab_path) {
+  return jsondata_get_cache(ab_path).arch_targets;
 }
 
 std::vector<std::string>
 jsondata_get_arch_groups(const std::string &ab_path,
                          const std::string &this_arch) {
-  const auto arch_groups_path = ab_path + "/sets/arch_groups.json";
-  std::vector<std::string> groups{};
-  std::ifstream groups_file(arch_groups_path);
-  json arch_groups = json::parse(groups_file);
-  for (json::iterator it = arch_groups.begin(); it != arch_groups.end(); ++it) {
-    const auto &group_name = it.key();
-    auto group = it.value();
-    // search inner array for the target architecture name
-    for (json::iterator it = group.begin(); it != group.end(); ++it) {
-      const auto arch_value = it.value().template get<std::string>();
-      if (arch_value == this_arch) {
-        // append the group name to the array
-        groups.push_back(group_name);
-      }
-    }
-  }
-
-  return groups;
+  const auto &arch_groups = jsondata_get_cache(ab_path).arch_groups;
+  const auto found = arch_groups.find(this_arch);
+  if (found == arch_groups.end())
+    return {};
+  return found->second;
 }
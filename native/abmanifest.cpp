@@ -0,0 +1,622 @@
+#include "abmanifest.hpp"
+#include "threadpool.hpp"
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <memory>
+#include <set>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+// Timestamps within this window of the time of the scan may be shared with
+// a later modification of the directory (the file system timestamps are as
+// coarse as the timer tick).
+constexpr int64_t manifest_racy_window_ns = 100 * 1000 * 1000;
+// Below this many files, the classes are read in the calling thread.
+constexpr size_t manifest_parallel_classify_min = 64;
+
+// indexed by ManifestClass
+static const char *const manifest_class_names[] = {
+    "unknown", "empty", "elf-dynamic", "elf-executable", "elf-relocatable",
+    "elf-other", "archive", "bitcode", "script", "gzip", "xz", "zstd",
+    "bzip2", "data", "none",
+};
+
+static std::unique_ptr<PkgdirManifest> current_manifest{};
+
+static inline int64_t timespec_ns(const struct timespec &ts) {
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static inline int64_t now_ns() {
+  struct timespec ts {};
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return timespec_ns(ts);
+}
+
+static inline bool is_dot_or_dotdot(const char *name) {
+  return name[0] == '.' &&
+         (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+static inline bool has_prefix(const std::string &str,
+                              const std::string &prefix) {
+  return str.compare(0, prefix.size(), prefix) == 0;
+}
+
+static inline std::string join_path(const std::string &parent,
+                                    const char *name) {
+  return parent.empty() ? std::string{name} : parent + "/" + name;
+}
+
+static ManifestEntry make_entry(const struct stat &st, const int64_t now) {
+  ManifestEntry entry{};
+  entry.size = st.st_size;
+  entry.blocks = st.st_blocks;
+  entry.inode = st.st_ino;
+  entry.dev = st.st_dev;
+  entry.mtime_ns = timespec_ns(st.st_mtim);
+  entry.nlink = st.st_nlink;
+  entry.mode = st.st_mode & 07777;
+  entry.cls = ManifestClass::None;
+  if (S_ISREG(st.st_mode)) {
+    entry.type = ManifestType::File;
+    entry.cls = st.st_size ? ManifestClass::Unknown : ManifestClass::Empty;
+  } else if (S_ISDIR(st.st_mode)) {
+    entry.type = ManifestType::Directory;
+    entry.racy = entry.mtime_ns + manifest_racy_window_ns >= now;
+  } else if (S_ISLNK(st.st_mode)) {
+    entry.type = ManifestType::Symlink;
+  } else {
+    entry.type = ManifestType::Other;
+  }
+  return entry;
+}
+
+// Replaces the entry with a newer status of the same path and type, keeping
+// the class of the file and the scan time of the directory if they still
+// hold. Returns false if nothing changed.
+static bool replace_entry(ManifestEntry &old, ManifestEntry entry) {
+  if (old.size == entry.size && old.mtime_ns == entry.mtime_ns &&
+      old.inode == entry.inode && old.mode == entry.mode &&
+      old.nlink == entry.nlink && old.target == entry.target)
+    return false;
+  if (entry.type == ManifestType::File && old.size == entry.size &&
+      old.mtime_ns == entry.mtime_ns && old.inode == entry.inode)
+    entry.cls = old.cls;
+  if (entry.type == ManifestType::Directory) {
+    // compared with the directory itself when it is rescanned
+    entry.mtime_ns = old.mtime_ns;
+    entry.racy = old.racy;
+  }
+  old = std::move(entry);
+  return true;
+}
+
+static void read_link_target(const int dirfd, const char *name,
+                             ManifestEntry &entry) {
+  char buffer[PATH_MAX];
+  const ssize_t len = readlinkat(dirfd, name, buffer, sizeof(buffer));
+  if (len > 0)
+    entry.target.assign(buffer, len);
+}
+
+static ManifestClass classify_head(const unsigned char *head, const size_t n) {
+  if (n == 0)
+    return ManifestClass::Empty;
+  if (n >= EI_NIDENT + 2 && memcmp(head, ELFMAG, SELFMAG) == 0) {
+    // e_type, in the byte order of the file
+    const unsigned char *type_bytes = head + EI_NIDENT;
+    const unsigned int type =
+        head[EI_DATA] == ELFDATA2MSB ? (type_bytes[0] << 8) | type_bytes[1]
+                                     : (type_bytes[1] << 8) | type_bytes[0];
+    switch (type) {
+    case ET_DYN:
+      return ManifestClass::ElfDynamic;
+    case ET_EXEC:
+      return ManifestClass::ElfExecutable;
+    case ET_REL:
+      return ManifestClass::ElfRelocatable;
+    default:
+      return ManifestClass::ElfOther;
+    }
+  }
+  if (n >= 8 && (memcmp(head, "!<arch>\n", 8) == 0 ||
+                 memcmp(head, "!<thin>\n", 8) == 0))
+    return ManifestClass::Archive;
+  if (n >= 4 && memcmp(head, "BC\xc0\xde", 4) == 0)
+    return ManifestClass::Bitcode;
+  if (n >= 2 && head[0] == '#' && head[1] == '!')
+    return ManifestClass::Script;
+  if (n >= 2 && head[0] == 0x1f && head[1] == 0x8b)
+    return ManifestClass::Gzip;
+  if (n >= 6 && memcmp(head, "\xfd" "7zXZ\0", 6) == 0)
+    return ManifestClass::Xz;
+  if (n >= 4 && memcmp(head, "\x28\xb5\x2f\xfd", 4) == 0)
+    return ManifestClass::Zstd;
+  if (n >= 3 && memcmp(head, "BZh", 3) == 0)
+    return ManifestClass::Bzip2;
+  return ManifestClass::Data;
+}
+
+static ManifestClass read_class(const std::string &path) {
+  const int fd = open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd < 0)
+    return ManifestClass::None;
+  unsigned char head[EI_NIDENT + 2];
+  const ssize_t n = read(fd, head, sizeof(head));
+  close(fd);
+  if (n < 0)
+    return ManifestClass::None;
+  return classify_head(head, n);
+}
+
+PkgdirManifest::PkgdirManifest(std::string root)
+    : m_root(std::move(root)), m_root_entry(), m_entries() {
+  if (!m_root.empty() && m_root.front() != '/') {
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)))
+      m_root = std::string{cwd} + "/" + m_root;
+  }
+  while (m_root.size() > 1 && m_root.back() == '/')
+    m_root.pop_back();
+}
+
+bool PkgdirManifest::build() {
+  m_entries.clear();
+  const int64_t now = now_ns();
+  const int fd = open(m_root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  struct stat st {};
+  if (fstat(fd, &st) != 0) {
+    const int err = errno;
+    close(fd);
+    errno = err;
+    return false;
+  }
+  m_root_entry = make_entry(st, now);
+  return scan_children(fd, {});
+}
+
+// Adds the contents of the directory open as dirfd (which is closed
+// afterwards), recursively.
+bool PkgdirManifest::scan_children(const int dirfd,
+                                   const std::string &relative) {
+  DIR *dir = fdopendir(dirfd);
+  if (!dir) {
+    const int err = errno;
+    close(dirfd);
+    errno = err;
+    return false;
+  }
+  const int64_t now = now_ns();
+  std::vector<std::string> subdirs{};
+  while (const dirent *ent = readdir(dir)) {
+    const char *name = ent->d_name;
+    if (is_dot_or_dotdot(name))
+      continue;
+    struct stat st {};
+    if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+      // removed in the meantime
+      if (errno == ENOENT)
+        continue;
+      const int err = errno;
+      closedir(dir);
+      errno = err;
+      return false;
+    }
+    auto entry = make_entry(st, now);
+    if (entry.type == ManifestType::Symlink)
+      read_link_target(dirfd, name, entry);
+    else if (entry.type == ManifestType::Directory)
+      subdirs.emplace_back(name);
+    m_entries[join_path(relative, name)] = std::move(entry);
+  }
+  bool ok = true;
+  for (const auto &name : subdirs) {
+    const int fd = openat(dirfd, name.c_str(),
+                          O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0 || !scan_children(fd, join_path(relative, name.c_str()))) {
+      ok = false;
+      break;
+    }
+  }
+  const int err = errno;
+  closedir(dir);
+  errno = err;
+  return ok;
+}
+
+void PkgdirManifest::erase_children(const std::string &relative) {
+  if (relative.empty()) {
+    m_entries.clear();
+    return;
+  }
+  // the contents of the directory sort between "<dir>/" and "<dir>0"
+  m_entries.erase(m_entries.lower_bound(relative + "/"),
+                  m_entries.lower_bound(relative + "0"));
+}
+
+// Brings the direct children of the directory up to date, the directories
+// added in the meantime are scanned recursively.
+bool PkgdirManifest::rescan_directory(const std::string &relative,
+                                      ManifestEntry &entry, size_t &changed) {
+  const std::string path = relative.empty() ? m_root : m_root + "/" + relative;
+  const int64_t now = now_ns();
+  struct stat st {};
+  if (lstat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+    return false;
+  const int dirfd =
+      open(path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  if (dirfd < 0)
+    return false;
+  DIR *dir = fdopendir(dirfd);
+  if (!dir) {
+    close(dirfd);
+    return false;
+  }
+  entry = make_entry(st, now);
+  std::set<std::string> names{};
+  while (const dirent *ent = readdir(dir)) {
+    if (!is_dot_or_dotdot(ent->d_name))
+      names.emplace(ent->d_name);
+  }
+
+  // remove the entries which are gone
+  const std::string prefix = relative.empty() ? "" : relative + "/";
+  auto it = m_entries.lower_bound(prefix);
+  while (it != m_entries.end() && has_prefix(it->first, prefix)) {
+    const auto slash = it->first.find('/', prefix.size());
+    if (slash != std::string::npos) {
+      // skip the contents of the subdirectory
+      it = m_entries.lower_bound(it->first.substr(0, slash) + "0");
+      continue;
+    }
+    if (names.count(it->first.substr(prefix.size()))) {
+      ++it;
+      continue;
+    }
+    erase_children(it->first);
+    it = m_entries.erase(it);
+    changed++;
+  }
+
+  // add the new entries, update the existing ones
+  for (const auto &name : names) {
+    struct stat child_st {};
+    if (fstatat(dirfd, name.c_str(), &child_st, AT_SYMLINK_NOFOLLOW) != 0)
+      continue;
+    auto child = make_entry(child_st, now);
+    if (child.type == ManifestType::Symlink)
+      read_link_target(dirfd, name.c_str(), child);
+    const auto key = prefix + name;
+    auto existing = m_entries.find(key);
+    if (existing != m_entries.end() && existing->second.type == child.type) {
+      if (replace_entry(existing->second, std::move(child)))
+        changed++;
+      continue;
+    }
+    if (existing != m_entries.end())
+      erase_children(key);
+    const bool is_dir = child.type == ManifestType::Directory;
+    m_entries[key] = std::move(child);
+    changed++;
+    if (is_dir) {
+      const int fd = openat(dirfd, name.c_str(),
+                            O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+      if (fd >= 0)
+        scan_children(fd, key);
+    }
+  }
+  closedir(dir);
+  return true;
+}
+
+size_t PkgdirManifest::refresh() {
+  size_t changed = 0;
+  struct stat st {};
+  if (lstat(m_root.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+    changed = m_entries.size();
+    m_entries.clear();
+    return changed;
+  }
+  if (m_root_entry.racy || timespec_ns(st.st_mtim) != m_root_entry.mtime_ns)
+    rescan_directory({}, m_root_entry, changed);
+
+  std::vector<std::string> directories{};
+  for (const auto &entry : m_entries) {
+    if (entry.second.type == ManifestType::Directory)
+      directories.emplace_back(entry.first);
+  }
+  for (const auto &directory : directories) {
+    // removed along with its parent
+    auto it = m_entries.find(directory);
+    if (it == m_entries.end() || it->second.type != ManifestType::Directory)
+      continue;
+    const auto path = m_root + "/" + directory;
+    if (lstat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+      update(directory);
+      changed++;
+      continue;
+    }
+    if (!it->second.racy && timespec_ns(st.st_mtim) == it->second.mtime_ns)
+      continue;
+    if (!rescan_directory(directory, it->second, changed)) {
+      update(directory);
+      changed++;
+    }
+  }
+  return changed;
+}
+
+bool PkgdirManifest::update(const std::string &path) {
+  std::string relative{};
+  if (!relative_path(path, relative))
+    return false;
+  // the parents of new directories are scanned along with them
+  while (!relative.empty()) {
+    const auto slash = relative.rfind('/');
+    if (slash == std::string::npos ||
+        m_entries.count(relative.substr(0, slash)))
+      break;
+    relative.resize(slash);
+  }
+  if (relative.empty())
+    return build();
+
+  erase_children(relative);
+  const auto full_path = m_root + "/" + relative;
+  struct stat st {};
+  if (lstat(full_path.c_str(), &st) != 0) {
+    m_entries.erase(relative);
+    return true;
+  }
+  auto entry = make_entry(st, now_ns());
+  if (entry.type == ManifestType::Symlink)
+    read_link_target(AT_FDCWD, full_path.c_str(), entry);
+  const bool is_dir = entry.type == ManifestType::Directory;
+  m_entries[relative] = std::move(entry);
+  if (is_dir) {
+    const int fd = open(full_path.c_str(),
+                        O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd >= 0)
+      scan_children(fd, relative);
+  }
+  return true;
+}
+
+bool PkgdirManifest::relative_path(const std::string &path,
+                                   std::string &relative) const {
+  relative.clear();
+  size_t start = 0;
+  if (!path.empty() && path.front() == '/') {
+    const size_t root_len = m_root == "/" ? 0 : m_root.size();
+    if (path.compare(0, root_len, m_root, 0, root_len) != 0 ||
+        (path.size() > root_len && path[root_len] != '/'))
+      return false;
+    start = root_len;
+  }
+  while (start < path.size()) {
+    size_t end = path.find('/', start);
+    if (end == std::string::npos)
+      end = path.size();
+    const auto component = path.substr(start, end - start);
+    start = end + 1;
+    if (component.empty() || component == ".")
+      continue;
+    if (component == "..")
+      return false;
+    if (!relative.empty())
+      relative += '/';
+    relative += component;
+  }
+  return true;
+}
+
+ManifestClass PkgdirManifest::file_class(const std::string &relative,
+                                         ManifestEntry &entry) {
+  if (entry.cls == ManifestClass::Unknown)
+    entry.cls = read_class(m_root + "/" + relative);
+  return entry.cls;
+}
+
+void PkgdirManifest::classify(const std::vector<entry_map::iterator> &entries) {
+  using task_t = entry_map::iterator;
+  std::vector<task_t> unknown{};
+  for (const auto &it : entries) {
+    if (it->second.cls == ManifestClass::Unknown)
+      unknown.emplace_back(it);
+  }
+  if (unknown.size() < manifest_parallel_classify_min) {
+    for (const auto &it : unknown)
+      file_class(it->first, it->second);
+    return;
+  }
+  // each task writes to its own entry only
+  ThreadPool<task_t, void> pool{
+      [this](task_t &it) { file_class(it->first, it->second); }};
+  for (auto &it : unknown)
+    pool.enqueue(std::move(it));
+  pool.wait_for_completion();
+}
+
+uint64_t PkgdirManifest::disk_usage() const {
+  uint64_t blocks = m_root_entry.blocks;
+  // the hard links are counted once
+  std::set<std::pair<uint64_t, uint64_t>> linked{};
+  for (const auto &entry : m_entries) {
+    const auto &info = entry.second;
+    if (info.nlink > 1 && info.type != ManifestType::Directory &&
+        !linked.emplace(info.dev, info.inode).second)
+      continue;
+    blocks += info.blocks;
+  }
+  return (blocks * 512 + 1023) / 1024;
+}
+
+static bool match_query(const std::string &relative,
+                        const ManifestEntry &entry,
+                        const ManifestQuery &query) {
+  if (query.types && !(query.types & static_cast<unsigned int>(entry.type)))
+    return false;
+  const auto slash = relative.rfind('/');
+  const char *name =
+      relative.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+  if (!query.names.empty()) {
+    bool matched = false;
+    for (const auto &glob : query.names) {
+      if (fnmatch(glob.c_str(), name, 0) == 0) {
+        matched = true;
+        break;
+      }
+    }
+    if (!matched)
+      return false;
+  }
+  for (const auto &glob : query.not_names) {
+    if (fnmatch(glob.c_str(), name, 0) == 0)
+      return false;
+  }
+  if (!query.paths.empty()) {
+    bool matched = false;
+    for (const auto &glob : query.paths) {
+      if (fnmatch(glob.c_str(), relative.c_str(), FNM_PATHNAME) == 0) {
+        matched = true;
+        break;
+      }
+    }
+    if (!matched)
+      return false;
+  }
+  if ((query.size_op == '=' && entry.size != query.size) ||
+      (query.size_op == '+' && entry.size <= query.size) ||
+      (query.size_op == '-' && entry.size >= query.size))
+    return false;
+  if ((query.nlink_op == '=' && entry.nlink != query.nlink) ||
+      (query.nlink_op == '+' && entry.nlink <= query.nlink) ||
+      (query.nlink_op == '-' && entry.nlink >= query.nlink))
+    return false;
+  if (query.mode_op) {
+    bool matched = true;
+    switch (query.mode_op) {
+    case '=':
+      matched = entry.mode == query.mode;
+      break;
+    case '-':
+      matched = (entry.mode & query.mode) == query.mode;
+      break;
+    case '/':
+      matched = query.mode == 0 || (entry.mode & query.mode) != 0;
+      break;
+    }
+    if (matched == query.mode_negated)
+      return false;
+  }
+  return true;
+}
+
+static bool match_class(const ManifestClass cls, const ManifestQuery &query) {
+  if (!query.classes.empty()) {
+    bool matched = false;
+    for (const auto c : query.classes) {
+      if (c == cls) {
+        matched = true;
+        break;
+      }
+    }
+    if (!matched)
+      return false;
+  }
+  for (const auto c : query.not_classes) {
+    if (c == cls)
+      return false;
+  }
+  return true;
+}
+
+std::vector<std::string> manifest_query(PkgdirManifest &manifest,
+                                        const ManifestQuery &query) {
+  using iterator_t = PkgdirManifest::entry_map::iterator;
+  auto &entries = manifest.entries();
+  std::vector<iterator_t> candidates{};
+  const auto visit = [&](const iterator_t &it) {
+    if (match_query(it->first, it->second, query))
+      candidates.emplace_back(it);
+  };
+  if (query.directories.empty()) {
+    for (auto it = entries.begin(); it != entries.end(); ++it)
+      visit(it);
+  }
+  for (const auto &directory : query.directories) {
+    if (directory.empty()) {
+      for (auto it = entries.begin(); it != entries.end(); ++it)
+        visit(it);
+      continue;
+    }
+    // the directory itself, like find
+    auto it = entries.find(directory);
+    if (it == entries.end())
+      continue;
+    visit(it);
+    const auto prefix = directory + "/";
+    for (it = entries.lower_bound(prefix);
+         it != entries.end() && has_prefix(it->first, prefix); ++it)
+      visit(it);
+  }
+
+  // the classes are only read for the files matching the other predicates
+  if (!query.classes.empty() || !query.not_classes.empty())
+    manifest.classify(candidates);
+  const auto &root = manifest.root() == "/" ? std::string{} : manifest.root();
+  std::vector<std::string> results{};
+  for (const auto &it : candidates) {
+    if (!match_class(it->second.cls, query))
+      continue;
+    results.emplace_back(query.relative ? it->first : root + "/" + it->first);
+  }
+  return results;
+}
+
+const char *manifest_class_name(ManifestClass cls) {
+  return manifest_class_names[static_cast<size_t>(cls)];
+}
+
+bool manifest_parse_class(const char *name, std::vector<ManifestClass> &out) {
+  if (strcmp(name, "elf") == 0) {
+    out.insert(out.end(),
+               {ManifestClass::ElfDynamic, ManifestClass::ElfExecutable,
+                ManifestClass::ElfRelocatable, ManifestClass::ElfOther});
+    return true;
+  }
+  for (size_t i = 0; i < sizeof(manifest_class_names) / sizeof(char *); i++) {
+    if (strcmp(name, manifest_class_names[i]) == 0) {
+      out.emplace_back(static_cast<ManifestClass>(i));
+      return true;
+    }
+  }
+  return false;
+}
+
+PkgdirManifest *manifest_current() { return current_manifest.get(); }
+
+PkgdirManifest *manifest_load(const std::string &root) {
+  auto manifest = std::make_unique<PkgdirManifest>(root);
+  if (!manifest->build()) {
+    const int err = errno;
+    current_manifest.reset();
+    errno = err;
+    return nullptr;
+  }
+  current_manifest = std::move(manifest);
+  return current_manifest.get();
+}
+
+void manifest_free() { current_manifest.reset(); }
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+enum class ManifestType : uint8_t {
+  File = 1 << 0,
+  Directory = 1 << 1,
+  Symlink = 1 << 2,
+  Other = 1 << 3,
+};
+
+// Classification of the regular files by their first bytes, read on demand.
+enum class ManifestClass : uint8_t {
+  Unknown = 0,
+  Empty,
+  ElfDynamic,
+  ElfExecutable,
+  ElfRelocatable,
+  ElfOther,
+  Archive,
+  Bitcode,
+  Script,
+  Gzip,
+  Xz,
+  Zstd,
+  Bzip2,
+  Data,
+  // not a regular file, or unreadable
+  None,
+};
+
+struct ManifestEntry {
+  std::string target; // of the symlinks
+  uint64_t size;
+  uint64_t blocks;
+  uint64_t inode;
+  uint64_t dev;
+  int64_t mtime_ns;
+  uint32_t nlink;
+  uint16_t mode; // permission bits
+  ManifestType type;
+  ManifestClass cls;
+  // the directory was modified too recently for its modification time to
+  // tell later changes apart, it is rescanned by the next refresh
+  bool racy;
+};
+
+// The entries of a directory tree (PKGDIR), recorded by a single walk and
+// kept up to date by rescanning the directories whose modification time
+// changed, so that the post-build stages can query it instead of walking
+// the tree again and again.
+class PkgdirManifest {
+public:
+  using entry_map = std::map<std::string, ManifestEntry>;
+
+  explicit PkgdirManifest(std::string root);
+  // Walks the whole tree, returns false with errno set on errors.
+  bool build();
+  // Rescans the directories modified since they were last scanned, which
+  // catches the files added, removed or renamed, but not the files modified
+  // in place. Returns the number of entries added, removed or changed.
+  size_t refresh();
+  // Rescans the path (recursively for directories), or removes it from the
+  // manifest if it no longer exists. Returns false if the path is outside of
+  // the tree.
+  bool update(const std::string &path);
+  // Converts a path (absolute, or relative to the root) to the key of its
+  // entry, "" being the root itself.
+  bool relative_path(const std::string &path, std::string &relative) const;
+  // Reads the classes of the entries which are not known yet, in parallel.
+  void classify(const std::vector<entry_map::iterator> &entries);
+  ManifestClass file_class(const std::string &relative, ManifestEntry &entry);
+  // Disk usage in KiB, like du -s.
+  uint64_t disk_usage() const;
+
+  const std::string &root() const { return m_root; }
+  entry_map &entries() { return m_entries; }
+  const entry_map &entries() const { return m_entries; }
+
+private:
+  bool scan_children(int dirfd, const std::string &relative);
+  bool rescan_directory(const std::string &relative, ManifestEntry &entry,
+                        size_t &changed);
+  void erase_children(const std::string &relative);
+
+  std::string m_root;
+  ManifestEntry m_root_entry;
+  entry_map m_entries;
+};
+
+// Predicates of manifest_query(), loosely following find(1). The values of
+// the same predicate are alternatives, different predicates must all match.
+struct ManifestQuery {
+  // restricts the results to these directories (relative keys) and their
+  // contents, the whole tree if empty
+  std::vector<std::string> directories;
+  unsigned int types = 0; // ManifestType bits, any type if 0
+  std::vector<std::string> names;      // globs on the file name
+  std::vector<std::string> not_names;  // excluded file name globs
+  std::vector<std::string> paths;      // globs on the relative path
+  std::vector<ManifestClass> classes;  // "elf" is expanded to all ELF classes
+  std::vector<ManifestClass> not_classes;
+  // '=', '+' (greater than) or '-' (less than), not checked if 0
+  char size_op = 0;
+  uint64_t size = 0;
+  char nlink_op = 0;
+  uint32_t nlink = 0;
+  // '=' (exactly), '-' (all of the bits) or '/' (any of the bits)
+  char mode_op = 0;
+  uint16_t mode = 0;
+  bool mode_negated = false;
+  // relative paths instead of absolute paths
+  bool relative = false;
+};
+
+// Returns the matching paths in lexicographical order.
+std::vector<std::string> manifest_query(PkgdirManifest &manifest,
+                                        const ManifestQuery &query);
+const char *manifest_class_name(ManifestClass cls);
+// Parses a class name, "elf" adds all ELF classes.
+bool manifest_parse_class(const char *name, std::vector<ManifestClass> &out);
+
+// The manifest built by abmanifest_build, nullptr if there is none.
+PkgdirManifest *manifest_current();
+// Replaces the current manifest with a new one of the tree, nullptr with
+// errno set on errors.
+PkgdirManifest *manifest_load(const std::string &root);
+void manifest_free();
@@ -1,4 +1,6 @@
 #include "abnativeelf.hpp"
+#include "abprogress.hpp"
+#include "abtrace.hpp"
 #include "abnativefunctions.h"
 #include "stdwrapper.hpp"
 #include "threadpool.hpp"
@@ -398,8 +400,7 @@ const AOSCArch detect_architecture(Elf *elf_file, GElf_Ehdr &elf_ehdr,
   }
 }
 
-static ELFParseResult identify_binary_data(const char *data,
-                                           const size_t size) {
+ELFParseResult identify_binary_data(const char *data, const size_t size) {
   ELFParseResult result{};
   const bool is_static_library =
       (size >= 8 && memcmp(data, ar_magic.data(), ar_magic.size()) == 0) ||
@@ -626,6 +627,88 @@ aosc_arch_to_debian_arch_suffix(const char *arch_name) {
   return aosc_arch_to_debian_arch_suffix(parse_aosc_arch_name(arch_name));
 }
 
+const char *aosc_arch_name(const AOSCArch arch) {
+  switch (arch) {
+  case AOSCArch::ALPHA:
+    return "alpha";
+  case AOSCArch::AMD64:
+    return "amd64";
+  case AOSCArch::ARM64:
+    return "arm64";
+  case AOSCArch::ARMV4:
+    return "armv4";
+  case AOSCArch::ARMV6HF:
+    return "armv6hf";
+  case AOSCArch::ARMV7HF:
+    return "armv7hf";
+  case AOSCArch::I486:
+    return "i486";
+  case AOSCArch::IA64:
+    return "ia64";
+  case AOSCArch::LOONGARCH64:
+    return "loongarch64";
+  case AOSCArch::LOONGSON2F:
+    return "loongson2f";
+  case AOSCArch::LOONGSON3:
+    return "loongson3";
+  case AOSCArch::MIPS64R6EL:
+    return "mips64r6el";
+  case AOSCArch::POWERPC:
+    return "powerpc";
+  case AOSCArch::PPC64:
+    return "ppc64";
+  case AOSCArch::PPC64EL:
+    return "ppc64el";
+  case AOSCArch::RISCV64:
+    return "riscv64";
+  case AOSCArch::SPARC64:
+    return "sparc64";
+  default:
+    return "";
+  }
+}
+
+const char *binary_type_name(const BinaryType type) {
+  switch (type) {
+  case BinaryType::Static:
+    return "static";
+  case BinaryType::Dynamic:
+    return "dynamic";
+  case BinaryType::Executable:
+    return "executable";
+  case BinaryType::Relocatable:
+    return "relocatable";
+  case BinaryType::KernelObject:
+    return "kernel-object";
+  case BinaryType::LLVM_IR:
+    return "llvm-ir";
+  default:
+    return "invalid";
+  }
+}
+
+int elf_identify_file(const char *path, ELFParseResult &result) {
+  const int fd = open(path, O_RDONLY | O_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+  struct stat st {};
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return -1;
+  }
+  if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+    close(fd);
+    result = ELFParseResult{};
+    return 0;
+  }
+  const MappedFile file{fd, static_cast<size_t>(st.st_size)};
+  if (file.addr() == MAP_FAILED)
+    return -1;
+  result = identify_binary_data(static_cast<const char *>(file.addr()),
+                                file.size());
+  return 0;
+}
+
 class FileLockGuard {
 public:
   FileLockGuard(int fd) : m_fd{fd} { flock(m_fd, LOCK_EX); }
@@ -636,9 +719,39 @@ private:
   int m_fd;
 };
 
+// Counts the file in the progress of the pool when it is done with, as
+// skipped unless it could be read.
+class ProgressGuard {
+public:
+  explicit ProgressGuard(ProgressReporter *progress)
+      : m_progress(progress), m_size(0), m_skipped(true) {}
+
+  inline void set(const uint64_t size, const bool skipped) {
+    m_size = size;
+    m_skipped = skipped;
+  }
+
+  ~ProgressGuard() {
+    if (!m_progress)
+      return;
+    if (m_skipped)
+      m_progress->skipped(m_size);
+    else
+      m_progress->processed(m_size);
+  }
+
+private:
+  ProgressReporter *m_progress;
+  uint64_t m_size;
+  bool m_skipped;
+};
+
 int elf_copy_debug_symbols(const char *src_path, const char *dst_path,
                            int flags, GuardedSet<std::string> &symbols,
-                           GuardedSet<std::string> &sonames) {
+                           GuardedSet<std::string> &sonames,
+                           ProgressReporter *progress) {
+  AB_INSTRUMENT_SCOPE(Elf);
+  ProgressGuard progress_guard{progress};
   int fd = open(src_path, O_RDONLY, 0);
   if (fd < 0) {
     perror("open");
@@ -659,6 +772,7 @@ int elf_copy_debug_symbols(const char *src_path, const char *dst_path,
   extra_args.reserve(1);
   const char *data = static_cast<const char *>(file.addr());
   const ELFParseResult result = identify_binary_data(data, size);
+  progress_guard.set(size, result.bin_type == BinaryType::Invalid);
 
   constexpr const char *base_path = "/usr/lib/";
   constexpr const size_t base_len = sizeof(base_path);
@@ -731,27 +845,25 @@ int elf_copy_debug_symbols(const char *src_path, const char *dst_path,
 
   fs::path final_path;
   if (flags & AB_ELF_STRIP_ONLY) {
-    get_logger()->info(
-        fmt::format("Stripping debug symbols from {0}", src_path));
+    get_logger()->infof("Stripping debug symbols from {0}", src_path);
   } else {
-    get_logger()->info(
-        fmt::format("Saving and stripping debug symbols from {0}", src_path));
+    get_logger()->infof("Saving and stripping debug symbols from {0}",
+                        src_path);
     if (!result.has_debug_info) {
-      get_logger()->warning(
-          fmt::format("No debug symbols found in {0}", src_path));
+      get_logger()->warningf("No debug symbols found in {0}", src_path);
       return -3;
     }
 
     if (result.build_id.empty() && !(flags & AB_ELF_SAVE_WITH_PATH)) {
       // For binaries without build-id, save with path
       flags |= AB_ELF_SAVE_WITH_PATH;
-      get_logger()->warning(fmt::format(
-          "No build id found in {0}. Saving with relative path", src_path));
+      get_logger()->warningf(
+          "No build id found in {0}. Saving with relative path", src_path);
     }
 
     if (flags & AB_ELF_SAVE_WITH_PATH) {
       final_path = fs::path{dst_path} / fs::path{src_path}.filename();
-      get_logger()->debug(fmt::format("Saving to {0}", final_path.string()));
+      get_logger()->debugf("Saving to {0}", final_path.string());
     } else {
       final_path = get_filename_from_build_id(result.build_id, dst_path);
     }
@@ -804,14 +916,24 @@ int elf_copy_to_symdir(const char *src_path, const char *dst_path,
   return chown(final_path.c_str(), 0, 0);
 }
 
-class ELFWorkerPool : public ThreadPool<std::string, int> {
+// a file to process and its size, as seen when the file was found
+using ELFTask = std::pair<std::string, uint64_t>;
+
+class ELFWorkerPool : public ThreadPool<ELFTask, int> {
 public:
   ELFWorkerPool(std::string symdir, int flags)
-      : ThreadPool<std::string, int>([&, flags](const std::string &src_path) {
-          return elf_copy_debug_symbols(src_path.c_str(), m_symdir.c_str(),
-                                        flags, m_sodeps, m_sonames);
+      : ThreadPool<ELFTask, int>([&, flags](const ELFTask &task) {
+          TraceSpan span{"elf", task.first};
+          // the build statistics keep the cost of the files by size
+          span.set_bytes(task.second);
+          return elf_copy_debug_symbols(task.first.c_str(), m_symdir.c_str(),
+                                        flags, m_sodeps, m_sonames,
+                                        &m_progress);
         }),
-        m_symdir(std::move(symdir)), m_sodeps(), m_sonames() {}
+        m_symdir(std::move(symdir)), m_sodeps(), m_sonames(),
+        m_progress("elf") {}
+
+  ProgressReporter &progress() { return m_progress; }
 
   const std::unordered_set<std::string> get_sodeps() const {
     return m_sodeps.get_set();
@@ -825,24 +947,42 @@ private:
   const std::string m_symdir;
   GuardedSet<std::string> m_sodeps;
   GuardedSet<std::string> m_sonames;
+  ProgressReporter m_progress;
 };
 
-int elf_copy_debug_symbols_parallel(const std::vector<std::string> &directories,
-                                    const char *dst_path,
-                                    std::unordered_set<std::string> &so_deps,
-                                    std::unordered_set<std::string> &sonames,
-                                    int flags) {
-  ELFWorkerPool pool{dst_path, flags};
-  for (const auto &directory : directories) {
-    for (const auto &entry : fs::recursive_directory_iterator(directory)) {
-      if (entry.is_regular_file() && (!entry.is_symlink())) {
-        // queue the files
-        pool.enqueue(entry.path().string());
-      }
-    }
+// Queues the file right away, or records its expected cost to queue the
+// files by cost once all of them are known.
+static void elf_queue_file(ELFWorkerPool &pool, const ELFCostHint *hint,
+                           std::vector<std::pair<double, ELFTask>> &files,
+                           std::string path, const uint64_t size) {
+  pool.progress().discovered(size);
+  if (!hint) {
+    pool.enqueue(ELFTask{std::move(path), size});
+    return;
+  }
+  const auto cost = hint->cost_us.find(path);
+  const double expected_us = cost != hint->cost_us.end()
+                                 ? static_cast<double>(cost->second)
+                                 : size * hint->us_per_byte;
+  files.emplace_back(expected_us, ELFTask{std::move(path), size});
+}
+
+static int elf_finish_pool(ELFWorkerPool &pool,
+                           std::vector<std::pair<double, ELFTask>> &files,
+                           std::unordered_set<std::string> &so_deps,
+                           std::unordered_set<std::string> &sonames,
+                           const int flags) {
+  pool.progress().discovery_done();
+  // the workers take the last queued file first
+  std::sort(files.begin(), files.end());
+  for (auto &file : files) {
+    pool.enqueue(std::move(file.second));
   }
 
   pool.wait_for_completion();
+  pool.progress().finish();
+  // the workers may have queued their messages (ABASYNCLOG=1)
+  logger_flush();
 
   if (flags & AB_ELF_FIND_SO_DEPS) {
     const auto pool_results = pool.get_sodeps();
@@ -859,3 +999,40 @@ int elf_copy_debug_symbols_parallel(const std::vector<std::string> &directories,
 
   return 0;
 }
+
+int elf_copy_debug_symbols_parallel(const std::vector<std::string> &directories,
+                                    const char *dst_path,
+                                    std::unordered_set<std::string> &so_deps,
+                                    std::unordered_set<std::string> &sonames,
+                                    int flags, const ELFCostHint *hint) {
+  AB_INSTRUMENT_SCOPE(Elf);
+  // also closed if walking the directories throws
+  const TraceStage stage{"pool", "elf"};
+  ELFWorkerPool pool{dst_path, flags};
+  // with a cost hint, the files are queued once all of them are known
+  std::vector<std::pair<double, ELFTask>> files{};
+  for (const auto &directory : directories) {
+    for (const auto &entry : fs::recursive_directory_iterator(directory)) {
+      if (entry.is_regular_file() && (!entry.is_symlink())) {
+        elf_queue_file(pool, hint, files, entry.path().string(),
+                       entry.file_size());
+      }
+    }
+  }
+  return elf_finish_pool(pool, files, so_deps, sonames, flags);
+}
+
+int elf_copy_debug_symbols_files(
+    const std::vector<std::pair<std::string, uint64_t>> &paths,
+    const char *dst_path, std::unordered_set<std::string> &so_deps,
+    std::unordered_set<std::string> &sonames, int flags,
+    const ELFCostHint *hint) {
+  AB_INSTRUMENT_SCOPE(Elf);
+  const TraceStage stage{"pool", "elf"};
+  ELFWorkerPool pool{dst_path, flags};
+  std::vector<std::pair<double, ELFTask>> files{};
+  for (const auto &path : paths) {
+    elf_queue_file(pool, hint, files, path.first, path.second);
+  }
+  return elf_finish_pool(pool, files, so_deps, sonames, flags);
+}
@@ -3,9 +3,13 @@
 #include <cstdint>
 #include <mutex>
 #include <string>
+#include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
+#include "abinstrument.hpp"
+
 enum class BinaryType : uint8_t {
   Invalid = 0,
   Static,
@@ -51,17 +55,18 @@ public:
   GuardedSet() = default;
   GuardedSet(std::unordered_set<T> set) : m_set{std::move(set)} {}
   template <typename Iterator> void insert(Iterator begin, Iterator end) {
-    auto lock_guard = std::lock_guard<std::mutex>{m_mutex};
+    auto lock_guard = std::lock_guard<mutex_t>{m_mutex};
     m_set.insert(begin, end);
   }
   void emplace(T elem) {
-    auto lock_guard = std::lock_guard<std::mutex>{m_mutex};
+    auto lock_guard = std::lock_guard<mutex_t>{m_mutex};
     m_set.emplace(std::move(elem));
   }
   const std::unordered_set<T> &get_set() const { return m_set; }
 
 private:
-  std::mutex m_mutex;
+  using mutex_t = InstrumentedMutex<InstrumentSite::GuardedSet>;
+  mutex_t m_mutex;
   std::unordered_set<T> m_set;
 };
 
@@ -74,13 +79,39 @@ constexpr int AB_ELF_FIND_SONAMES = 1 << 5;
 
 int elf_copy_to_symdir(const char *src_path, const char *dst_path,
                        const char *build_id);
+class ProgressReporter;
+// The file is counted in progress (if any) once it is handled.
 int elf_copy_debug_symbols(const char *src_path, const char *dst_path,
                            int flags, GuardedSet<std::string> &symbols,
-                           GuardedSet<std::string> &sonames);
+                           GuardedSet<std::string> &sonames,
+                           ProgressReporter *progress = nullptr);
+// Expected processing time of the files, from earlier builds.
+struct ELFCostHint {
+  // by path
+  std::unordered_map<std::string, int64_t> cost_us;
+  // for the other files, by size
+  double us_per_byte;
+};
+// With a cost hint, the most expensive files are processed first.
 int elf_copy_debug_symbols_parallel(const std::vector<std::string> &directories,
                                     const char *dst_path,
                                     std::unordered_set<std::string> &so_deps,
                                     std::unordered_set<std::string> &sonames,
-                                    int flags = AB_ELF_USE_EU_STRIP);
+                                    int flags = AB_ELF_USE_EU_STRIP,
+                                    const ELFCostHint *hint = nullptr);
+// Same as above, for the given files (with their sizes) instead of the
+// contents of directories.
+int elf_copy_debug_symbols_files(
+    const std::vector<std::pair<std::string, uint64_t>> &paths,
+    const char *dst_path, std::unordered_set<std::string> &so_deps,
+    std::unordered_set<std::string> &sonames, int flags = AB_ELF_USE_EU_STRIP,
+    const ELFCostHint *hint = nullptr);
 const std::unordered_set<std::string>
 aosc_arch_to_debian_arch_suffix(const char *arch_name);
+const char *aosc_arch_name(const AOSCArch arch);
+const char *binary_type_name(const BinaryType type);
+// Classifies the file without modifying it, non-regular and empty files are
+// reported as BinaryType::Invalid. Returns -1 with errno set on I/O errors.
+int elf_identify_file(const char *path, ELFParseResult &result);
+// Classifies the file mapped at data, ELF files are parsed in place.
+ELFParseResult identify_binary_data(const char *data, size_t size);
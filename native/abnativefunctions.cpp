@@ -1,11 +1,20 @@
 #include "logger.hpp"
 
 #include "abconfig.h"
+#include "abbuildlog.hpp"
+#include "abbuildstats.hpp"
+#include "abbundle.hpp"
+#include "abfileindex.hpp"
+#include "abinstrument.hpp"
 #include "abjsondata.hpp"
+#include "abmanifest.hpp"
 #include "abnativeelf.hpp"
 #include "abnativefunctions.h"
+#include "abserver.hpp"
 #include "abserialize.hpp"
 #include "abspiral.hpp"
+#include "abtemplates.hpp"
+#include "abtrace.hpp"
 #include "bashinterface.hpp"
 #include "pm.hpp"
 #include "stdwrapper.hpp"
@@ -14,13 +23,23 @@
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
+#include <csignal>
 #include <fcntl.h>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <poll.h>
 #include <random>
+#include <sstream>
 #include <string>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <thread>
 #include <unistd.h>
+#include <unordered_map>
 #include <unordered_set>
 
 extern "C" {
@@ -120,36 +139,48 @@ static inline std::string string_to_uppercase(const std::string &str) {
   return result;
 }
 
-static inline std::string arch_findfile_maybe_stage2(std::string &path,
-                                                     bool is_stage2) {
-  auto test_path_stage2 = path + ".stage2";
-  if (is_stage2 && access(test_path_stage2.c_str(), F_OK) == 0) {
-    return test_path_stage2;
+static inline std::string
+arch_findfile_maybe_stage2(const FileIndex *index, const std::string &prefix,
+                           const std::string &path, bool is_stage2) {
+  const auto exists = [&](const std::string &relative_path) {
+    if (index)
+      return index->exists(relative_path);
+    const auto test_path = "autobuild/" + relative_path;
+    return access(test_path.c_str(), F_OK) == 0;
+  };
+  const auto test_path = prefix + path;
+  if (is_stage2 && exists(test_path + ".stage2")) {
+    return "autobuild/" + test_path + ".stage2";
   }
-  if (access(path.c_str(), F_OK) == 0) {
+  if (exists(test_path)) {
     if (is_stage2) {
-      get_logger()->warning(fmt::format(
-          "Unable to find stage2 {0}, falling back to normal defines ...",
-          path));
+      get_logger()->warningf(
+          "Unable to find stage2 autobuild/{0}, falling back to normal "
+          "defines ...",
+          test_path);
     }
-    return path;
+    return "autobuild/" + test_path;
   }
   return {};
 }
 
 static inline std::string arch_findfile_inner(const std::string &path,
                                               bool stage2_aware) {
-  const auto defines_path = std::string{"autobuild/"};
+  // use the cached listing of the autobuild/ directory if possible,
+  // otherwise probe the file system directly
+  const FileIndex *index = FileIndex::is_indexable(path)
+                               ? &autobuild_file_index()
+                               : nullptr;
   // find arch-specific directory first
   const auto *arch_name = find_variable("ABHOST");
   const auto *stage2_v = find_variable("ABSTAGE2");
   const bool is_stage2 =
       stage2_aware && (stage2_v ? autobuild_bool(stage2_v->value) : false);
   if (arch_name && arch_name->value) {
-    auto test_path = defines_path + arch_name->value + "/" + path;
-    auto result = arch_findfile_maybe_stage2(test_path, is_stage2);
+    auto result = arch_findfile_maybe_stage2(
+        index, std::string{arch_name->value} + "/", path, is_stage2);
     if (!result.empty()) {
-      return std::move(result);
+      return result;
     }
   }
 
@@ -160,20 +191,19 @@ static inline std::string arch_findfile_inner(const std::string &path,
   const auto *ag_a = array_cell(ag_v);
   for (const ARRAY_ELEMENT *ae = element_forw(ag_a->head); ae != ag_a->head;
        ae = element_forw(ae)) {
-    auto test_path = defines_path + ae->value + "/" + path;
-    auto result = arch_findfile_maybe_stage2(test_path, is_stage2);
+    auto result = arch_findfile_maybe_stage2(
+        index, std::string{ae->value} + "/", path, is_stage2);
     // TODO: check if the group name is ambiguous
     if (!result.empty()) {
-      return std::move(result);
+      return result;
     }
   }
 
   // lastly, try to find the file in the standard location
   {
-    auto test_path = defines_path + path;
-    auto result = arch_findfile_maybe_stage2(test_path, is_stage2);
+    auto result = arch_findfile_maybe_stage2(index, {}, path, is_stage2);
     if (!result.empty()) {
-      return std::move(result);
+      return result;
     }
   }
   // not found
@@ -195,6 +225,48 @@ static inline void bash_array_push(ARRAY *array, char *value) {
   array->num_elements++;
 }
 
+// Handles the `-v <var>' option (like printf -v) of the builtins printing
+// their results, so that the callers don't need a command substitution.
+// Advances `list' past the option if it is present.
+static int get_output_varname(WORD_LIST *&list, const char *&varname) {
+  varname = nullptr;
+  const auto *argv1 = get_argv1(list);
+  if (!argv1 || strcmp(argv1, "-v") != 0)
+    return 0;
+  varname = get_argv1(list->next);
+  if (!varname || !legal_identifier(varname))
+    return EX_BADUSAGE;
+  list = list->next->next;
+  return 0;
+}
+
+static int bind_output_variable(const char *varname, const std::string &value) {
+  const auto *var =
+      bind_variable(varname, const_cast<char *>(value.c_str()), 0);
+  return var ? 0 : EX_BADASSIGN;
+}
+
+static int bind_output_array(const char *varname,
+                             const std::vector<std::string> &values) {
+  // reuse the existing variable so that the local variables are respected
+  auto *var = find_variable(varname);
+  if (var && (readonly_p(var) || (var->attributes & att_assoc)))
+    return EX_BADASSIGN;
+  if (!var)
+    var = make_new_array_variable(const_cast<char *>(varname));
+  else if (!(var->attributes & att_array))
+    var = convert_var_to_array(var);
+  if (!var)
+    return EX_BADASSIGN;
+  auto *var_a = array_cell(var);
+  array_flush(var_a);
+  for (size_t i = 0; i < values.size(); i++) {
+    array_insert(var_a, static_cast<arrayind_t>(i),
+                 const_cast<char *>(values[i].c_str()));
+  }
+  return 0;
+}
+
 static int ab_bool(WORD_LIST *list) {
   const char *argv1 = get_argv1(list);
   if (!argv1)
@@ -345,11 +417,276 @@ static int aberr(WORD_LIST *list) {
 }
 
 static int abdbg(WORD_LIST *list) {
+  if (!get_logger()->enabled(LogLevel::Debug))
+    return 0;
   const auto message = get_all_args(list, true);
   get_logger()->debug(message);
   return 0;
 }
 
+static std::string format_resource_usage(const ResourceUsage &usage) {
+  std::string text{};
+  if (usage.user_us >= 0)
+    text += fmt::format(", CPU {0:.2f}s",
+                        (usage.user_us + usage.system_us) / 1e6);
+  const int64_t peak = usage.cgroup_memory_peak >= 0
+                           ? usage.cgroup_memory_peak / 1024
+                           : usage.max_rss_kb;
+  if (peak >= 0)
+    text += fmt::format(", peak memory {0} MiB", peak / 1024);
+  if (usage.read_bytes >= 0)
+    text += fmt::format(", {0} MiB read, {1} MiB written",
+                        usage.read_bytes >> 20, usage.write_bytes >> 20);
+  return text;
+}
+
+static LogFields resource_usage_fields(const TraceEvent &event) {
+  LogFields fields{{"wall_us", event.duration_us}};
+  const std::pair<const char *, int64_t> values[] = {
+      {"user_us", event.usage.user_us},
+      {"system_us", event.usage.system_us},
+      {"max_rss_kb", event.usage.max_rss_kb},
+      {"read_bytes", event.usage.read_bytes},
+      {"write_bytes", event.usage.write_bytes},
+      {"cgroup_memory_peak", event.usage.cgroup_memory_peak},
+      {"cgroup_anon_peak", event.usage.cgroup_anon_peak},
+      {"cgroup_read_bytes", event.usage.cgroup_read_bytes},
+      {"cgroup_write_bytes", event.usage.cgroup_write_bytes},
+  };
+  for (const auto &value : values) {
+    if (value.second >= 0)
+      fields.emplace_back(value.first, value.second);
+  }
+  return fields;
+}
+
+static std::string shell_variable_value(const char *name) {
+  const auto *var = find_variable(name);
+  return (var && var->value) ? var->value : std::string{};
+}
+
+// The number of jobs of -j/--jobs in MAKEFLAGS (the last one wins), or -1.
+static int makeflags_jobs(const std::string &makeflags) {
+  int jobs = -1;
+  std::istringstream words(makeflags);
+  std::string word{};
+  while (words >> word) {
+    const char *value = nullptr;
+    if (word.compare(0, 7, "--jobs=") == 0)
+      value = word.c_str() + 7;
+    else if (word.compare(0, 2, "-j") == 0)
+      value = word.c_str() + 2;
+    if (value)
+      jobs = std::atoi(value) > 0 ? std::atoi(value) : -1;
+  }
+  return jobs;
+}
+
+static std::string buildstats_store() {
+  const auto store = shell_variable_value("ABSTATSDB");
+  return store.empty() ? buildstats_default_store : store;
+}
+
+// Appends the record of this build to the build statistics store (ABSTATS=1).
+static void buildstats_record_build(const std::vector<TraceEvent> &events,
+                                    const bool failed) {
+  const auto name = shell_variable_value("PKGNAME");
+  if (name.empty())
+    return;
+  auto version = shell_variable_value("PKGVER");
+  const auto release = shell_variable_value("PKGREL");
+  if (!release.empty())
+    version += "-" + release;
+  const auto epoch = shell_variable_value("PKGEPOCH");
+  if (!epoch.empty() && epoch != "0")
+    version = epoch + ":" + version;
+  const int threads = std::atoi(shell_variable_value("ABTHREADS").c_str());
+  const int jobs = makeflags_jobs(shell_variable_value("MAKEFLAGS"));
+  const BuildStatsPackage pkg{name, version, shell_variable_value("ABHOST"),
+                              threads, jobs > 0 ? jobs : threads};
+  const auto store = buildstats_store();
+  if (!buildstats_append(store, pkg, events, shell_variable_value("PKGDIR"),
+                         failed)) {
+    get_logger()->warningf("Unable to append the build statistics to {0}: {1}",
+                           store, strerror(errno));
+  }
+}
+
+// Writes the trace (ABTRACE=1) to $SRCDIR/abtrace.json and the resource usage
+// of the stages (ABSTATS=1) to $SRCDIR/.buildstats.json and the build
+// statistics store, then logs a short summary of where the time went.
+static void trace_finish_build(const bool failed) {
+  const int flags = trace_flags();
+  if (!flags)
+    return;
+  const auto *srcdir_v = find_variable("SRCDIR");
+  const std::string srcdir =
+      (srcdir_v && srcdir_v->value) ? srcdir_v->value : ".";
+  const std::string trace_path = srcdir + "/abtrace.json";
+  const std::string stats_path = srcdir + "/.buildstats.json";
+  std::vector<TraceEvent> events{};
+  auto *log = get_logger();
+  if (!trace_finish(trace_path, events)) {
+    log->warningf("Unable to write the build trace to {0}", trace_path);
+  }
+  if (events.empty())
+    return;
+  if ((flags & AB_TRACE_RESOURCES) && !trace_write_stats(stats_path, events)) {
+    log->warningf("Unable to write the build resource usage to {0}",
+                  stats_path);
+  }
+  if (flags & AB_TRACE_RESOURCES)
+    buildstats_record_build(events, failed);
+  // the stages are listed in the order they ran, the rest is totalled per
+  // category
+  constexpr const char *stage_categories[] = {"proc", "template", "hwcaps",
+                                              "pool"};
+  std::vector<const TraceEvent *> stages{};
+  std::vector<std::string> categories{};
+  std::unordered_map<std::string, std::pair<size_t, int64_t>> totals{};
+  for (const auto &event : events) {
+    if (std::find(std::begin(stage_categories), std::end(stage_categories),
+                  event.category) != std::end(stage_categories)) {
+      stages.push_back(&event);
+      continue;
+    }
+    auto &total = totals[event.category];
+    if (total.first == 0)
+      categories.push_back(event.category);
+    total.first++;
+    total.second += event.duration_us;
+  }
+  std::sort(stages.begin(), stages.end(),
+            [](const TraceEvent *a, const TraceEvent *b) {
+              return a->start_us < b->start_us;
+            });
+  if (flags & AB_TRACE_EXPORT)
+    log->infof("Build trace saved to {0}", trace_path);
+  if (flags & AB_TRACE_RESOURCES)
+    log->infof("Build resource usage saved to {0}", stats_path);
+  for (const auto *stage : stages) {
+    auto text = fmt::format("  {0:<28} {1:>9.2f}s", stage->name,
+                            stage->duration_us / 1e6);
+    if (stage->incomplete)
+      text += " (interrupted)";
+    if (!stage->has_usage) {
+      log->info(text);
+      continue;
+    }
+    text += format_resource_usage(stage->usage);
+    log->logFields(LogLevel::Info, text, resource_usage_fields(*stage));
+  }
+  for (const auto &category : categories) {
+    const auto &total = totals[category];
+    log->infof("  {0:<28} {1:>9.2f}s in {2} span(s)", category,
+               total.second / 1e6, total.first);
+  }
+}
+
+// Stops the capture of the build output (ABCAPTURELOG=1), if any. On failure,
+// the first errors found in the output are shown again, with some context.
+static void finish_build_log(const bool failed) {
+  BuildLogSummary summary{};
+  if (!build_log_stop(summary))
+    return;
+  auto *log = get_logger();
+  log->infof("Build log saved to {0} ({1} error(s), {2} warning(s))",
+             summary.log_path, summary.errors, summary.warnings);
+  if (!failed || summary.excerpt.empty())
+    return;
+  log->errorf("Errors found in the build output (index: {0}):",
+              summary.index_path);
+  for (const auto &line : summary.excerpt) {
+    std::cerr << "  " << line << std::endl;
+  }
+}
+
+/**
+ * Lowers ABTHREADS to the number of jobs which should fit in the available
+ * memory, according to the earlier builds of $PKGNAME in the build statistics
+ * store (ABSTATS=1).
+ */
+static int abstats_limit_threads(WORD_LIST *list) {
+  const auto name = shell_variable_value("PKGNAME");
+  const int threads = std::atoi(shell_variable_value("ABTHREADS").c_str());
+  if (name.empty() || threads <= 1)
+    return 0;
+  const auto history = buildstats_load(buildstats_store(), name);
+  if (!history.builds)
+    return 0;
+  const int64_t available_kb = buildstats_available_memory_kb();
+  const int jobs = buildstats_suggest_jobs(history, threads, available_kb);
+  if (jobs >= threads)
+    return 0;
+  get_logger()->warningf(
+      "Earlier builds of {0} needed up to {1} MiB per job, lowering ABTHREADS "
+      "from {2} to {3} for the {4} MiB available",
+      name, history.job_memory_kb / 1024, threads, jobs, available_kb / 1024);
+  const auto jobs_string = std::to_string(jobs);
+  bind_variable("ABTHREADS", const_cast<char *>(jobs_string.c_str()), 0);
+  return 0;
+}
+
+static int abtrace_begin(WORD_LIST *list) {
+  const auto *category = get_argv1(list);
+  if (!category)
+    return EX_BADUSAGE;
+  const auto *name = get_argv1(list->next);
+  if (!name)
+    return EX_BADUSAGE;
+  build_log_mark(fmt::format("{0}/{1}", category, name));
+  trace_begin(category, name);
+  return 0;
+}
+
+static int abtrace_end(WORD_LIST *list) {
+  if (!trace_end()) {
+    get_logger()->warning(
+        "abtrace_end called without a matching abtrace_begin");
+    return 1;
+  }
+  return 0;
+}
+
+#ifdef AB_INSTRUMENT
+/**
+ * Prints the counters of the native instrumentation as JSON.
+ * Usage: abinstrument_dump [-r] [file]
+ *   -r: reset the counters afterwards
+ */
+static int abinstrument_dump(WORD_LIST *list) {
+  bool reset = false;
+  reset_internal_getopt();
+  int opt = 0;
+  while ((opt = internal_getopt(list, const_cast<char *>("r"))) != -1) {
+    switch (opt) {
+    case 'r':
+      reset = true;
+      break;
+    default:
+      return EX_BADUSAGE;
+    }
+  }
+  const auto *path = get_argv1(loptend);
+  const auto dump = instrument_dump();
+  if (path) {
+    std::ofstream file(path, std::ios::trunc);
+    file << dump << '\n';
+    file.close();
+    if (file.fail()) {
+      get_logger()->errorf("Unable to write to {0}: {1}", path,
+                           strerror(errno));
+      return 1;
+    }
+  } else {
+    std::cout << dump << std::endl;
+  }
+  if (reset)
+    instrument_reset();
+  return 0;
+}
+#endif
+
 static int abdie(WORD_LIST *list) {
   const auto message = get_argv1(list);
   const auto exit_value = list ? get_argv1(list->next) : nullptr;
@@ -373,8 +710,10 @@ static int abdie(WORD_LIST *list) {
                                     srcdir_v->value, strerror(errno)));
     }
   }
+  trace_finish_build(true);
   log->logDiagnostic(diag);
   log->logException(message ? message : std::string());
+  finish_build_log(true);
 
   // reset the traps to avoid double-triggering
   autobuild_switch_strict_mode(false);
@@ -382,27 +721,45 @@ static int abdie(WORD_LIST *list) {
   __builtin_unreachable();
 }
 
-static void register_logger_from_env() {
+static BaseLogger *make_logger_from_env() {
   const auto *var = find_variable_tempenv("ABREPORTER");
   const auto *no_color_string = getenv("NO_COLOR");
   const bool no_color = no_color_string && no_color_string[0] == '1';
   if (!var || !var->value) {
-    if (no_color) {
-      logger = reinterpret_cast<Logger *>(new PlainLogger());
-    } else {
-      logger = reinterpret_cast<Logger *>(new ColorfulLogger());
-    }
-    return;
+    if (no_color)
+      return new PlainLogger();
+    return new ColorfulLogger();
   }
   const char *reporter = var->value;
-  if (strncmp(reporter, "color", 5) == 0) {
-    logger = reinterpret_cast<Logger *>(new ColorfulLogger());
-    return;
-  } else if (strncmp(reporter, "json", 4) == 0) {
-    logger = reinterpret_cast<Logger *>(new JsonLogger());
-    return;
-  }
-  logger = reinterpret_cast<Logger *>(new PlainLogger());
+  if (strncmp(reporter, "color", 5) == 0)
+    return new ColorfulLogger();
+  else if (strncmp(reporter, "json", 4) == 0)
+    return new JsonLogger();
+  return new PlainLogger();
+}
+
+static void register_logger_from_env() {
+  const auto *async_string = getenv("ABASYNCLOG");
+  if (async_string && async_string[0] == '1')
+    logger_enable_async();
+  auto *log = make_logger_from_env();
+  // ABLOGLEVEL=debug|info|warn|error, messages below are not even formatted
+  const auto *level_v = find_variable_tempenv("ABLOGLEVEL");
+  if (level_v && level_v->value) {
+    const std::string level = string_to_uppercase(level_v->value);
+    if (level == "DEBUG")
+      log->setLogLevel(LogLevel::Debug);
+    else if (level == "INFO")
+      log->setLogLevel(LogLevel::Info);
+    else if (level == "WARN" || level == "WARNING")
+      log->setLogLevel(LogLevel::Warning);
+    else if (level == "ERROR")
+      log->setLogLevel(LogLevel::Error);
+    else
+      log->warningf("Unknown log level ABLOGLEVEL={0}, ignored",
+                    level_v->value);
+  }
+  logger = reinterpret_cast<Logger *>(log);
 }
 
 static int set_arch_variables(const char *arch = nullptr) {
@@ -411,7 +768,7 @@ static int set_arch_variables(const char *arch = nullptr) {
     return 1;
   }
   // read targets
-  auto map_table = jsondata_get_arch_targets(ab_path);
+  const auto &map_table = jsondata_get_arch_targets(ab_path);
   const auto *arch_target_var =
       make_new_assoc_variable(const_cast<char *>("ARCH_TARGET"));
   auto *arch_target_var_h = assoc_cell(arch_target_var);
@@ -439,7 +796,9 @@ static int set_arch_variables(const char *arch = nullptr) {
   bind_global_variable("ABBUILD", const_cast<char *>(this_arch.c_str()),
                        ASS_NOEVAL);
 
-  const std::string arch_triple = map_table[this_arch];
+  const auto arch_triple_it = map_table.find(this_arch);
+  const std::string arch_triple =
+      arch_triple_it != map_table.end() ? arch_triple_it->second : "";
   // set HOST
   // HOST=${ARCH_TARGET["$ABHOST"]}
   bind_global_variable("HOST", const_cast<char *>(arch_triple.c_str()),
@@ -461,44 +820,70 @@ static int set_arch_variables(const char *arch = nullptr) {
   return 0;
 }
 
-static inline int arch_loadvar_inner(const std::string &var_name) {
-  std::vector<std::string> aliases{};
+static inline bool arch_get_aliases(std::vector<std::string> &aliases) {
   aliases.reserve(4);
   const auto arch_v = find_variable("ARCH");
   // ARCH can't be an array
   if (!arch_v || arch_v->attributes & att_array)
-    return 1;
+    return false;
   const auto ag_v = find_variable("ABHOST_GROUP");
   // ABHOST_GROUP needs to be an array
   if (!ag_v || !(ag_v->attributes & att_array))
-    return 1;
+    return false;
   aliases.emplace_back(string_to_uppercase(arch_v->value));
   const auto ag_a = array_cell(ag_v);
   for (const ARRAY_ELEMENT *ae = element_forw(ag_a->head); ae != ag_a->head;
        ae = element_forw(ae)) {
     aliases.emplace_back(string_to_uppercase(ae->value));
   }
+  return true;
+}
+
+static void arch_report_conflict(const std::string &var_name,
+                                 const std::string &assigned_alias,
+                                 const std::string &conflicting_alias) {
+  const auto logger = get_logger();
+  logger->errorf(
+      "Refusing to assign {0} to group-specific variable {0}__{1}\n"
+      "... because it is already assigned to {0}__{2}",
+      var_name, conflicting_alias, assigned_alias);
+  logger->infof("Current ABHOST {0} belongs to the following groups:",
+                ab_get_current_architecture());
+  logger->infof(
+      "Add the more specific {0}__{1} instead to suppress the conflict.",
+      var_name, string_to_uppercase(ab_get_current_architecture()));
+  logger->logException(
+      "Ambiguous architecture group variable detected! Refuse to proceed.");
+}
+
+static inline int arch_loadvar_inner(const std::string &var_name) {
+  std::vector<std::string> aliases{};
+  if (!arch_get_aliases(aliases))
+    return 1;
 
   const int result = autobuild_get_variable_with_suffix(var_name, aliases);
   if (result != 0) {
-    const auto logger = get_logger();
-    logger->error(fmt::format(
-        "Refusing to assign {0} to group-specific variable {0}__{1}\n"
-        "... because it is already assigned to {0}__{2}",
-        var_name, aliases[2], aliases[1]));
-    logger->info(
-        fmt::format("Current ABHOST {0} belongs to the following groups:",
-                    ab_get_current_architecture()));
-    logger->info(fmt::format(
-        "Add the more specific {0}__{1} instead to suppress the conflict.",
-        var_name, string_to_uppercase(ab_get_current_architecture())));
-    logger->logException(
-        "Ambiguous architecture group variable detected! Refuse to proceed.");
+    arch_report_conflict(var_name, aliases[1], aliases[2]);
     return 1;
   }
   return 0;
 }
 
+static inline int
+arch_loadvars_inner(const std::vector<std::string> &var_names) {
+  std::vector<std::string> aliases{};
+  if (!arch_get_aliases(aliases))
+    return 1;
+
+  const auto conflicts =
+      autobuild_get_variables_with_suffix(var_names, aliases);
+  for (const auto &conflict : conflicts) {
+    arch_report_conflict(conflict.name, conflict.assigned_alias,
+                         conflict.conflicting_alias);
+  }
+  return conflicts.empty() ? 0 : 1;
+}
+
 static int arch_loadvar(WORD_LIST *list) {
   const auto name = get_argv1(list);
   if (!name)
@@ -531,20 +916,20 @@ static int arch_loaddefines(WORD_LIST *list) {
   if (ab_path.empty()) {
     return 1;
   }
-  const std::vector<std::string> exported_vars =
+  const std::vector<std::string> &exported_vars =
       jsondata_get_exported_vars(ab_path);
 
   // load the defines file
   const auto defines_path = arch_findfile_inner(argv1, stage2_aware);
   if (defines_path.empty())
     return 127;
+  // VAR may still be aliased to VAR__ARCH by the previous call
+  autobuild_detach_array_aliases();
   const int result = autobuild_load_file(defines_path.c_str(), false);
   if (result != 0)
     return result;
   // load the actual variables from the current context
-  for (const auto &var : exported_vars) {
-    arch_loadvar_inner(var);
-  }
+  arch_loadvars_inner(exported_vars);
   return 0;
 }
 
@@ -657,12 +1042,16 @@ static int arch_findfile(WORD_LIST *list) {
   // parse args
   int opt = 0;
   bool stage2_aware = false;
+  const char *out_varname = nullptr;
   reset_internal_getopt();
-  while ((opt = internal_getopt(list, const_cast<char *>("2"))) != -1) {
+  while ((opt = internal_getopt(list, const_cast<char *>("2v:"))) != -1) {
     switch (opt) {
     case '2':
       stage2_aware = true;
       break;
+    case 'v':
+      out_varname = list_optarg;
+      break;
     default:
       return 1;
     }
@@ -670,7 +1059,9 @@ static int arch_findfile(WORD_LIST *list) {
   const auto *argv1 = get_argv1(loptend);
   if (!argv1)
     return EX_BADUSAGE;
-  const auto *out_varname = get_argv1(loptend->next);
+  // the output variable can also be given as the second argument
+  if (!out_varname)
+    out_varname = get_argv1(loptend->next);
   const auto filepath = arch_findfile_inner(argv1, stage2_aware);
   if (filepath.empty())
     return 127;
@@ -761,9 +1152,14 @@ static int abpm_dump_builddep_req(WORD_LIST *list) {
 }
 
 static int abpm_genver(WORD_LIST *list) {
+  const char *out_varname = nullptr;
+  if (get_output_varname(list, out_varname))
+    return EX_BADUSAGE;
   const auto argv1 = get_argv1(list);
   if (!argv1)
     return EX_BADUSAGE;
+  if (out_varname)
+    return bind_output_variable(out_varname, autobuild_to_deb_version(argv1));
   std::cout << autobuild_to_deb_version(argv1);
   return 0;
 }
@@ -886,8 +1282,59 @@ static int abelf_copy_dbg_parallel(WORD_LIST *list) {
   args.pop_back();
   std::unordered_set<std::string> so_deps{};
   std::unordered_set<std::string> sonames;
-  const int ret = elf_copy_debug_symbols_parallel(args, dst.c_str(), so_deps,
-                                                  sonames, flags);
+  // the slowest files of the previous build first (ABSTATS=1)
+  std::unique_ptr<ELFCostHint> hint{};
+  if (trace_flags() & AB_TRACE_RESOURCES) {
+    const auto history =
+        buildstats_load(buildstats_store(), shell_variable_value("PKGNAME"));
+    if (!history.elf_cost_us.empty()) {
+      std::string pkgdir = shell_variable_value("PKGDIR");
+      while (!pkgdir.empty() && pkgdir.back() == '/')
+        pkgdir.pop_back();
+      hint = std::make_unique<ELFCostHint>();
+      hint->us_per_byte = history.elf_us_per_byte;
+      for (const auto &cost : history.elf_cost_us) {
+        hint->cost_us.emplace(pkgdir + "/" + cost.first, cost.second);
+      }
+    }
+  }
+  // the candidates are taken from the PKGDIR manifest (abmanifest_build) if
+  // it covers the directories, instead of walking them
+  auto *manifest = manifest_current();
+  ManifestQuery query{};
+  if (manifest) {
+    manifest->refresh();
+    for (const auto &directory : args) {
+      std::string relative{};
+      if (!manifest->relative_path(directory, relative)) {
+        manifest = nullptr;
+        break;
+      }
+      query.directories.emplace_back(std::move(relative));
+    }
+  }
+  int ret = 0;
+  if (manifest) {
+    query.types = static_cast<unsigned int>(ManifestType::File);
+    query.relative = true;
+    manifest_parse_class("elf", query.classes);
+    manifest_parse_class("archive", query.classes);
+    manifest_parse_class("bitcode", query.classes);
+    std::vector<std::pair<std::string, uint64_t>> files{};
+    for (const auto &relative : manifest_query(*manifest, query)) {
+      files.emplace_back(manifest->root() + "/" + relative,
+                         manifest->entries().at(relative).size);
+    }
+    ret = elf_copy_debug_symbols_files(files, dst.c_str(), so_deps, sonames,
+                                       flags, hint.get());
+    // stripped in place
+    for (const auto &file : files) {
+      manifest->update(file.first);
+    }
+  } else {
+    ret = elf_copy_debug_symbols_parallel(args, dst.c_str(), so_deps, sonames,
+                                          flags, hint.get());
+  }
   if (ret < 0)
     return 10;
   // copy the data to the bash variable
@@ -1199,6 +1646,9 @@ static int abmm_array_mine_remove(WORD_LIST *list) {
 }
 
 static int ab_join_elements(WORD_LIST *list) {
+  const char *out_varname = nullptr;
+  if (get_output_varname(list, out_varname))
+    return EX_BADUSAGE;
   const auto *array_name = get_argv1(list);
   if (!array_name)
     return EX_BADUSAGE;
@@ -1211,14 +1661,16 @@ static int ab_join_elements(WORD_LIST *list) {
     return EX_BADUSAGE;
   }
   const auto *array = array_cell(array_var);
+  std::string result{};
   for (const ARRAY_ELEMENT *ae = element_forw(array->head); ae != array->head;
        ae = element_forw(ae)) {
-    if (array->head == element_forw(ae)) {
-      printf("%s", ae->value);
-      continue;
-    }
-    printf("%s%s", ae->value, sep_);
+    result += ae->value;
+    if (array->head != element_forw(ae))
+      result += sep_;
   }
+  if (out_varname)
+    return bind_output_variable(out_varname, result);
+  printf("%s", result.c_str());
   return 0;
 }
 
@@ -1278,8 +1730,7 @@ static int ab_parse_set_modifiers(WORD_LIST *list) {
   auto *hash = assoc_cell(hash_var);
   for (const auto &modifier : modifiers) {
     const std::string name = string_to_uppercase(modifier.name);
-    logger->info(
-        fmt::format("Setting modifier {0} to {1}", name, modifier.enabled));
+    logger->infof("Setting modifier {0} to {1}", name, modifier.enabled);
     if (name == "STAGE2" && modifier.enabled) {
       // compatibility with old versions of autobuild
       setenv("ABSTAGE2", "1", 1);
@@ -1305,6 +1756,9 @@ static int ab_dump_variables(const std::vector<std::string> &names,
 }
 
 static int ab_get_item_by_key(WORD_LIST *list) {
+  const char *out_varname = nullptr;
+  if (get_output_varname(list, out_varname))
+    return EX_BADUSAGE;
   const auto *array_name = get_argv1(list);
   if (!array_name)
     return EX_BADUSAGE;
@@ -1322,29 +1776,21 @@ static int ab_get_item_by_key(WORD_LIST *list) {
   auto *elem = hash_search(key, array, 0);
   if (!elem) {
     if (default_value) {
+      if (out_varname)
+        return bind_output_variable(out_varname, default_value);
       std::cout << default_value << std::endl;
       return 0;
     } else {
       return EX_BADASSIGN;
     }
   }
+  if (out_varname)
+    return bind_output_variable(out_varname, static_cast<char *>(elem->data));
   std::cout << static_cast<char *>(elem->data) << std::endl;
   return 0;
 }
 
-static int abjson_get_item(WORD_LIST *list) {
-  const auto *json_data = get_argv1(list);
-  if (!json_data)
-    return EX_BADUSAGE;
-  list = list->next;
-  const auto *key = get_argv1(list);
-  if (!key)
-    return EX_BADUSAGE;
-  list = list->next;
-  const auto *var = get_argv1(list);
-  if (!var)
-    return EX_BADUSAGE;
-  const int ret = autobuild_deserialize_variable(json_data, key, var, false);
+static void abjson_report_error(const int ret) {
   const auto logger = get_logger();
   switch (ret) {
   case 1:
@@ -1359,10 +1805,92 @@ static int abjson_get_item(WORD_LIST *list) {
   case 4:
     logger->error("Unable to represent the JSON value in Bash.");
     break;
+  case 5:
+    logger->error("Unknown JSON document handle.");
+    break;
+  }
+}
+
+static int abjson_get_item(WORD_LIST *list) {
+  const auto *json_data = get_argv1(list);
+  if (!json_data)
+    return EX_BADUSAGE;
+  list = list->next;
+  const auto *key = get_argv1(list);
+  if (!key)
+    return EX_BADUSAGE;
+  list = list->next;
+  const auto *var = get_argv1(list);
+  if (!var)
+    return EX_BADUSAGE;
+  const int ret = autobuild_deserialize_variable(json_data, key, var, false);
+  abjson_report_error(ret);
+  return ret;
+}
+
+// abjson_load [-f] <handle> <json data | file>
+static int abjson_load(WORD_LIST *list) {
+  int opt = 0;
+  bool from_file = false;
+  reset_internal_getopt();
+  while ((opt = internal_getopt(list, const_cast<char *>("f"))) != -1) {
+    switch (opt) {
+    case 'f':
+      from_file = true;
+      break;
+    default:
+      return EX_BADUSAGE;
+    }
+  }
+  list = loptend;
+  const auto *handle = get_argv1(list);
+  if (!handle)
+    return EX_BADUSAGE;
+  const auto *input = get_argv1(list->next);
+  if (!input)
+    return EX_BADUSAGE;
+  std::string content{};
+  if (from_file) {
+    std::ifstream file(input);
+    if (!file.is_open()) {
+      get_logger()->errorf("Unable to open {0}.", input);
+      return 1;
+    }
+    content.assign(std::istreambuf_iterator<char>(file),
+                   std::istreambuf_iterator<char>());
+  } else {
+    content = input;
   }
+  const int ret = autobuild_json_load(handle, content);
+  abjson_report_error(ret);
+  return ret;
+}
+
+// abjson_query <handle> <query> <var>
+static int abjson_query(WORD_LIST *list) {
+  const auto *handle = get_argv1(list);
+  if (!handle)
+    return EX_BADUSAGE;
+  list = list->next;
+  const auto *key = get_argv1(list);
+  if (!key)
+    return EX_BADUSAGE;
+  list = list->next;
+  const auto *var = get_argv1(list);
+  if (!var)
+    return EX_BADUSAGE;
+  const int ret = autobuild_json_query(handle, key, var, false);
+  abjson_report_error(ret);
   return ret;
 }
 
+static int abjson_free(WORD_LIST *list) {
+  const auto *handle = get_argv1(list);
+  if (!handle)
+    return EX_BADUSAGE;
+  return autobuild_json_free(handle) ? 0 : 1;
+}
+
 static int abspiral_from_sonames(WORD_LIST *list) {
   constexpr const char *varname_spiral_provides_sonames =
       "__ABSPIRAL_PROVIDES_SONAMES";
@@ -1378,11 +1906,429 @@ static int abspiral_from_sonames(WORD_LIST *list) {
   return 0;
 }
 
+static int abspiral_from_pkgdir(WORD_LIST *list) {
+  constexpr const char *varname_spiral_provides = "__ABSPIRAL_PROVIDES";
+  const auto *pkgdir = get_argv1(list);
+  if (!pkgdir)
+    return EX_BADUSAGE;
+  list = list->next;
+  const auto *py2ver = get_argv1(list);
+  if (!py2ver)
+    return EX_BADUSAGE;
+  list = list->next;
+  const auto *py3ver = get_argv1(list);
+  if (!py3ver)
+    return EX_BADUSAGE;
+  std::vector<std::string> spiral_provides{};
+  const int ret = spiral_from_pkgdir(pkgdir, py2ver, py3ver, spiral_provides);
+  if (ret != 0)
+    return ret;
+  // append to the existing provides from the soname lookup
+  auto *var = find_variable(varname_spiral_provides);
+  if (!var || !(var->attributes & att_array))
+    var = make_new_array_variable(const_cast<char *>(varname_spiral_provides));
+  auto *var_a = array_cell(var);
+  for (const auto &provide : spiral_provides) {
+    array_insert(var_a, var_a->max_index + 1,
+                 const_cast<char *>(provide.c_str()));
+  }
+  return 0;
+}
+
+// The manifest of PKGDIR, refreshed, or built on demand when the stages
+// querying it are run on their own.
+static PkgdirManifest *pkgdir_manifest() {
+  auto pkgdir = shell_variable_value("PKGDIR");
+  while (pkgdir.size() > 1 && pkgdir.back() == '/')
+    pkgdir.pop_back();
+  auto *manifest = manifest_current();
+  if (manifest && (pkgdir.empty() || manifest->root() == pkgdir)) {
+    manifest->refresh();
+    return manifest;
+  }
+  if (pkgdir.empty()) {
+    get_logger()->error("No PKGDIR manifest has been built.");
+    return nullptr;
+  }
+  manifest = manifest_load(pkgdir);
+  if (!manifest)
+    get_logger()->errorf("Unable to scan {0}: {1}", pkgdir, strerror(errno));
+  return manifest;
+}
+
+static bool parse_manifest_number(const char *arg, char &op, uint64_t &value,
+                                  const bool with_units) {
+  op = '=';
+  if (*arg == '+' || *arg == '-')
+    op = *arg++;
+  if (!isdigit(*arg))
+    return false;
+  char *end = nullptr;
+  errno = 0;
+  value = strtoull(arg, &end, 10);
+  if (errno)
+    return false;
+  if (with_units && *end) {
+    switch (*end++) {
+    case 'k':
+      value <<= 10;
+      break;
+    case 'M':
+      value <<= 20;
+      break;
+    case 'G':
+      value <<= 30;
+      break;
+    default:
+      return false;
+    }
+  }
+  return *end == '\0';
+}
+
+static bool parse_manifest_mode(const char *arg, ManifestQuery &query) {
+  query.mode_op = '=';
+  if (*arg == '/' || *arg == '-')
+    query.mode_op = *arg++;
+  if (*arg < '0' || *arg > '7')
+    return false;
+  char *end = nullptr;
+  const auto mode = strtoul(arg, &end, 8);
+  if (*end || mode > 07777)
+    return false;
+  query.mode = mode;
+  return true;
+}
+
+/**
+ * Records the entries of a directory tree (PKGDIR by default) with a single
+ * walk, for abmanifest_query.
+ * @param list [directory]
+ */
+static int abmanifest_build(WORD_LIST *list) {
+  const auto *argv1 = get_argv1(list);
+  const std::string root = argv1 ? argv1 : shell_variable_value("PKGDIR");
+  if (root.empty())
+    return EX_BADUSAGE;
+  const auto *manifest = manifest_load(root);
+  if (!manifest) {
+    get_logger()->errorf("Unable to scan {0}: {1}", root, strerror(errno));
+    return 1;
+  }
+  get_logger()->debugf("Recorded {0} entries of {1}.",
+                       manifest->entries().size(), manifest->root());
+  return 0;
+}
+
+/**
+ * Rescans the given paths (for the files modified in place), or the
+ * directories modified since the last scan without arguments.
+ * @param list [paths...]
+ */
+static int abmanifest_update(WORD_LIST *list) {
+  auto *manifest = manifest_current();
+  if (!manifest)
+    return 0;
+  if (!list) {
+    manifest->refresh();
+    return 0;
+  }
+  int ret = 0;
+  for (const auto &path : get_all_args_vector(list)) {
+    if (!manifest->update(path)) {
+      get_logger()->errorf("{0} is outside of {1}.", path, manifest->root());
+      ret = 1;
+    }
+  }
+  return ret;
+}
+
+/**
+ * Lists the entries of PKGDIR matching all of the predicates, in
+ * lexicographical order. A repeated predicate matches any of its values.
+ * @param list [-v array] [-r] [-t fdlo] [-n|-N name-glob] [-p path-glob]
+ *             [-c|-C class] [-s [+-]size[kMG]] [-l [+-]links]
+ *             [-m|-M [/-]mode] [directories...]
+ *   -v: saves the paths to the array instead of printing them
+ *   -r: paths relative to PKGDIR
+ *   -t: types, regular files, directories, symlinks or others
+ *   -n, -N: file names matching (not matching) the glob
+ *   -p: relative path matching the glob (`*' does not match `/')
+ *   -c, -C: class (not) read from the magic number, see abmanifest.cpp,
+ *           elf matches all ELF files
+ *   -s: size in bytes, exactly, more than (+) or less than (-)
+ *   -l: link count, exactly, more than (+) or less than (-)
+ *   -m, -M: permissions (not) set exactly, with all (-) or any (/) of the bits
+ * Returns 1 if any of the directories is not in PKGDIR, after listing the
+ * others.
+ */
+static int abmanifest_query(WORD_LIST *list) {
+  const char *out_varname = nullptr;
+  ManifestQuery query{};
+  int opt = 0;
+  reset_internal_getopt();
+  while ((opt = internal_getopt(
+              list, const_cast<char *>("v:rt:n:N:p:c:C:s:l:m:M:"))) != -1) {
+    switch (opt) {
+    case 'v':
+      out_varname = list_optarg;
+      if (!legal_identifier(out_varname))
+        return EX_BADUSAGE;
+      break;
+    case 'r':
+      query.relative = true;
+      break;
+    case 't':
+      for (const char *type = list_optarg; *type; type++) {
+        switch (*type) {
+        case 'f':
+          query.types |= static_cast<unsigned int>(ManifestType::File);
+          break;
+        case 'd':
+          query.types |= static_cast<unsigned int>(ManifestType::Directory);
+          break;
+        case 'l':
+          query.types |= static_cast<unsigned int>(ManifestType::Symlink);
+          break;
+        case 'o':
+          query.types |= static_cast<unsigned int>(ManifestType::Other);
+          break;
+        case ',':
+          break;
+        default:
+          get_logger()->errorf("Invalid type: {0}", *type);
+          return EX_BADUSAGE;
+        }
+      }
+      break;
+    case 'n':
+      query.names.emplace_back(list_optarg);
+      break;
+    case 'N':
+      query.not_names.emplace_back(list_optarg);
+      break;
+    case 'p':
+      query.paths.emplace_back(list_optarg);
+      break;
+    case 'c':
+    case 'C':
+      if (!manifest_parse_class(list_optarg, opt == 'c' ? query.classes
+                                                         : query.not_classes)) {
+        get_logger()->errorf("Invalid class: {0}", list_optarg);
+        return EX_BADUSAGE;
+      }
+      break;
+    case 's':
+      if (!parse_manifest_number(list_optarg, query.size_op, query.size, true))
+        return EX_BADUSAGE;
+      break;
+    case 'l': {
+      uint64_t nlink = 0;
+      if (!parse_manifest_number(list_optarg, query.nlink_op, nlink, false))
+        return EX_BADUSAGE;
+      query.nlink = nlink;
+      break;
+    }
+    case 'm':
+    case 'M':
+      if (!parse_manifest_mode(list_optarg, query))
+        return EX_BADUSAGE;
+      query.mode_negated = opt == 'M';
+      break;
+    default:
+      return EX_BADUSAGE;
+    }
+  }
+  auto *manifest = pkgdir_manifest();
+  if (!manifest)
+    return 1;
+  // like find, the other directories are still listed
+  int ret = 0;
+  for (const auto &directory : get_all_args_vector(loptend)) {
+    std::string relative{};
+    if (!manifest->relative_path(directory, relative)) {
+      get_logger()->errorf("{0} is outside of {1}.", directory,
+                           manifest->root());
+      return 1;
+    }
+    if (!relative.empty() && !manifest->entries().count(relative)) {
+      get_logger()->errorf("{0}: No such file or directory", directory);
+      ret = 1;
+      continue;
+    }
+    query.directories.emplace_back(std::move(relative));
+  }
+  // all of them missing: nothing to list, not the whole tree
+  const auto paths = ret && query.directories.empty()
+                         ? std::vector<std::string>{}
+                         : manifest_query(*manifest, query);
+  if (out_varname) {
+    const int bind_ret = bind_output_array(out_varname, paths);
+    return bind_ret ? bind_ret : ret;
+  }
+  for (const auto &path : paths) {
+    std::cout << path << '\n';
+  }
+  std::cout.flush();
+  return ret;
+}
+
+/**
+ * Prints the disk usage of PKGDIR in KiB, like du -s.
+ * @param list [-v var]
+ */
+static int abmanifest_du(WORD_LIST *list) {
+  const char *out_varname = nullptr;
+  if (get_output_varname(list, out_varname))
+    return EX_BADUSAGE;
+  const auto *manifest = pkgdir_manifest();
+  if (!manifest)
+    return 1;
+  const auto usage = std::to_string(manifest->disk_usage());
+  if (out_varname)
+    return bind_output_variable(out_varname, usage);
+  std::cout << usage << std::endl;
+  return 0;
+}
+
+static int abmanifest_free(WORD_LIST *list) {
+  manifest_free();
+  return 0;
+}
+
+// build templates indexed by ab_index_templates, in registration order
+static std::vector<TemplateInfo> template_index{};
+// listing of SRCDIR shared by the template probes
+static std::unique_ptr<SourceListing> template_listing{};
+
+static TemplateInfo *template_index_find(const std::string &name) {
+  for (auto &info : template_index) {
+    if (info.has_probe && info.name == name)
+      return &info;
+  }
+  return nullptr;
+}
+
+static int ab_index_templates(WORD_LIST *list) {
+  constexpr const char *varname_templates = "AB_TEMPLATES";
+  const auto *dir = get_argv1(list);
+  if (!dir)
+    return EX_BADUSAGE;
+  auto index = template_index_directory(dir);
+  for (auto &info : index) {
+    if (!info.has_probe) {
+      // no declared probes, load the template now and let it register itself
+      const int ret = autobuild_load_file(info.path.c_str(), false);
+      if (ret != 0)
+        return ret;
+      info.loaded = true;
+      continue;
+    }
+    // the template is loaded on demand by ab_load_template
+    auto *var = find_variable(varname_templates);
+    if (!var || !(var->attributes & att_array))
+      var = make_new_array_variable(const_cast<char *>(varname_templates));
+    auto *var_a = array_cell(var);
+    array_insert(var_a, var_a->max_index + 1,
+                 const_cast<char *>(info.name.c_str()));
+    get_logger()->debugf("Indexed build template: {0}", info.name);
+  }
+  template_index.insert(template_index.end(),
+                        std::make_move_iterator(index.begin()),
+                        std::make_move_iterator(index.end()));
+  return 0;
+}
+
+static int ab_probe_template(WORD_LIST *list) {
+  const auto *name = get_argv1(list);
+  if (!name)
+    return EX_BADUSAGE;
+  const auto *info = template_index_find(name);
+  if (!info)
+    return 2;
+  const auto *srcdir_v = find_variable("SRCDIR");
+  const std::string srcdir{(srcdir_v && srcdir_v->value) ? srcdir_v->value
+                                                         : "."};
+  if (!template_listing || template_listing->srcdir() != srcdir ||
+      !template_listing->is_valid()) {
+    template_listing = std::make_unique<SourceListing>(srcdir);
+  }
+  const auto find_arch_file = [](const std::string &path) {
+    return !arch_findfile_inner(path, true).empty();
+  };
+  return template_probe_match(*info, *template_listing, find_arch_file) ? 0
+                                                                        : 1;
+}
+
+/**
+ * Lists the executables required by an indexed template (##@requires), with
+ * the $VAR words expanded.
+ * @param list [-v array] <template>
+ */
+static int ab_template_requires(WORD_LIST *list) {
+  const char *out_varname = nullptr;
+  if (get_output_varname(list, out_varname))
+    return EX_BADUSAGE;
+  const auto *name = get_argv1(list);
+  if (!name)
+    return EX_BADUSAGE;
+  const auto *info = template_index_find(name);
+  if (!info)
+    return 1;
+  std::vector<std::string> exes{};
+  for (const auto &exe : info->required_exes) {
+    if (exe.size() > 1 && exe[0] == '$') {
+      exes.emplace_back(shell_variable_value(exe.c_str() + 1));
+      continue;
+    }
+    exes.emplace_back(exe);
+  }
+  if (out_varname)
+    return bind_output_array(out_varname, exes);
+  for (const auto &exe : exes) {
+    std::cout << exe << '\n';
+  }
+  std::cout.flush();
+  return 0;
+}
+
+static int ab_load_template(WORD_LIST *list) {
+  const auto *name = get_argv1(list);
+  if (!name)
+    return EX_BADUSAGE;
+  auto *info = template_index_find(name);
+  if (!info) {
+    // templates without declared probes are loaded by ab_index_templates
+    const auto configure_func = fmt::format("build_{0}_configure", name);
+    if (find_function(configure_func.c_str()))
+      return 0;
+    get_logger()->errorf("Build template {0} not found.", name);
+    return 1;
+  }
+  if (info->loaded)
+    return 0;
+  int ret = autobuild_load_file(info->path.c_str(), true);
+  if (ret == 0)
+    ret = autobuild_load_file(info->path.c_str(), false);
+  if (ret != 0) {
+    get_logger()->errorf("Unable to load build template {0}.", name);
+    return ret;
+  }
+  info->loaded = true;
+  return 0;
+}
+
 static int abpm_deb_arch_name(WORD_LIST *list) {
+  const char *out_varname = nullptr;
+  if (get_output_varname(list, out_varname))
+    return EX_BADUSAGE;
   const auto *arch = get_argv1(list);
   if (!arch)
     return EX_BADUSAGE;
-  for (const auto &name: aosc_arch_to_debian_arch_suffix(arch)) {
+  const auto names = aosc_arch_to_debian_arch_suffix(arch);
+  if (out_varname)
+    return bind_output_array(out_varname, {names.begin(), names.end()});
+  for (const auto &name: names) {
     std::cout << name << ' ';
   }
   std::cout << std::endl;
@@ -1405,6 +2351,12 @@ void register_all_native_functions() {
       {"aberr", aberr},
       {"abdbg", abdbg},
       {"abdie", abdie},
+      {"abstats_limit_threads", abstats_limit_threads},
+      {"abtrace_begin", abtrace_begin},
+      {"abtrace_end", abtrace_end},
+#ifdef AB_INSTRUMENT
+      {"abinstrument_dump", abinstrument_dump},
+#endif
       // previously in arch.sh
       {"arch_loadvar", arch_loadvar},
       {"arch_loaddefines", arch_loaddefines},
@@ -1438,7 +2390,20 @@ void register_all_native_functions() {
       {"abmm_array_mine_remove", abmm_array_mine_remove},
       {"ab_get_item_by_key", ab_get_item_by_key},
       {"abjson_get_item", abjson_get_item},
-      {"abspiral_from_sonames", abspiral_from_sonames}};
+      {"abjson_load", abjson_load},
+      {"abjson_query", abjson_query},
+      {"abjson_free", abjson_free},
+      {"abspiral_from_sonames", abspiral_from_sonames},
+      {"abspiral_from_pkgdir", abspiral_from_pkgdir},
+      {"abmanifest_build", abmanifest_build},
+      {"abmanifest_update", abmanifest_update},
+      {"abmanifest_query", abmanifest_query},
+      {"abmanifest_du", abmanifest_du},
+      {"abmanifest_free", abmanifest_free},
+      {"ab_index_templates", ab_index_templates},
+      {"ab_probe_template", ab_probe_template},
+      {"ab_template_requires", ab_template_requires},
+      {"ab_load_template", ab_load_template}};
 
   // Initialize logger
   if (!logger)
@@ -1452,42 +2417,304 @@ static int load_config_file() {
 }
 
 int register_builtin_variables() {
+  // deferred to the first autobuild call when loaded for the native tools
+  static bool registered = false;
+  if (registered)
+    return 0;
   int ret = 0;
   // Initialize logger
   if (!logger)
     register_logger_from_env();
   if ((ret = setup_default_env_variables())) {
-    get_logger()->error(
-        fmt::format("Failed to setup default env variables: {0}", ret));
+    get_logger()->errorf("Failed to setup default env variables: {0}", ret);
     return ret;
   }
   (void)load_config_file();
   if ((ret = set_arch_variables())) {
-    get_logger()->error(fmt::format(
-        "Failed to setup default architecture variables: {0}", ret));
+    get_logger()->errorf("Failed to setup default architecture variables: {0}",
+                         ret);
     return ret;
   }
+  // pre-validated scripts for autobuild_load_file(), if installed
+  script_bundle_load(get_self_path());
+  registered = true;
   return 0;
 }
 
 int start_proc_00() {
   autobuild_switch_strict_mode(true);
+  int trace_options = 0;
+  const auto *trace_v = find_variable("ABTRACE");
+  if (trace_v && trace_v->value && autobuild_bool(trace_v->value) == 1)
+    trace_options |= AB_TRACE_EXPORT;
+  const auto *stats_v = find_variable("ABSTATS");
+  if (stats_v && stats_v->value && autobuild_bool(stats_v->value) == 1)
+    trace_options |= AB_TRACE_RESOURCES;
+  trace_start(trace_options);
+  const auto *capture_v = find_variable("ABCAPTURELOG");
+  if (capture_v && capture_v->value && autobuild_bool(capture_v->value) == 1) {
+    const auto log_base = (fs::current_path() / "abbuild.log").string();
+    if (!build_log_start(log_base)) {
+      get_logger()->warningf("Unable to capture the build output: {0}",
+                             strerror(errno));
+    }
+  }
   const std::string self_path = get_self_path() + "/proc";
-  return autobuild_load_all_from_directory(self_path.c_str());
+  const int ret = autobuild_load_all_from_directory(self_path.c_str());
+  trace_finish_build(ret != 0);
+  finish_build_log(ret != 0);
+  return ret;
+}
+
+// Removes the environment the server was started with, so that the builds
+// only see the environment of their clients.
+static void server_clear_environment() {
+  SHELL_VAR **vars = all_exported_variables();
+  if (vars) {
+    for (SHELL_VAR **var = vars; *var; var++) {
+      // $AB locates the scripts of autobuild itself
+      if (readonly_p(*var) || strcmp((*var)->name, "AB") == 0)
+        continue;
+      unbind_variable((*var)->name);
+    }
+    free(vars);
+  }
+  clearenv();
+  array_needs_making = 1;
+}
+
+// Prepares the forked child for the build request, then starts the build as
+// `autobuild' would do.
+static int server_run_request(const BuildRequest &request) {
+  if (chdir(request.cwd.c_str()) != 0) {
+    get_logger()->errorf("Unable to chdir() to {0}: {1}", request.cwd,
+                         strerror(errno));
+    return 1;
+  }
+  set_working_directory(const_cast<char *>(request.cwd.c_str()));
+  server_clear_environment();
+  for (const auto &entry : request.env) {
+    const size_t sep = entry.find('=');
+    const std::string name = entry.substr(0, sep);
+    const char *value = entry.c_str() + sep + 1;
+    if (!legal_identifier(name.c_str()))
+      continue;
+    const auto *existing = find_variable(name.c_str());
+    if (existing && readonly_p(existing))
+      continue;
+    setenv(name.c_str(), value, true);
+    auto *var =
+        bind_global_variable(name.c_str(), const_cast<char *>(value), 0);
+    if (var)
+      VSETATTR(var, att_exported);
+  }
+  array_needs_making = 1;
+  if (!request.arch.empty()) {
+    bind_global_variable("ARCH", const_cast<char *>(request.arch.c_str()),
+                         ASS_NOEVAL);
+  }
+
+  // the reporter may have been changed by the client
+  delete get_logger();
+  logger = nullptr;
+  register_logger_from_env();
+  int ret = 0;
+  if ((ret = setup_default_env_variables())) {
+    get_logger()->errorf("Failed to setup default env variables: {0}", ret);
+    return ret;
+  }
+  if ((ret = set_arch_variables())) {
+    get_logger()->errorf("Failed to setup default architecture variables: {0}",
+                         ret);
+    return ret;
+  }
+  return start_proc_00();
+}
+
+static void server_reply(const int conn, const int32_t status) {
+  // the client may have gone away, nothing to do in that case
+  (void)!send(conn, &status, sizeof(status), MSG_NOSIGNAL);
+  close(conn);
+}
+
+// Only the user running the server may submit builds, which run with its
+// privileges.
+static bool server_accept_peer(const int conn) {
+  ucred cred{};
+  socklen_t cred_len = sizeof(cred);
+  if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) != 0 ||
+      cred.uid != geteuid()) {
+    get_logger()->warningf("Rejected a build request from uid {0}.",
+                           static_cast<int64_t>(cred.uid));
+    return false;
+  }
+  const timeval timeout{build_server_receive_timeout, 0};
+  return setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                    sizeof(timeout)) == 0;
+}
+
+int start_build_server(const char *socket_path) {
+  auto *log = get_logger();
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    log->errorf("Socket path is too long: {0}", socket_path);
+    return EX_BADUSAGE;
+  }
+  strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+  const int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0)
+    return 1;
+  // remove the stale socket from the previous server
+  unlink(socket_path);
+  // the socket is only accessible to the user running the server
+  const mode_t orig_umask = umask(0177);
+  const int bind_ret =
+      bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+  umask(orig_umask);
+  if (bind_ret != 0 || listen(listen_fd, SOMAXCONN) != 0) {
+    log->errorf("Unable to listen on {0}: {1}", socket_path, strerror(errno));
+    close(listen_fd);
+    return 1;
+  }
+
+  // the children are reaped here instead of the job control of bash, and the
+  // server stops on SIGINT and SIGTERM
+  sigset_t server_mask{};
+  sigset_t orig_mask{};
+  sigemptyset(&server_mask);
+  sigaddset(&server_mask, SIGCHLD);
+  sigaddset(&server_mask, SIGINT);
+  sigaddset(&server_mask, SIGTERM);
+  sigprocmask(SIG_BLOCK, &server_mask, &orig_mask);
+  const int signal_fd =
+      signalfd(-1, &server_mask, SFD_CLOEXEC | SFD_NONBLOCK);
+  if (signal_fd < 0) {
+    log->errorf("Unable to create signalfd: {0}", strerror(errno));
+    sigprocmask(SIG_SETMASK, &orig_mask, nullptr);
+    close(listen_fd);
+    unlink(socket_path);
+    return 1;
+  }
+
+  log->infof("Build server listening on {0}", socket_path);
+  // pid of the build -> connection to the client
+  std::unordered_map<pid_t, int> builds{};
+  bool stopping = false;
+  while (!stopping) {
+    pollfd pfds[2]{{listen_fd, POLLIN, 0}, {signal_fd, POLLIN, 0}};
+    if (poll(pfds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (pfds[1].revents & POLLIN) {
+      signalfd_siginfo info{};
+      while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo != SIGCHLD)
+          stopping = true;
+      }
+      int status = 0;
+      pid_t pid = 0;
+      while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        const auto build = builds.find(pid);
+        if (build == builds.end())
+          continue;
+        const int32_t exit_code = WIFEXITED(status)
+                                      ? WEXITSTATUS(status)
+                                      : 128 + WTERMSIG(status);
+        log->infof("Build {0} finished with status {1}", pid, exit_code);
+        server_reply(build->second, exit_code);
+        builds.erase(build);
+      }
+    }
+    if (stopping || !(pfds[0].revents & POLLIN))
+      continue;
+    const int conn = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (conn < 0)
+      continue;
+    if (!server_accept_peer(conn)) {
+      close(conn);
+      continue;
+    }
+    std::string payload{};
+    int fds[3]{-1, -1, -1};
+    BuildRequest request{};
+    if (build_request_receive(conn, payload, fds) != 0 ||
+        !build_request_decode(payload, request) || fds[0] < 0 || fds[1] < 0 ||
+        fds[2] < 0) {
+      log->warning("Rejected a malformed build request.");
+      for (const int fd : fds) {
+        if (fd >= 0)
+          close(fd);
+      }
+      server_reply(conn, EX_BADUSAGE);
+      continue;
+    }
+    fflush(nullptr);
+    std::cout.flush();
+    const pid_t pid = fork();
+    if (pid == 0) {
+      // the build runs in a copy of the initialized shell
+      sigprocmask(SIG_SETMASK, &orig_mask, nullptr);
+      close(listen_fd);
+      close(signal_fd);
+      close(conn);
+      for (const auto &build : builds) {
+        close(build.second);
+      }
+      for (int i = 0; i < 3; i++) {
+        dup2(fds[i], i);
+      }
+      for (const int fd : fds) {
+        if (fd > STDERR_FILENO)
+          close(fd);
+      }
+      // the child must not return into the script which started the server
+      exit_shell(server_run_request(request));
+      __builtin_unreachable();
+    }
+    for (const int fd : fds) {
+      close(fd);
+    }
+    if (pid < 0) {
+      log->errorf("Unable to fork: {0}", strerror(errno));
+      server_reply(conn, 1);
+      continue;
+    }
+    log->infof("Build {0} started in {1}", pid, request.cwd);
+    builds.emplace(pid, conn);
+  }
+  // the running builds are left to finish on their own
+  for (const auto &build : builds) {
+    close(build.second);
+  }
+  sigprocmask(SIG_SETMASK, &orig_mask, nullptr);
+  close(signal_fd);
+  close(listen_fd);
+  unlink(socket_path);
+  log->info("Build server stopped.");
+  return stopping ? 0 : 1;
+}
+
+static int dump_defines_load(const char *script) {
+  const std::string path = get_self_path() + "/proc/" + script;
+  const int ret = autobuild_load_file(path.c_str(), false);
+  if (ret != 0) {
+    get_logger()->errorf("Failed to load {0}: {1}", path, ret);
+  }
+  return ret;
 }
 
 int dump_defines() {
-  const std::vector<std::string> names =
+  const std::vector<std::string> &names =
       jsondata_get_exported_vars(get_self_path());
   constexpr const char *precond_scripts[] = {"00-python-defines.sh",
                                              "01-core-defines.sh"};
   for (const auto &script : precond_scripts) {
-    const std::string path = get_self_path() + "/proc/" + script;
-    const int ret = autobuild_load_file(path.c_str(), false);
-    if (ret != 0) {
-      get_logger()->error(fmt::format("Failed to load {0}: {1}", path, ret));
+    const int ret = dump_defines_load(script);
+    if (ret != 0)
       return ret;
-    }
   }
 
   const auto *write_file_string = getenv("AB_WRITE_METADATA");
@@ -1496,6 +2723,233 @@ int dump_defines() {
   return ab_dump_variables(names, write_file);
 }
 
+// at most this much of the output of a failed package is reported
+constexpr size_t batch_max_log_size = 64 * 1024;
+
+struct BatchWorker {
+  std::string path;
+  pid_t pid;
+  // fds of the result and the captured output, -1 once closed
+  int result_fd;
+  int log_fd;
+  std::string result;
+  std::string log;
+};
+
+// Lists the package directories (containing autobuild/) in the tree, which
+// is laid out as <section>/<package>/autobuild.
+static std::vector<std::string> batch_scan_tree(const std::string &root) {
+  std::vector<std::string> packages{};
+  std::error_code ec{};
+  const auto is_package = [](const fs::path &dir) {
+    std::error_code ec{};
+    return fs::is_directory(dir / "autobuild", ec);
+  };
+  for (const auto &section : fs::directory_iterator(root, ec)) {
+    if (!fs::is_directory(section.path(), ec))
+      continue;
+    if (is_package(section.path())) {
+      packages.emplace_back(section.path().string());
+      continue;
+    }
+    for (const auto &package : fs::directory_iterator(section.path(), ec)) {
+      if (fs::is_directory(package.path(), ec) && is_package(package.path()))
+        packages.emplace_back(package.path().string());
+    }
+  }
+  std::sort(packages.begin(), packages.end());
+  return packages;
+}
+
+static std::vector<std::string> batch_read_list(const char *source) {
+  std::vector<std::string> packages{};
+  std::ifstream file{};
+  const bool from_stdin = strcmp(source, "-") == 0;
+  if (!from_stdin)
+    file.open(source);
+  std::istream &input = from_stdin ? std::cin : file;
+  std::string line{};
+  while (std::getline(input, line)) {
+    if (!line.empty())
+      packages.emplace_back(std::move(line));
+  }
+  return packages;
+}
+
+// Runs in the forked worker: loads the defines of the package and writes the
+// serialized variables to result_fd.
+static void batch_run_worker(const std::string &path, const int result_fd) {
+  int ret = 1;
+  if (chdir(path.c_str()) == 0) {
+    set_working_directory(const_cast<char *>(path.c_str()));
+    bind_global_variable("PWD", const_cast<char *>(path.c_str()), 0);
+    ret = dump_defines_load("01-core-defines.sh");
+  } else {
+    get_logger()->errorf("Unable to chdir() to {0}: {1}", path,
+                         strerror(errno));
+  }
+  if (ret == 0) {
+    const auto result = autobuild_serialized_variables(
+        jsondata_get_exported_vars(get_self_path()));
+    const char *data = result.data();
+    size_t remaining = result.size();
+    while (remaining > 0) {
+      const ssize_t written = write(result_fd, data, remaining);
+      if (written < 0 && errno == EINTR)
+        continue;
+      if (written <= 0) {
+        ret = 1;
+        break;
+      }
+      data += written;
+      remaining -= written;
+    }
+  }
+  fflush(nullptr);
+  std::cout.flush();
+  std::cerr.flush();
+  _exit(ret);
+}
+
+static bool batch_spawn_worker(const std::string &path,
+                               const sigset_t &orig_mask,
+                               std::vector<BatchWorker> &workers) {
+  int result_pipe[2]{-1, -1};
+  int log_pipe[2]{-1, -1};
+  if (pipe2(result_pipe, O_CLOEXEC) != 0)
+    return false;
+  if (pipe2(log_pipe, O_CLOEXEC) != 0) {
+    close(result_pipe[0]);
+    close(result_pipe[1]);
+    return false;
+  }
+  fflush(nullptr);
+  std::cout.flush();
+  const pid_t pid = fork();
+  if (pid == 0) {
+    sigprocmask(SIG_SETMASK, &orig_mask, nullptr);
+    close(result_pipe[0]);
+    close(log_pipe[0]);
+    for (const auto &worker : workers) {
+      close(worker.result_fd);
+      close(worker.log_fd);
+    }
+    // the output of the package scripts must not mix with the results
+    dup2(log_pipe[1], STDOUT_FILENO);
+    dup2(log_pipe[1], STDERR_FILENO);
+    close(log_pipe[1]);
+    batch_run_worker(path, result_pipe[1]);
+  }
+  close(result_pipe[1]);
+  close(log_pipe[1]);
+  if (pid < 0) {
+    close(result_pipe[0]);
+    close(log_pipe[0]);
+    return false;
+  }
+  workers.push_back(
+      BatchWorker{path, pid, result_pipe[0], log_pipe[0], {}, {}});
+  return true;
+}
+
+static void batch_finish_worker(BatchWorker &worker) {
+  int status = 0;
+  while (waitpid(worker.pid, &status, 0) < 0 && errno == EINTR) {
+  }
+  const int exit_code =
+      WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+  if (exit_code != 0)
+    worker.result.clear();
+  std::cout << autobuild_batch_record(worker.path, exit_code, worker.result,
+                                      worker.log)
+            << std::endl;
+}
+
+int dump_defines_batch(const char *source) {
+  std::error_code ec{};
+  const bool is_tree = strcmp(source, "-") != 0 && fs::is_directory(source, ec);
+  auto packages = is_tree ? batch_scan_tree(source) : batch_read_list(source);
+  if (packages.empty()) {
+    get_logger()->errorf("No package found in {0}.", source);
+    return 1;
+  }
+
+  // shared by all the packages, only evaluated once
+  int ret = dump_defines_load("00-python-defines.sh");
+  if (ret != 0)
+    return ret;
+
+  size_t max_workers = std::thread::hardware_concurrency() + 1;
+  const auto *threads_string = getenv("ABTHREADS");
+  if (threads_string && std::atoi(threads_string) > 0)
+    max_workers = std::atoi(threads_string);
+
+  // the workers are reaped here instead of the job control of bash
+  sigset_t chld_mask{};
+  sigset_t orig_mask{};
+  sigemptyset(&chld_mask);
+  sigaddset(&chld_mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &chld_mask, &orig_mask);
+
+  std::vector<BatchWorker> workers{};
+  workers.reserve(max_workers);
+  size_t next = 0;
+  while (next < packages.size() || !workers.empty()) {
+    while (next < packages.size() && workers.size() < max_workers) {
+      if (!batch_spawn_worker(packages[next], orig_mask, workers)) {
+        std::cout << autobuild_batch_record(packages[next], 1, {},
+                                            strerror(errno))
+                  << std::endl;
+      }
+      next++;
+    }
+    if (workers.empty())
+      continue;
+    std::vector<pollfd> pfds{};
+    pfds.reserve(workers.size() * 2);
+    for (const auto &worker : workers) {
+      pfds.push_back({worker.result_fd, POLLIN, 0});
+      pfds.push_back({worker.log_fd, POLLIN, 0});
+    }
+    if (poll(pfds.data(), pfds.size(), -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    char buffer[16384];
+    for (size_t i = 0; i < pfds.size(); i++) {
+      if (!pfds[i].revents)
+        continue;
+      auto &worker = workers[i / 2];
+      int &fd = (i % 2) ? worker.log_fd : worker.result_fd;
+      std::string &output = (i % 2) ? worker.log : worker.result;
+      const ssize_t size = read(fd, buffer, sizeof(buffer));
+      if (size < 0 && errno == EINTR)
+        continue;
+      if (size <= 0) {
+        close(fd);
+        fd = -1;
+        continue;
+      }
+      if (&output == &worker.result ||
+          output.size() < batch_max_log_size)
+        output.append(buffer, size);
+    }
+    // poll() ignores the negative fds, but finished workers are removed
+    // before the next round
+    for (auto it = workers.begin(); it != workers.end();) {
+      if (it->result_fd >= 0 || it->log_fd >= 0) {
+        ++it;
+        continue;
+      }
+      batch_finish_worker(*it);
+      it = workers.erase(it);
+    }
+  }
+  sigprocmask(SIG_SETMASK, &orig_mask, nullptr);
+  return 0;
+}
+
 void disable_logger() {
   delete get_logger();
   logger = reinterpret_cast<Logger *>(new NullLogger());
@@ -1503,6 +2957,7 @@ void disable_logger() {
 
 void autobuild_crash_handler(int sig, siginfo_t *info, void *ucontext) {
   auto *log = reinterpret_cast<BaseLogger *>(logger);
+  logger_enter_crash_mode();
   if (log) {
     Diagnostic diagnostic{};
     diagnostic.code = sig;
@@ -1524,11 +2979,13 @@ void autobuild_crash_handler(int sig, siginfo_t *info, void *ucontext) {
         .line = 0,
     });
     log->logDiagnostic(diagnostic);
-    log->error(fmt::format("Got signal {0} at address {1}", sig, addr));
+    log->errorf("Got signal {0} at address {1}", sig, addr);
     log->logException(fmt::format("autobuild (PID {0}) received signal: {1}",
                                   getpid(), std::string(strsignal(sig))));
   }
-  exit(1);
+  // the exit handlers would wait for the log writer thread and its locks
+  std::cout.flush();
+  _exit(1);
 }
 
 void setup_crash_handler() {
@@ -1541,8 +2998,7 @@ void setup_crash_handler() {
 }
 
 void set_custom_arch(const char *arch) {
-  get_logger()->info(
-      fmt::format("Overriding target architecture to {0}", arch));
+  get_logger()->infof("Overriding target architecture to {0}", arch);
   set_arch_variables(arch);
 }
 } // extern "C"
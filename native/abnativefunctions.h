@@ -6,11 +6,15 @@ extern "C" {
 
 struct Logger;
 extern struct Logger *logger;
+struct word_list;
 
 void register_all_native_functions();
 int register_builtin_variables();
 int start_proc_00();
+int start_build_server(const char *socket_path);
 int dump_defines();
+int dump_defines_batch(const char *source);
+int run_native_tool(const char *name, struct word_list *list);
 void disable_logger();
 void set_custom_arch(const char *arch);
 void setup_crash_handler();
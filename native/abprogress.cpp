@@ -0,0 +1,62 @@
+#include "abprogress.hpp"
+#include "abnativefunctions.h"
+#include "threadpool.hpp"
+
+ProgressReporter::ProgressReporter(std::string task,
+                                   const std::chrono::milliseconds interval)
+    : m_task(std::move(task)), m_interval(interval),
+      m_start(std::chrono::steady_clock::now()) {
+  m_thread = start_background_thread([this] { run(); });
+}
+
+ProgressReporter::~ProgressReporter() { finish(); }
+
+ProgressEvent ProgressReporter::snapshot(const bool done) const {
+  const double elapsed_s = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - m_start)
+                               .count();
+  ProgressEvent event{m_task,
+                      m_discovered.load(std::memory_order_relaxed),
+                      m_processed.load(std::memory_order_relaxed),
+                      m_skipped.load(std::memory_order_relaxed),
+                      m_bytes.load(std::memory_order_relaxed),
+                      m_bytes_total.load(std::memory_order_relaxed),
+                      elapsed_s,
+                      0,
+                      -1,
+                      done};
+  if (elapsed_s > 0)
+    event.throughput = event.bytes / elapsed_s;
+  if (done) {
+    event.eta_s = 0;
+  } else if (m_discovery_done.load(std::memory_order_relaxed) &&
+             event.throughput > 0 && event.bytes_total >= event.bytes) {
+    event.eta_s = static_cast<int64_t>(
+        (event.bytes_total - event.bytes) / event.throughput + 0.5);
+  }
+  return event;
+}
+
+void ProgressReporter::run() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (!m_waker.wait_for(lock, m_interval, [this] { return m_stopping; })) {
+    m_reported = true;
+    const auto event = snapshot(false);
+    lock.unlock();
+    get_logger()->logProgress(event);
+    lock.lock();
+  }
+}
+
+void ProgressReporter::finish() {
+  {
+    std::lock_guard<std::mutex> guard(m_mutex);
+    if (m_stopping)
+      return;
+    m_stopping = true;
+  }
+  m_waker.notify_all();
+  m_thread.join();
+  if (m_reported)
+    get_logger()->logProgress(snapshot(true));
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "logger.hpp"
+
+// Progress of a long native stage (e.g. the ELF worker pool), reported
+// through the logger (BaseLogger::logProgress) by a background thread at most
+// once per interval. The workers only update relaxed atomic counters.
+//
+// Nothing is reported for stages shorter than one interval.
+class ProgressReporter {
+public:
+  explicit ProgressReporter(
+      std::string task,
+      std::chrono::milliseconds interval = std::chrono::milliseconds(1000));
+  ~ProgressReporter();
+  ProgressReporter(const ProgressReporter &) = delete;
+  ProgressReporter &operator=(const ProgressReporter &) = delete;
+
+  inline void discovered(const uint64_t bytes) {
+    m_discovered.fetch_add(1, std::memory_order_relaxed);
+    m_bytes_total.fetch_add(bytes, std::memory_order_relaxed);
+  }
+  // all the files are discovered, the remaining time can be estimated
+  inline void discovery_done() {
+    m_discovery_done.store(true, std::memory_order_relaxed);
+  }
+  inline void processed(const uint64_t bytes) {
+    m_processed.fetch_add(1, std::memory_order_relaxed);
+    m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+  }
+  inline void skipped(const uint64_t bytes) {
+    m_skipped.fetch_add(1, std::memory_order_relaxed);
+    m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+  }
+  // Stops the reporting, with a final event if anything was reported.
+  void finish();
+
+private:
+  ProgressEvent snapshot(bool done) const;
+  void run();
+
+  const std::string m_task;
+  const std::chrono::milliseconds m_interval;
+  const std::chrono::steady_clock::time_point m_start;
+  std::atomic<uint64_t> m_discovered{0};
+  std::atomic<uint64_t> m_processed{0};
+  std::atomic<uint64_t> m_skipped{0};
+  std::atomic<uint64_t> m_bytes{0};
+  std::atomic<uint64_t> m_bytes_total{0};
+  std::atomic<bool> m_discovery_done{false};
+  bool m_reported{false};
+  bool m_stopping{false};
+  std::mutex m_mutex;
+  std::condition_variable m_waker;
+  std::thread m_thread;
+};
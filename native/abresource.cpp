@@ -0,0 +1,279 @@
+#include "abresource.hpp"
+#include "threadpool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static inline int64_t timeval_to_us(const timeval &tv) {
+  return static_cast<int64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+// "/sys/fs/cgroup/<path>" of the cgroup v2 of this process, empty if there is
+// none (e.g. cgroup v1 only)
+static const std::string &cgroup_directory() {
+  static const std::string directory = [] {
+    std::ifstream file("/proc/self/cgroup");
+    std::string line{};
+    while (std::getline(file, line)) {
+      if (line.compare(0, 3, "0::") == 0)
+        return std::string{"/sys/fs/cgroup"} + line.substr(3);
+    }
+    return std::string{};
+  }();
+  return directory;
+}
+
+// sums rbytes= and wbytes= over all the devices in io.stat
+static void read_cgroup_io(const std::string &path, int64_t &read_bytes,
+                           int64_t &write_bytes) {
+  std::ifstream file(path);
+  if (!file.is_open())
+    return;
+  read_bytes = write_bytes = 0;
+  std::string field{};
+  while (file >> field) {
+    long long value = 0;
+    if (sscanf(field.c_str(), "rbytes=%lld", &value) == 1)
+      read_bytes += value;
+    else if (sscanf(field.c_str(), "wbytes=%lld", &value) == 1)
+      write_bytes += value;
+  }
+}
+
+// "anon" of memory.stat, the memory of the processes which is not page cache
+static int64_t read_cgroup_anon(const std::string &path) {
+  FILE *file = fopen(path.c_str(), "re");
+  if (!file)
+    return -1;
+  char line[128]{};
+  long long value = -1;
+  while (fgets(line, sizeof(line), file)) {
+    if (sscanf(line, "anon %lld", &value) == 1)
+      break;
+  }
+  fclose(file);
+  return value;
+}
+
+static constexpr auto memory_watch_interval = std::chrono::milliseconds(200);
+
+// the peaks of an open span, see resource_span_begin()
+struct SpanPeaks {
+  // memory.peak, reset for this descriptor only; -1 if it cannot be reset
+  int peak_fd;
+  int64_t anon_peak;
+};
+
+struct MemoryWatch {
+  pid_t pid{0};
+  // the same, for the whole build
+  int peak_fd{-1};
+  std::atomic<int64_t> anon_peak{-1};
+  std::mutex mutex;
+  std::condition_variable wakeup;
+  bool stopping{false};
+  std::thread sampler;
+  // innermost last, updated by the sampler thread too
+  std::mutex spans_mutex;
+  std::vector<SpanPeaks> spans;
+};
+
+// never freed, like the asynchronous log output
+static MemoryWatch *memory_watch = nullptr;
+
+static inline bool memory_watch_active(const MemoryWatch *watch) {
+  return watch && watch->pid == getpid() && watch->sampler.joinable();
+}
+
+// returns the anonymous memory now, -1 if unknown
+static int64_t memory_watch_update(MemoryWatch *watch) {
+  const int64_t anon = read_cgroup_anon(cgroup_directory() + "/memory.stat");
+  int64_t peak = watch->anon_peak.load(std::memory_order_relaxed);
+  while (anon > peak && !watch->anon_peak.compare_exchange_weak(
+                            peak, anon, std::memory_order_relaxed)) {
+  }
+  std::lock_guard<std::mutex> guard(watch->spans_mutex);
+  for (auto &span : watch->spans)
+    span.anon_peak = std::max(span.anon_peak, anon);
+  return anon;
+}
+
+// opens memory.peak with a peak of its own, from now on
+static int open_reset_peak() {
+  const int fd = open((cgroup_directory() + "/memory.peak").c_str(),
+                      O_RDWR | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  if (write(fd, "reset\n", 6) == 6)
+    return fd;
+  close(fd);
+  return -1;
+}
+
+static void memory_watch_main(MemoryWatch *watch) {
+  std::unique_lock<std::mutex> lock(watch->mutex);
+  do {
+    memory_watch_update(watch);
+  } while (!watch->wakeup.wait_for(lock, memory_watch_interval,
+                                   [watch] { return watch->stopping; }));
+}
+
+void resource_watch_start() {
+  static bool hooks_registered = false;
+  // the watch of a parent process (if any) has no sampler in this one
+  if ((memory_watch && memory_watch->pid == getpid()) ||
+      cgroup_directory().empty())
+    return;
+  if (!hooks_registered) {
+    atexit(resource_watch_stop);
+    hooks_registered = true;
+  }
+  auto *watch = new MemoryWatch();
+  watch->pid = getpid();
+  // older kernels have no per-descriptor peaks, their memory.peak is the
+  // peak since the cgroup was created, which may well be before this build
+  watch->peak_fd = open_reset_peak();
+  watch->sampler = start_background_thread(memory_watch_main, watch);
+  memory_watch = watch;
+}
+
+void resource_watch_stop() {
+  MemoryWatch *watch = memory_watch;
+  if (!memory_watch_active(watch))
+    return;
+  {
+    std::lock_guard<std::mutex> lock(watch->mutex);
+    watch->stopping = true;
+  }
+  watch->wakeup.notify_one();
+  watch->sampler.join();
+  if (watch->peak_fd >= 0)
+    close(watch->peak_fd);
+  watch->peak_fd = -1;
+}
+
+static int64_t read_watched_peak(const int fd) {
+  char buffer[32]{};
+  const ssize_t size = pread(fd, buffer, sizeof(buffer) - 1, 0);
+  if (size <= 0)
+    return -1;
+  long long value = -1;
+  if (sscanf(buffer, "%lld", &value) != 1)
+    return -1;
+  return value;
+}
+
+static void read_proc_io(int64_t &read_bytes, int64_t &write_bytes) {
+  FILE *file = fopen("/proc/self/io", "re");
+  if (!file)
+    return;
+  char line[128]{};
+  long long value = 0;
+  while (fgets(line, sizeof(line), file)) {
+    if (sscanf(line, "read_bytes: %lld", &value) == 1)
+      read_bytes = value;
+    else if (sscanf(line, "write_bytes: %lld", &value) == 1)
+      write_bytes = value;
+  }
+  fclose(file);
+}
+
+ResourceUsage resource_sample() {
+  ResourceUsage usage{0, 0, -1, -1, -1, -1, -1, -1, -1};
+  rusage self{};
+  rusage children{};
+  if (getrusage(RUSAGE_SELF, &self) == 0 &&
+      getrusage(RUSAGE_CHILDREN, &children) == 0) {
+    usage.user_us = timeval_to_us(self.ru_utime) +
+                    timeval_to_us(children.ru_utime);
+    usage.system_us = timeval_to_us(self.ru_stime) +
+                      timeval_to_us(children.ru_stime);
+    usage.max_rss_kb = children.ru_maxrss;
+  }
+  read_proc_io(usage.read_bytes, usage.write_bytes);
+  const auto &cgroup = cgroup_directory();
+  if (!cgroup.empty()) {
+    MemoryWatch *watch = memory_watch;
+    if (memory_watch_active(watch)) {
+      // between two samples of the thread
+      memory_watch_update(watch);
+      usage.cgroup_anon_peak =
+          watch->anon_peak.load(std::memory_order_relaxed);
+      if (watch->peak_fd >= 0)
+        usage.cgroup_memory_peak = read_watched_peak(watch->peak_fd);
+    }
+    read_cgroup_io(cgroup + "/io.stat", usage.cgroup_read_bytes,
+                   usage.cgroup_write_bytes);
+  }
+  return usage;
+}
+
+void resource_span_begin() {
+  MemoryWatch *watch = memory_watch;
+  if (!memory_watch_active(watch)) {
+    // kept even, resource_span_end() pops one
+    if (watch)
+      watch->spans.push_back(SpanPeaks{-1, -1});
+    return;
+  }
+  const int64_t anon = memory_watch_update(watch);
+  const int fd = open_reset_peak();
+  std::lock_guard<std::mutex> guard(watch->spans_mutex);
+  watch->spans.push_back(SpanPeaks{fd, anon});
+}
+
+void resource_span_end(ResourceUsage &usage) {
+  usage.cgroup_memory_peak = -1;
+  usage.cgroup_anon_peak = -1;
+  MemoryWatch *watch = memory_watch;
+  if (!watch || watch->spans.empty())
+    return;
+  if (memory_watch_active(watch))
+    memory_watch_update(watch);
+  SpanPeaks span{};
+  {
+    std::lock_guard<std::mutex> guard(watch->spans_mutex);
+    span = watch->spans.back();
+    watch->spans.pop_back();
+  }
+  usage.cgroup_anon_peak = span.anon_peak;
+  if (span.peak_fd >= 0) {
+    usage.cgroup_memory_peak = read_watched_peak(span.peak_fd);
+    close(span.peak_fd);
+  }
+}
+
+static inline int64_t counter_delta(const int64_t begin, const int64_t end) {
+  return (begin < 0 || end < 0) ? -1 : end - begin;
+}
+
+ResourceUsage resource_delta(const ResourceUsage &begin,
+                             const ResourceUsage &end) {
+  return ResourceUsage{
+      counter_delta(begin.user_us, end.user_us),
+      counter_delta(begin.system_us, end.system_us),
+      // the largest child so far cannot be reset: a larger one was reaped
+      // in between, or the peak in between is unknown
+      end.max_rss_kb > begin.max_rss_kb ? end.max_rss_kb : -1,
+      counter_delta(begin.read_bytes, end.read_bytes),
+      counter_delta(begin.write_bytes, end.write_bytes),
+      end.cgroup_memory_peak,
+      end.cgroup_anon_peak,
+      counter_delta(begin.cgroup_read_bytes, end.cgroup_read_bytes),
+      counter_delta(begin.cgroup_write_bytes, end.cgroup_write_bytes),
+  };
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+// Resource usage of the build process and its (reaped) children. Values which
+// are not available on this system are -1.
+struct ResourceUsage {
+  // getrusage(), RUSAGE_SELF + RUSAGE_CHILDREN
+  int64_t user_us;
+  int64_t system_us;
+  // RUSAGE_CHILDREN, the peak of the largest child so far
+  int64_t max_rss_kb;
+  // /proc/self/io, which includes the reaped children
+  int64_t read_bytes;
+  int64_t write_bytes;
+  // cgroup v2 memory.peak and io.stat of the cgroup of the build. The peaks
+  // are the ones since resource_watch_start(): memory.peak only where it can
+  // be reset (Linux 6.12+), and the anonymous memory of memory.stat (without
+  // the page cache) as sampled in the background.
+  int64_t cgroup_memory_peak;
+  int64_t cgroup_anon_peak;
+  int64_t cgroup_read_bytes;
+  int64_t cgroup_write_bytes;
+};
+
+// Starts (and stops) following the peaks of the cgroup of the build, in the
+// main process only.
+void resource_watch_start();
+void resource_watch_stop();
+ResourceUsage resource_sample();
+// The usage between two samples. The counters are differences, max_rss_kb is
+// only known if it grew in between, and the cgroup peaks are the ones of the
+// whole build so far.
+ResourceUsage resource_delta(const ResourceUsage &begin,
+                             const ResourceUsage &end);
+// Follows the cgroup peaks of a span of the build: resource_span_begin() at
+// its start, and resource_span_end() at its end, which replaces the peaks of
+// usage with the ones reached in between. The spans nest.
+void resource_span_begin();
+void resource_span_end(ResourceUsage &usage);
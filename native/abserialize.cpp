@@ -1,5 +1,7 @@
 #include <nlohmann/json.hpp>
+#include <unordered_map>
 
+#include "abinstrument.hpp"
 #include "abserialize.hpp"
 
 extern "C" {
@@ -40,9 +42,74 @@ inline static json json_from_shell_var(SHELL_VAR *var) {
   return j;
 }
 
-static SHELL_VAR *shell_var_from_json(json &input, const char *name) {
+// JSON documents parsed by abjson_load, kept for the shell session
+static std::unordered_map<std::string, json> json_documents{};
+
+static std::string json_element_to_string(const json &input) {
+  if (input.is_null())
+    return {};
+  if (input.is_string())
+    return input.template get<std::string>();
+  if (input.is_boolean())
+    return input.template get<bool>() ? "1" : "0";
+  // numbers and nested containers
+  return input.dump();
+}
+
+// Returns the array variable `name', reusing the existing variable (so that
+// the local variables are respected) if possible.
+static SHELL_VAR *shell_array_var(const char *name, const bool assoc) {
+  SHELL_VAR *var = find_variable(name);
+  if (!var)
+    return assoc ? make_new_assoc_variable(const_cast<char *>(name))
+                 : make_new_array_variable(const_cast<char *>(name));
+  if (readonly_p(var))
+    return nullptr;
+  if (assoc) {
+    if (var->attributes & att_array)
+      return nullptr;
+    if (!(var->attributes & att_assoc))
+      var = convert_var_to_assoc(var);
+    if (var)
+      assoc_flush(assoc_cell(var));
+    return var;
+  }
+  if (var->attributes & att_assoc)
+    return nullptr;
+  if (!(var->attributes & att_array))
+    var = convert_var_to_array(var);
+  if (var)
+    array_flush(array_cell(var));
+  return var;
+}
+
+static SHELL_VAR *shell_var_from_json(const json &input, const char *name) {
   if (input.is_discarded())
     return nullptr;
+  if (input.is_array()) {
+    SHELL_VAR *var = shell_array_var(name, false);
+    if (!var)
+      return nullptr;
+    auto *var_a = array_cell(var);
+    arrayind_t index = 0;
+    for (const auto &element : input) {
+      const auto value = json_element_to_string(element);
+      array_insert(var_a, index++, const_cast<char *>(value.c_str()));
+    }
+    return var;
+  }
+  if (input.is_object()) {
+    SHELL_VAR *var = shell_array_var(name, true);
+    if (!var)
+      return nullptr;
+    auto *var_h = assoc_cell(var);
+    for (const auto &element : input.items()) {
+      const auto value = json_element_to_string(element.value());
+      assoc_insert(var_h, strdup(element.key().c_str()),
+                   const_cast<char *>(value.c_str()));
+    }
+    return var;
+  }
   SHELL_VAR *var = bind_variable(name, nullptr, ASS_FORCE);
   if (input.is_null()) {
     return var;
@@ -63,13 +130,12 @@ static SHELL_VAR *shell_var_from_json(json &input, const char *name) {
   return var;
 }
 
-int autobuild_deserialize_variable(const std::string &content,
-                                   const std::string &query,
-                                   const std::string &var_name,
-                                   const bool allow_failure) {
-  json data = json::parse(content, nullptr, false);
-  if (data.is_discarded())
-    return 1;
+// Walks the query (e.g. ['targets'][0]['kind']) from the root of the
+// document. Missing keys and indices yield null.
+static int json_walk_query(const json &root, const std::string &query,
+                           const bool allow_failure, const json *&result) {
+  static const json null_value{};
+  const json *data = &root;
   size_t start = 0;
   bool started = false;
   for (size_t i = 0; i < query.size(); i++) {
@@ -81,12 +147,15 @@ int autobuild_deserialize_variable(const std::string &content,
       auto key = query.substr(start, i - start);
       if (!key.empty() && key[0] == '\'') {
         key = key.substr(1, key.size() - 2);
-        try {
-          data = data[key];
-        } catch (...) {
+        if (data->is_null()) {
+          continue;
+        } else if (!data->is_object()) {
           if (!allow_failure)
             return 3;
+          continue;
         }
+        const auto found = data->find(key);
+        data = found == data->end() ? &null_value : &(*found);
       } else {
         const auto *key_str = key.c_str();
         char *endp = nullptr;
@@ -94,29 +163,96 @@ int autobuild_deserialize_variable(const std::string &content,
         if (endp != key_str + key.size()) {
           return 2;
         }
-        try {
-          data = data[idx];
-        } catch (...) {
+        if (data->is_null()) {
+          continue;
+        } else if (!data->is_array() || idx < 0) {
           if (!allow_failure)
             return 3;
+          continue;
         }
+        data = static_cast<size_t>(idx) < data->size() ? &(*data)[idx]
+                                                         : &null_value;
       }
     } else if (!started) {
       return 2;
     }
   }
+  result = data;
+  return 0;
+}
 
-  if (!shell_var_from_json(data, var_name.c_str())) {
+static int json_bind_query(const json &root, const std::string &query,
+                           const std::string &var_name,
+                           const bool allow_failure) {
+  const json *data = nullptr;
+  const int ret = json_walk_query(root, query, allow_failure, data);
+  if (ret != 0)
+    return ret;
+  if (!shell_var_from_json(*data, var_name.c_str())) {
     return 4;
   }
   return 0;
 }
 
+int autobuild_deserialize_variable(const std::string &content,
+                                   const std::string &query,
+                                   const std::string &var_name,
+                                   const bool allow_failure) {
+  AB_INSTRUMENT_SCOPE(Serialize);
+  const json data = json::parse(content, nullptr, false);
+  if (data.is_discarded())
+    return 1;
+  return json_bind_query(data, query, var_name, allow_failure);
+}
+
+int autobuild_json_load(const std::string &handle, const std::string &content) {
+  AB_INSTRUMENT_SCOPE(Serialize);
+  json data = json::parse(content, nullptr, false);
+  if (data.is_discarded())
+    return 1;
+  json_documents[handle] = std::move(data);
+  return 0;
+}
+
+int autobuild_json_query(const std::string &handle, const std::string &query,
+                         const std::string &var_name,
+                         const bool allow_failure) {
+  AB_INSTRUMENT_SCOPE(Serialize);
+  const auto document = json_documents.find(handle);
+  if (document == json_documents.end())
+    return 5;
+  return json_bind_query(document->second, query, var_name, allow_failure);
+}
+
+bool autobuild_json_free(const std::string &handle) {
+  AB_INSTRUMENT_SCOPE(Serialize);
+  return json_documents.erase(handle) > 0;
+}
+
 std::string
 autobuild_serialized_variables(const std::vector<std::string> &variables) {
+  AB_INSTRUMENT_SCOPE(Serialize);
   json j{};
   for (const auto &variable : variables) {
     j[variable] = json_from_shell_var(find_variable(variable.c_str()));
   }
   return j.dump();
 }
+
+std::string autobuild_batch_record(const std::string &path, const int status,
+                                   const std::string &defines,
+                                   const std::string &log) {
+  AB_INSTRUMENT_SCOPE(Serialize);
+  json j{};
+  j["path"] = path;
+  j["status"] = status;
+  json parsed_defines = json::parse(defines, nullptr, false);
+  if (status == 0 && !parsed_defines.is_discarded()) {
+    j["defines"] = std::move(parsed_defines);
+  } else {
+    // the captured output tells why the package failed
+    j["error"] = log;
+  }
+  // the output of the package scripts is not necessarily valid UTF-8
+  return j.dump(-1, ' ', false, json::error_handler_t::replace);
+}
@@ -5,4 +5,17 @@
 
 std::string
 autobuild_serialized_variables(const std::vector<std::string> &variables);
+// One line of the batch metadata dump (autobuild -B).
+std::string autobuild_batch_record(const std::string &path, const int status,
+                                   const std::string &defines,
+                                   const std::string &log);
 int autobuild_deserialize_variable(const std::string &content, const std::string &query, const std::string &var_name, const bool allow_failure = false);
+
+// Parse-once JSON documents, referred to by a handle name for the rest of the
+// shell session. Queries use the same syntax and return values as
+// autobuild_deserialize_variable(), 5 is returned for unknown handles.
+int autobuild_json_load(const std::string &handle, const std::string &content);
+int autobuild_json_query(const std::string &handle, const std::string &query,
+                         const std::string &var_name,
+                         const bool allow_failure = false);
+bool autobuild_json_free(const std::string &handle);
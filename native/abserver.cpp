@@ -0,0 +1,157 @@
+#include "abserver.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static void append_record(std::string &payload, const char *key,
+                          const std::string &value) {
+  payload += key;
+  payload += '=';
+  payload += value;
+  payload += '\0';
+}
+
+std::string build_request_encode(const BuildRequest &request) {
+  std::string payload{build_server_magic};
+  payload += '\0';
+  append_record(payload, "cwd", request.cwd);
+  if (!request.arch.empty())
+    append_record(payload, "arch", request.arch);
+  for (const auto &entry : request.env) {
+    append_record(payload, "env", entry);
+  }
+  return payload;
+}
+
+bool build_request_decode(const std::string &payload, BuildRequest &request) {
+  size_t pos = 0;
+  bool has_magic = false;
+  while (pos < payload.size()) {
+    const size_t end = payload.find('\0', pos);
+    if (end == std::string::npos)
+      return false;
+    const std::string record = payload.substr(pos, end - pos);
+    pos = end + 1;
+    if (!has_magic) {
+      if (record != build_server_magic)
+        return false;
+      has_magic = true;
+      continue;
+    }
+    const size_t sep = record.find('=');
+    if (sep == std::string::npos)
+      return false;
+    const std::string key = record.substr(0, sep);
+    std::string value = record.substr(sep + 1);
+    if (key == "cwd") {
+      request.cwd = std::move(value);
+    } else if (key == "arch") {
+      request.arch = std::move(value);
+    } else if (key == "env") {
+      if (value.find('=') == std::string::npos)
+        return false;
+      request.env.emplace_back(std::move(value));
+    }
+    // unknown records are ignored for forward compatibility
+  }
+  return has_magic && !request.cwd.empty();
+}
+
+static int write_all(int sock, const char *data, size_t size) {
+  while (size > 0) {
+    const ssize_t ret = send(sock, data, size, MSG_NOSIGNAL);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    data += ret;
+    size -= ret;
+  }
+  return 0;
+}
+
+static int read_all(int sock, char *data, size_t size) {
+  while (size > 0) {
+    const ssize_t ret = recv(sock, data, size, 0);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (ret == 0) {
+      errno = ECONNRESET;
+      return -1;
+    }
+    data += ret;
+    size -= ret;
+  }
+  return 0;
+}
+
+int build_request_send(int sock, const std::string &payload,
+                       const int fds[3]) {
+  uint32_t length = payload.size();
+  iovec iov{&length, sizeof(length)};
+  char control[CMSG_SPACE(sizeof(int) * 3)]{};
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * 3);
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * 3);
+  ssize_t ret = 0;
+  do {
+    ret = sendmsg(sock, &msg, MSG_NOSIGNAL);
+  } while (ret < 0 && errno == EINTR);
+  if (ret < 0)
+    return -1;
+  // the header is too small to be split
+  if (static_cast<size_t>(ret) != sizeof(length)) {
+    errno = EIO;
+    return -1;
+  }
+  return write_all(sock, payload.data(), payload.size());
+}
+
+int build_request_receive(int sock, std::string &payload, int fds[3]) {
+  fds[0] = fds[1] = fds[2] = -1;
+  uint32_t length = 0;
+  iovec iov{&length, sizeof(length)};
+  char control[CMSG_SPACE(sizeof(int) * 3)]{};
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  ssize_t ret = 0;
+  do {
+    ret = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  } while (ret < 0 && errno == EINTR);
+  if (ret < 0)
+    return -1;
+  for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+      continue;
+    const size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * (count < 3 ? count : 3));
+  }
+  if (static_cast<size_t>(ret) < sizeof(length) &&
+      read_all(sock, reinterpret_cast<char *>(&length) + ret,
+               sizeof(length) - ret) != 0)
+    return -1;
+  if (length > build_server_max_payload) {
+    errno = EMSGSIZE;
+    return -1;
+  }
+  payload.resize(length);
+  return read_all(sock, &payload[0], length);
+}
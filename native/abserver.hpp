@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Protocol of the warm build server (autobuild -S <socket>).
+//
+// The client sends one request over the Unix socket: a native-endian
+// uint32_t payload length, carrying its stdin, stdout and stderr as
+// SCM_RIGHTS, followed by the payload. The payload is a list of NUL
+// terminated records, starting with the magic. The server replies with a
+// native-endian int32_t exit status once the build finishes.
+constexpr const char *build_server_magic = "AB4SERVE 1";
+constexpr size_t build_server_max_payload = 16 * 1024 * 1024;
+// the request is sent at once by ab4-client, a connection stalling for
+// longer than this must not block the other requests
+constexpr int build_server_receive_timeout = 10; // seconds
+
+struct BuildRequest {
+  // the source directory to build, becomes the working directory
+  std::string cwd;
+  // same as autobuild -a, optional
+  std::string arch;
+  // NAME=VALUE, ABMODIFIERS included
+  std::vector<std::string> env;
+};
+
+std::string build_request_encode(const BuildRequest &request);
+bool build_request_decode(const std::string &payload, BuildRequest &request);
+// Returns 0 on success, -1 with errno set on failure.
+int build_request_send(int sock, const std::string &payload, const int fds[3]);
+// Returns 0 on success, -1 with errno set on failure. The received file
+// descriptors are set to -1 if they were not sent by the client.
+int build_request_receive(int sock, std::string &payload, int fds[3]);
@@ -1,60 +1,162 @@
 #include "abspiral.hpp"
-#include "stdwrapper.hpp"
+#include "abinstrument.hpp"
 
-#include <memory>
-#include <unordered_map>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <dirent.h>
+#include <set>
+#include <string>
+#include <sys/stat.h>
 #include <vector>
 
 // defined in abspiral_data.cpp
-extern const char *lut_lookup(const char *soname);
-
-void insert_from_lut(const std::string &key, const std::string &suffix,
-                     std::unordered_set<std::string> &out) {
-  const auto search = lut_lookup(key.c_str());
-  if (search) {
-    const std::string package_string{search};
-    std::unordered_set<std::string> package_names;
-    size_t pos = 0, prev_pos = 0;
-    while ((pos = package_string.find(',', pos)) != std::string::npos) {
-      package_names.emplace(package_string.substr(prev_pos, pos - prev_pos));
-      prev_pos = ++pos;
-    }
-    if (prev_pos < package_string.length()) {
-      package_names.emplace(package_string.substr(prev_pos));
-    }
-    for (const auto &prov : package_names) {
-      out.emplace(fmt::format("{0}{1}", prov, suffix));
-      // Package names can't just be t64 and considered a suffix, a suffixed
-      // package name should always have a length of >= 4.
-      if (prov.size() < 4) {
-        continue;
-      }
-      if (prov.substr(prov.size() - 4, prov.size() - 1) == "t64") {
-        out.emplace(
-            fmt::format("{0}{1}", prov.substr(0, prov.size() - 3), suffix));
-      }
-    }
+extern size_t lut_lookup(const char *soname, const uint32_t **provides);
+extern const char *lut_package_name(const uint32_t index);
+
+static void insert_from_lut(const std::string &key, const std::string &suffix,
+                            std::unordered_set<std::string> &out) {
+  const uint32_t *provides = nullptr;
+  const size_t count = lut_lookup(key.c_str(), &provides);
+  for (size_t i = 0; i < count; i++) {
+    std::string name{lut_package_name(provides[i])};
+    name += suffix;
+    out.emplace(std::move(name));
   }
 }
 
 int spiral_from_sonames(const std::vector<std::string> &sonames,
                         std::unordered_set<std::string> &spiral_provides) {
+  AB_INSTRUMENT_SCOPE(Spiral);
+  std::string soname{};
+  std::string arch_suffix{};
   for (const auto &soname_and_arch : sonames) {
-    std::string soname{};
-    std::string arch_suffix;
     const size_t delim_pos = soname_and_arch.find(':');
     if (delim_pos != std::string::npos) {
-      soname = soname_and_arch.substr(0, delim_pos);
-      arch_suffix = soname_and_arch.substr(delim_pos, soname_and_arch.length());
+      soname.assign(soname_and_arch, 0, delim_pos);
+      arch_suffix.assign(soname_and_arch, delim_pos, std::string::npos);
     } else {
-      soname = soname_and_arch;
+      soname.assign(soname_and_arch);
+      arch_suffix.clear();
     }
     insert_from_lut(soname, arch_suffix, spiral_provides);
     const size_t suffix_pos = soname.find(".so");
     if (suffix_pos == std::string::npos)
       continue;
-    insert_from_lut(soname.substr(0, suffix_pos + 3), arch_suffix,
-                    spiral_provides);
+    soname.resize(suffix_pos + 3);
+    insert_from_lut(soname, arch_suffix, spiral_provides);
   }
   return 0;
 }
+
+static inline bool spiral_is_type(const std::string &dir, const dirent *entry,
+                                  const unsigned char type) {
+  if (entry->d_type != DT_UNKNOWN)
+    return entry->d_type == type;
+  // some file systems do not fill in d_type
+  struct stat st {};
+  const std::string path = dir + "/" + entry->d_name;
+  if (lstat(path.c_str(), &st) != 0)
+    return false;
+  switch (type) {
+  case DT_DIR:
+    return S_ISDIR(st.st_mode);
+  case DT_REG:
+    return S_ISREG(st.st_mode);
+  default:
+    return false;
+  }
+}
+
+static inline bool spiral_ends_with(const char *name, const size_t len,
+                                    const char *suffix,
+                                    const size_t suffix_len) {
+  return len > suffix_len &&
+         memcmp(name + len - suffix_len, suffix, suffix_len) == 0;
+}
+
+// awk '{ split($1, x, "<sep>"); gsub("_", "-", x[1]); print tolower(x[1]) }'
+static std::string spiral_normalize_python_name(const char *name,
+                                                const char separator) {
+  std::string result{};
+  for (const char *c = name; *c && *c != separator; c++) {
+    result += (*c == '_') ? '-' : static_cast<char>(tolower(*c));
+  }
+  return result;
+}
+
+static void spiral_scan_gir(const std::string &dir,
+                            std::set<std::string> &out) {
+  constexpr const char *typelib_suffix = ".typelib";
+  constexpr size_t typelib_suffix_len = 8;
+  DIR *handle = opendir(dir.c_str());
+  if (!handle)
+    return;
+  while (const dirent *entry = readdir(handle)) {
+    const char *name = entry->d_name;
+    if (name[0] == '.' &&
+        (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+      continue;
+    if (spiral_is_type(dir, entry, DT_DIR)) {
+      spiral_scan_gir(dir + "/" + name, out);
+      continue;
+    }
+    const size_t len = strlen(name);
+    if (!spiral_ends_with(name, len, typelib_suffix, typelib_suffix_len) ||
+        !spiral_is_type(dir, entry, DT_REG))
+      continue;
+    std::string provide{"gir1.2-"};
+    for (size_t i = 0; i < len - typelib_suffix_len; i++) {
+      provide += static_cast<char>(tolower(name[i]));
+    }
+    out.emplace(std::move(provide));
+  }
+  closedir(handle);
+}
+
+static void spiral_scan_site_packages(const std::string &dir,
+                                      const std::string &prefix,
+                                      const bool skip_pycache,
+                                      std::vector<std::string> &out) {
+  DIR *handle = opendir(dir.c_str());
+  if (!handle)
+    return;
+  std::set<std::string> packages{};
+  std::set<std::string> modules{};
+  while (const dirent *entry = readdir(handle)) {
+    const char *name = entry->d_name;
+    if (name[0] == '.' &&
+        (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+      continue;
+    if (spiral_is_type(dir, entry, DT_DIR)) {
+      if (skip_pycache && strcmp(name, "__pycache__") == 0)
+        continue;
+      packages.emplace(prefix + spiral_normalize_python_name(name, '-'));
+      continue;
+    }
+    if (spiral_ends_with(name, strlen(name), ".py", 3) &&
+        spiral_is_type(dir, entry, DT_REG)) {
+      modules.emplace(prefix + spiral_normalize_python_name(name, '.'));
+    }
+  }
+  closedir(handle);
+  out.insert(out.end(), packages.begin(), packages.end());
+  out.insert(out.end(), modules.begin(), modules.end());
+}
+
+int spiral_from_pkgdir(const std::string &pkgdir, const std::string &py2ver,
+                       const std::string &py3ver,
+                       std::vector<std::string> &spiral_provides) {
+  AB_INSTRUMENT_SCOPE(Spiral);
+  std::set<std::string> gir_provides{};
+  spiral_scan_gir(pkgdir + "/usr/lib/girepository-1.0", gir_provides);
+  spiral_provides.insert(spiral_provides.end(), gir_provides.begin(),
+                         gir_provides.end());
+  spiral_scan_site_packages(pkgdir + "/usr/lib/python" + py2ver +
+                                "/site-packages",
+                            "python2-", false, spiral_provides);
+  spiral_scan_site_packages(pkgdir + "/usr/lib/python" + py3ver +
+                                "/site-packages",
+                            "python3-", true, spiral_provides);
+  return 0;
+}
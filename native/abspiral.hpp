@@ -1,7 +1,11 @@
 #pragma once
 
+#include <string>
 #include <vector>
 #include <unordered_set>
 
 int spiral_from_sonames(const std::vector<std::string> &sonames,
                         std::unordered_set<std::string> &spiral_provides);
+int spiral_from_pkgdir(const std::string &pkgdir, const std::string &py2ver,
+                       const std::string &py3ver,
+                       std::vector<std::string> &spiral_provides);
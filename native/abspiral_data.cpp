@@ -1,22 +1,40 @@
-#define MAPBOX_ETERNAL_UNSAFE_ASSUME_SORTED
 #include "eternal.hpp"
 
+#include <cstdint>
 #include <unordered_map>
 
-constexpr std::pair<const mapbox::eternal::string,
-                    const mapbox::eternal::string>
-    data[] = {
-#include "../data/lut_sonames.cpp.inc"
+struct SpiralLutEntry {
+  const char *soname;
+  uint32_t offset;
+  uint32_t count;
 };
-const std::unordered_map<mapbox::eternal::string,
-                                            mapbox::eternal::string>
-    spiral_lut =
-        std::unordered_map<mapbox::eternal::string, mapbox::eternal::string>(
-            data, data + sizeof(data) / sizeof(data[0]));
 
-const char *lut_lookup(const char *soname) {
+#include "../data/lut_sonames.cpp.inc"
+
+static std::unordered_map<mapbox::eternal::string, const SpiralLutEntry *>
+build_spiral_lut() {
+  constexpr size_t num_entries = sizeof(spiral_sonames) / sizeof(spiral_sonames[0]);
+  std::unordered_map<mapbox::eternal::string, const SpiralLutEntry *> lut{};
+  lut.reserve(num_entries);
+  for (size_t i = 0; i < num_entries; i++) {
+    lut.emplace(spiral_sonames[i].soname, &spiral_sonames[i]);
+  }
+  return lut;
+}
+
+const std::unordered_map<mapbox::eternal::string, const SpiralLutEntry *>
+    spiral_lut = build_spiral_lut();
+
+// Returns the number of packages providing the soname, and points `provides'
+// to the indices of these packages (t64 aliases included) in the package pool
+size_t lut_lookup(const char *soname, const uint32_t **provides) {
   const auto found = spiral_lut.find(soname);
   if (found == spiral_lut.end())
-    return nullptr;
-  return found->second.c_str();
+    return 0;
+  *provides = spiral_provides + found->second->offset;
+  return found->second->count;
+}
+
+const char *lut_package_name(const uint32_t index) {
+  return spiral_packages[index];
 }
@@ -0,0 +1,335 @@
+// ab4-spiral-gen: generates the Spiral soname LUT (data/lut_sonames.cpp.inc)
+// from local Contents-*.gz files, the offline counterpart of
+// build_spiral_lut.py.
+#include "threadpool.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <zlib.h>
+
+constexpr size_t gen_inflate_buffer_size = 256 * 1024;
+constexpr size_t gen_chunk_size = 4 * 1024 * 1024;
+
+using spiral_lut_t = std::unordered_map<std::string, std::set<std::string>>;
+
+static inline bool gen_is_key_char(const char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '-' || c == '.' || c == '_' ||
+         c == '+';
+}
+
+// equivalent to (?:\.[0-9]+)*
+static inline bool gen_is_version_suffix(const char *start, const char *end) {
+  while (start < end) {
+    if (*start != '.' || (start + 1) >= end)
+      return false;
+    start++;
+    const char *digits = start;
+    while (start < end && *start >= '0' && *start <= '9')
+      start++;
+    if (start == digits)
+      return false;
+  }
+  return true;
+}
+
+// equivalent to the following Python regular expression (full match):
+// /?usr/lib/(?:x86_64-linux-gnu/)?(?P<key>lib[a-zA-Z0-9\-._+]+\.so(?:\.[0-9]+)*)
+static bool gen_match_soname_path(const char *path, const size_t len,
+                                  std::string &key) {
+  constexpr const char usr_lib[] = "usr/lib/";
+  constexpr const char multiarch[] = "x86_64-linux-gnu/";
+  const char *end = path + len;
+  if (path < end && *path == '/')
+    path++;
+  if (static_cast<size_t>(end - path) < sizeof(usr_lib) - 1 ||
+      memcmp(path, usr_lib, sizeof(usr_lib) - 1) != 0)
+    return false;
+  path += sizeof(usr_lib) - 1;
+  if (static_cast<size_t>(end - path) >= sizeof(multiarch) - 1 &&
+      memcmp(path, multiarch, sizeof(multiarch) - 1) == 0)
+    path += sizeof(multiarch) - 1;
+  // at least "lib" + one character + ".so"
+  if (end - path < 7 || memcmp(path, "lib", 3) != 0)
+    return false;
+  for (const char *c = path + 3; c < end; c++) {
+    if (!gen_is_key_char(*c))
+      return false;
+  }
+  for (const char *so = path + 4; so + 3 <= end; so++) {
+    if (memcmp(so, ".so", 3) != 0)
+      continue;
+    if (gen_is_version_suffix(so + 3, end)) {
+      key.assign(path, end);
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline bool gen_is_space(const char c) {
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+static void gen_parse_line(const char *line, const size_t len,
+                           spiral_lut_t &out) {
+  const char *end = line + len;
+  while (end > line && gen_is_space(*(end - 1)))
+    end--;
+  // the package list is the last whitespace separated field
+  const char *sep = end;
+  while (sep > line && !gen_is_space(*(sep - 1)))
+    sep--;
+  if (sep == line)
+    return;
+  const char *path_end = sep;
+  while (path_end > line && gen_is_space(*(path_end - 1)))
+    path_end--;
+  std::string key{};
+  if (!gen_match_soname_path(line, path_end - line, key))
+    return;
+  auto &packages = out[key];
+  // section/package,section/package
+  const char *start = sep;
+  for (const char *c = sep; c <= end; c++) {
+    if (c != end && *c != ',')
+      continue;
+    const char *name = start;
+    for (const char *s = start; s < c; s++) {
+      if (*s == '/')
+        name = s + 1;
+    }
+    if (name < c)
+      packages.emplace(name, c);
+    start = c + 1;
+  }
+}
+
+static void gen_parse_chunk(const std::string &chunk, spiral_lut_t &out) {
+  size_t pos = 0;
+  while (pos < chunk.size()) {
+    size_t eol = chunk.find('\n', pos);
+    if (eol == std::string::npos)
+      eol = chunk.size();
+    gen_parse_line(chunk.data() + pos, eol - pos, out);
+    pos = eol + 1;
+  }
+}
+
+// Merges the parsed chunks from all the worker threads, and limits the number
+// of chunks waiting to be parsed so that the memory usage stays bounded.
+class SpiralGenContext {
+public:
+  explicit SpiralGenContext(const size_t max_pending)
+      : m_max_pending(max_pending), m_pending(0) {}
+
+  void acquire() {
+    std::unique_lock<std::mutex> lock(m_pending_mutex);
+    m_waker.wait(lock, [&] { return m_pending < m_max_pending; });
+    m_pending++;
+  }
+
+  void release() {
+    std::lock_guard<std::mutex> lock(m_pending_mutex);
+    m_pending--;
+    m_waker.notify_all();
+  }
+
+  void merge(spiral_lut_t &partial) {
+    std::lock_guard<std::mutex> lock(m_result_mutex);
+    for (auto &entry : partial) {
+      auto &packages = m_result[entry.first];
+      packages.insert(entry.second.begin(), entry.second.end());
+    }
+  }
+
+  const spiral_lut_t &result() const { return m_result; }
+
+private:
+  const size_t m_max_pending;
+  size_t m_pending;
+  std::mutex m_pending_mutex;
+  std::condition_variable m_waker;
+  std::mutex m_result_mutex;
+  spiral_lut_t m_result;
+};
+
+class SpiralGenPool : public ThreadPool<std::string, int> {
+public:
+  explicit SpiralGenPool(SpiralGenContext &context)
+      : ThreadPool<std::string, int>([&](std::string &chunk) {
+          spiral_lut_t partial{};
+          gen_parse_chunk(chunk, partial);
+          m_context.merge(partial);
+          m_context.release();
+          return 0;
+        }),
+        m_context(context) {}
+
+private:
+  SpiralGenContext &m_context;
+};
+
+static int gen_read_contents(const std::string &path, SpiralGenPool &pool,
+                             SpiralGenContext &context) {
+  gzFile file = gzopen(path.c_str(), "rb");
+  if (!file) {
+    fprintf(stderr, "Unable to open %s\n", path.c_str());
+    return 1;
+  }
+  gzbuffer(file, gen_inflate_buffer_size);
+  std::vector<char> buffer(gen_inflate_buffer_size);
+  std::string chunk{};
+  chunk.reserve(gen_chunk_size + gen_inflate_buffer_size);
+  int read_size = 0;
+  while ((read_size = gzread(file, buffer.data(), buffer.size())) > 0) {
+    chunk.append(buffer.data(), read_size);
+    if (chunk.size() < gen_chunk_size)
+      continue;
+    // only hand over complete lines to the workers
+    const size_t eol = chunk.rfind('\n');
+    if (eol == std::string::npos)
+      continue;
+    std::string rest = chunk.substr(eol + 1);
+    chunk.resize(eol + 1);
+    context.acquire();
+    pool.enqueue(std::move(chunk));
+    chunk = std::move(rest);
+    chunk.reserve(gen_chunk_size + gen_inflate_buffer_size);
+  }
+  int errnum = Z_OK;
+  const std::string message{gzerror(file, &errnum)};
+  gzclose(file);
+  if (read_size < 0 || (errnum != Z_OK && errnum != Z_STREAM_END)) {
+    fprintf(stderr, "Unable to decompress %s: %s\n", path.c_str(),
+            message.c_str());
+    return 1;
+  }
+  if (!chunk.empty()) {
+    context.acquire();
+    pool.enqueue(std::move(chunk));
+  }
+  return 0;
+}
+
+// Package names can't just be t64 and considered a suffix, a suffixed
+// package name should always have a length of >= 4.
+static inline bool gen_has_t64_alias(const std::string &package) {
+  return package.size() >= 4 &&
+         package.compare(package.size() - 3, 3, "t64") == 0;
+}
+
+// The output must stay byte-identical to build_spiral_lut.py:write_lut()
+static int gen_write_lut(const spiral_lut_t &lut, const char *target_path) {
+  std::map<std::string, std::set<std::string>> provides{};
+  std::set<std::string> pool{};
+  for (const auto &entry : lut) {
+    auto &expanded = provides[entry.first];
+    for (const auto &package : entry.second) {
+      expanded.emplace(package);
+      if (gen_has_t64_alias(package))
+        expanded.emplace(package.substr(0, package.size() - 3));
+    }
+    pool.insert(expanded.begin(), expanded.end());
+  }
+  std::unordered_map<std::string, size_t> pool_index{};
+  pool_index.reserve(pool.size());
+  for (const auto &package : pool) {
+    pool_index.emplace(package, pool_index.size());
+  }
+
+  std::ofstream target_file(target_path, std::ios::binary | std::ios::trunc);
+  if (!target_file.is_open()) {
+    fprintf(stderr, "Unable to open %s for writing\n", target_path);
+    return 1;
+  }
+  target_file << "// Generated Spiral LUT, do not edit.\n"
+              << "constexpr const char *spiral_packages[] = {\n";
+  size_t i = 0;
+  for (const auto &package : pool) {
+    target_file << '"' << package << "\",";
+    if (++i < pool.size())
+      target_file << '\n';
+  }
+  target_file << "\n};\nconstexpr uint32_t spiral_provides[] = {\n";
+  i = 0;
+  for (const auto &entry : provides) {
+    for (const auto &package : entry.second) {
+      target_file << pool_index[package] << ',';
+    }
+    if (++i < provides.size())
+      target_file << '\n';
+  }
+  target_file << "\n};\nconstexpr SpiralLutEntry spiral_sonames[] = {\n";
+  i = 0;
+  size_t offset = 0;
+  for (const auto &entry : provides) {
+    target_file << "{\"" << entry.first << "\"," << offset << ','
+                << entry.second.size() << "},";
+    offset += entry.second.size();
+    if (++i < provides.size())
+      target_file << '\n';
+  }
+  target_file << "\n};\n";
+  target_file.close();
+  return target_file.fail() ? 1 : 0;
+}
+
+static void gen_usage(const char *argv0) {
+  fprintf(stderr, "Usage: %s -o <output> <Contents-*.gz>...\n", argv0);
+}
+
+int main(int argc, char *argv[]) {
+  const char *target_path = nullptr;
+  std::vector<std::string> inputs{};
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-o") == 0 && (i + 1) < argc) {
+      target_path = argv[++i];
+      continue;
+    }
+    inputs.emplace_back(argv[i]);
+  }
+  if (!target_path || inputs.empty()) {
+    gen_usage(argv[0]);
+    return 2;
+  }
+
+  const unsigned int num_threads =
+      std::max(1u, std::thread::hardware_concurrency());
+  SpiralGenContext context{static_cast<size_t>(num_threads) * 2};
+  int ret = 0;
+  {
+    SpiralGenPool pool{context};
+    std::vector<std::thread> readers{};
+    std::vector<int> results(inputs.size(), 0);
+    for (size_t i = 0; i < inputs.size(); i++) {
+      readers.emplace_back([&, i] {
+        results[i] = gen_read_contents(inputs[i], pool, context);
+      });
+    }
+    for (auto &reader : readers) {
+      reader.join();
+    }
+    pool.wait_for_completion();
+    for (const auto result : results) {
+      ret |= result;
+    }
+  }
+  if (ret != 0)
+    return 1;
+
+  fprintf(stderr, "%zu entries found, saving to %s\n",
+          context.result().size(), target_path);
+  return gen_write_lut(context.result(), target_path);
+}
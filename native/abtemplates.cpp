@@ -0,0 +1,277 @@
+#include "abtemplates.hpp"
+#include "abinstrument.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <fstream>
+#include <string_view>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// only the leading comment block of a template is read for the headers
+constexpr size_t template_max_header_lines = 32;
+// file system timestamps are as coarse as the timer tick
+constexpr int64_t listing_racy_window_ns = 100 * 1000 * 1000;
+
+static inline std::string_view trim_view(std::string_view str) {
+  while (!str.empty() && (str.front() == ' ' || str.front() == '\t'))
+    str.remove_prefix(1);
+  while (!str.empty() && (str.back() == ' ' || str.back() == '\t' ||
+                          str.back() == '\r'))
+    str.remove_suffix(1);
+  return str;
+}
+
+static std::vector<std::string_view> split_words(std::string_view str) {
+  std::vector<std::string_view> words{};
+  while (true) {
+    str = trim_view(str);
+    if (str.empty())
+      break;
+    const size_t end = str.find_first_of(" \t");
+    words.emplace_back(str.substr(0, end));
+    if (end == std::string_view::npos)
+      break;
+    str.remove_prefix(end);
+  }
+  return words;
+}
+
+static bool parse_probe_op(const std::string_view op, ProbeOp &out) {
+  if (op.size() != 2 || op[0] != '-')
+    return false;
+  switch (op[1]) {
+  case 'f':
+    out = ProbeOp::File;
+    return true;
+  case 'e':
+    out = ProbeOp::Exists;
+    return true;
+  case 'x':
+    out = ProbeOp::Executable;
+    return true;
+  case 'h':
+    out = ProbeOp::Symlink;
+    return true;
+  case 'd':
+    out = ProbeOp::Directory;
+    return true;
+  case 'g':
+    out = ProbeOp::Glob;
+    return true;
+  case 'a':
+    out = ProbeOp::ArchFile;
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Parses one ##@probe line, returns false if the expression is malformed.
+static bool parse_probe_line(std::string_view line,
+                             std::vector<std::vector<ProbeTerm>> &probe) {
+  const auto words = split_words(line);
+  std::vector<ProbeTerm> clause{};
+  for (size_t i = 0; i < words.size(); i++) {
+    const auto word = words[i];
+    if (word == "||" || word == "&&") {
+      if (clause.empty() || i + 1 == words.size())
+        return false;
+      if (word == "||")
+        probe.emplace_back(std::move(clause));
+      clause = {};
+      continue;
+    }
+    // terms must be separated by an operator
+    if (i > 0 && words[i - 1] != "||" && words[i - 1] != "&&")
+      return false;
+    if (word == "false") {
+      clause.push_back(ProbeTerm{ProbeOp::False, {}});
+      continue;
+    }
+    ProbeOp op{};
+    if (!parse_probe_op(word, op) || i + 1 >= words.size())
+      return false;
+    clause.push_back(ProbeTerm{op, std::string{words[++i]}});
+  }
+  if (clause.empty())
+    return false;
+  probe.emplace_back(std::move(clause));
+  return true;
+}
+
+static TemplateInfo template_parse_header(const std::string &path) {
+  TemplateInfo info{{}, path, {}, {}, false, false};
+  std::ifstream file(path);
+  std::string line{};
+  bool probe_ok = true;
+  for (size_t i = 0; i < template_max_header_lines && std::getline(file, line);
+       i++) {
+    if (line.empty() || line[0] != '#')
+      break;
+    const std::string_view view{line};
+    constexpr std::string_view template_key = "##@template ";
+    constexpr std::string_view probe_key = "##@probe ";
+    constexpr std::string_view requires_key = "##@requires ";
+    if (view.substr(0, template_key.size()) == template_key) {
+      info.name = trim_view(view.substr(template_key.size()));
+    } else if (view.substr(0, probe_key.size()) == probe_key) {
+      probe_ok &= parse_probe_line(view.substr(probe_key.size()), info.probe);
+      info.has_probe = true;
+    } else if (view.substr(0, requires_key.size()) == requires_key) {
+      for (const auto word : split_words(view.substr(requires_key.size())))
+        info.required_exes.emplace_back(word);
+    }
+  }
+  // templates with malformed headers are handled like the ones without
+  // headers: loaded eagerly, and probed using their probe functions
+  if (!probe_ok || info.name.empty()) {
+    info.has_probe = false;
+    info.probe.clear();
+  }
+  return info;
+}
+
+std::vector<TemplateInfo> template_index_directory(const std::string &dir) {
+  AB_INSTRUMENT_SCOPE(Templates);
+  std::vector<std::string> paths{};
+  DIR *handle = opendir(dir.c_str());
+  if (!handle)
+    return {};
+  while (const dirent *entry = readdir(handle)) {
+    const size_t len = strlen(entry->d_name);
+    if (entry->d_name[0] == '.' || len < 4 ||
+        strcmp(entry->d_name + len - 3, ".sh") != 0)
+      continue;
+    paths.emplace_back(dir + "/" + entry->d_name);
+  }
+  closedir(handle);
+  // list the files in the directory in alphabetical order
+  // instead of the file system order
+  std::sort(paths.begin(), paths.end());
+  std::vector<TemplateInfo> index{};
+  index.reserve(paths.size());
+  for (const auto &path : paths) {
+    index.emplace_back(template_parse_header(path));
+  }
+  return index;
+}
+
+static inline bool stat_mtime(const std::string &path, struct timespec &out) {
+  struct stat st {};
+  if (stat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+    return false;
+  out = st.st_mtim;
+  return true;
+}
+
+SourceListing::SourceListing(const std::string &srcdir)
+    : m_srcdir(srcdir), m_mtime(), m_racy(false), m_entries() {
+  if (!stat_mtime(m_srcdir, m_mtime))
+    return;
+  struct timespec now {};
+  clock_gettime(CLOCK_REALTIME, &now);
+  const auto to_ns = [](const struct timespec &ts) {
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+  };
+  m_racy = to_ns(m_mtime) + listing_racy_window_ns >= to_ns(now);
+  DIR *handle = opendir(m_srcdir.c_str());
+  if (!handle)
+    return;
+  while (const dirent *entry = readdir(handle)) {
+    m_entries.emplace(entry->d_name, entry->d_type);
+  }
+  closedir(handle);
+}
+
+bool SourceListing::is_valid() const {
+  if (m_racy)
+    return false;
+  struct timespec mtime {};
+  if (!stat_mtime(m_srcdir, mtime))
+    return m_entries.empty();
+  return mtime.tv_sec == m_mtime.tv_sec && mtime.tv_nsec == m_mtime.tv_nsec;
+}
+
+bool SourceListing::test(const ProbeTerm &term) const {
+  switch (term.op) {
+  case ProbeOp::False:
+    return false;
+  case ProbeOp::Glob: {
+    for (const auto &entry : m_entries) {
+      if (fnmatch(term.path.c_str(), entry.first.c_str(), 0) != 0)
+        continue;
+      if (entry.second == DT_REG)
+        return true;
+      if (entry.second != DT_UNKNOWN)
+        continue;
+      // same as find -type f: symlinks are not followed
+      struct stat st {};
+      const std::string path = m_srcdir + "/" + entry.first;
+      if (lstat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+        return true;
+    }
+    return false;
+  }
+  case ProbeOp::ArchFile:
+    // handled by template_probe_match()
+    return false;
+  default:
+    break;
+  }
+
+  // a path that is not in the listing can't exist
+  const std::string_view first_component =
+      std::string_view{term.path}.substr(0, term.path.find('/'));
+  const auto entry = m_entries.find(std::string{first_component});
+  if (entry == m_entries.end())
+    return false;
+  const bool is_leaf = first_component.size() == term.path.size();
+  const unsigned char type =
+      is_leaf ? entry->second : static_cast<unsigned char>(DT_UNKNOWN);
+  const std::string path = m_srcdir + "/" + term.path;
+
+  struct stat st {};
+  switch (term.op) {
+  case ProbeOp::Exists:
+    if (type != DT_UNKNOWN && type != DT_LNK)
+      return true;
+    return stat(path.c_str(), &st) == 0;
+  case ProbeOp::File:
+    if (type != DT_UNKNOWN && type != DT_LNK)
+      return type == DT_REG;
+    return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+  case ProbeOp::Directory:
+    if (type != DT_UNKNOWN && type != DT_LNK)
+      return type == DT_DIR;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+  case ProbeOp::Symlink:
+    if (type != DT_UNKNOWN)
+      return type == DT_LNK;
+    return lstat(path.c_str(), &st) == 0 && S_ISLNK(st.st_mode);
+  case ProbeOp::Executable:
+    return faccessat(AT_FDCWD, path.c_str(), X_OK, AT_EACCESS) == 0;
+  default:
+    return false;
+  }
+}
+
+bool template_probe_match(
+    const TemplateInfo &info, const SourceListing &listing,
+    const std::function<bool(const std::string &)> &find_arch_file) {
+  AB_INSTRUMENT_SCOPE(Templates);
+  for (const auto &clause : info.probe) {
+    const bool matched =
+        std::all_of(clause.begin(), clause.end(), [&](const ProbeTerm &term) {
+          if (term.op == ProbeOp::ArchFile)
+            return find_arch_file(term.path);
+          return listing.test(term);
+        });
+    if (matched)
+      return true;
+  }
+  return false;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum class ProbeOp : uint8_t {
+  // false
+  False,
+  // -f <path>
+  File,
+  // -e <path>
+  Exists,
+  // -x <path>
+  Executable,
+  // -h <path>
+  Symlink,
+  // -d <path>
+  Directory,
+  // -g <glob>: any regular file in SRCDIR matching the pattern, the paths of
+  // all the terms are relative to SRCDIR (not the working directory)
+  Glob,
+  // -a <file>: arch_findfile -2 <file>
+  ArchFile,
+};
+
+struct ProbeTerm {
+  ProbeOp op;
+  std::string path;
+};
+
+// Build templates declare their probes in the header:
+//   ##@template <name>
+//   ##@probe <term> [&& <term>]... [|| <term> [&& <term>]...]...
+//   ##@requires <executable>...
+// Multiple ##@probe lines are combined with ||. The required executables are
+// checked when the templates are indexed, like ab_register_template does for
+// the templates loaded eagerly.
+struct TemplateInfo {
+  std::string name;
+  std::string path;
+  // disjunction of conjunctions
+  std::vector<std::vector<ProbeTerm>> probe;
+  // $VAR is expanded by the caller
+  std::vector<std::string> required_exes;
+  bool has_probe;
+  bool loaded;
+};
+
+// Listing of the top-level entries in SRCDIR, shared by all the probes.
+class SourceListing {
+public:
+  explicit SourceListing(const std::string &srcdir);
+  bool is_valid() const;
+  bool test(const ProbeTerm &term) const;
+  const std::string &srcdir() const { return m_srcdir; }
+
+private:
+  std::string m_srcdir;
+  struct timespec m_mtime;
+  // the directory was modified too recently for its modification time to
+  // tell later changes apart
+  bool m_racy;
+  // entry name -> dirent type
+  std::unordered_map<std::string, unsigned char> m_entries;
+};
+
+// Parses the headers of all the templates in the directory, in the order
+// they should be registered.
+std::vector<TemplateInfo> template_index_directory(const std::string &dir);
+bool template_probe_match(
+    const TemplateInfo &info, const SourceListing &listing,
+    const std::function<bool(const std::string &)> &find_arch_file);
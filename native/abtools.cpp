@@ -0,0 +1,178 @@
+// Native tools (autobuild -E <tool> [args...]): the native functionality of
+// autobuild, usable from scripts without setting up a build environment.
+#include "abnativeelf.hpp"
+#include "abnativefunctions.h"
+#include "abspiral.hpp"
+#include "pm.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <sstream>
+#include <unordered_map>
+
+extern "C" {
+#include "bashincludes.h"
+}
+
+using json = nlohmann::json;
+
+struct NativeTool {
+  const char *usage;
+  int (*run)(const std::vector<std::string> &args, std::ostream &out);
+};
+
+static const std::unordered_map<std::string, NativeTool> &native_tools();
+
+// One JSON object per line and per file, in the order of the arguments.
+static int tool_elfinfo(const std::vector<std::string> &args,
+                        std::ostream &out) {
+  if (args.empty())
+    return EX_BADUSAGE;
+  int ret = 0;
+  for (const auto &path : args) {
+    json record{{"path", path}};
+    ELFParseResult result{};
+    if (elf_identify_file(path.c_str(), result) != 0) {
+      record["error"] = strerror(errno);
+      ret = 1;
+    } else {
+      record["type"] = binary_type_name(result.bin_type);
+      record["arch"] = aosc_arch_name(result.arch);
+      record["soname"] = result.soname;
+      record["build_id"] = result.build_id;
+      record["needed"] = result.needed_libs;
+      record["debug_info"] = result.has_debug_info;
+    }
+    out << record.dump() << '\n';
+  }
+  return ret;
+}
+
+static int tool_spiral(const std::vector<std::string> &args,
+                       std::ostream &out) {
+  if (args.empty())
+    return EX_BADUSAGE;
+  std::unordered_set<std::string> provides{};
+  const int ret = spiral_from_sonames(args, provides);
+  if (ret != 0)
+    return ret;
+  std::vector<std::string> sorted{provides.begin(), provides.end()};
+  std::sort(sorted.begin(), sorted.end());
+  for (const auto &name : sorted) {
+    out << name << '\n';
+  }
+  return 0;
+}
+
+static int tool_debver(const std::vector<std::string> &args,
+                       std::ostream &out) {
+  if (args.empty())
+    return EX_BADUSAGE;
+  for (const auto &version : args) {
+    out << autobuild_to_deb_version(version) << '\n';
+  }
+  return 0;
+}
+
+// Runs another tool repeatedly with its output discarded, and reports the
+// timings as a JSON object.
+static int tool_bench(const std::vector<std::string> &args,
+                      std::ostream &out) {
+  size_t iterations = 1000;
+  size_t pos = 0;
+  if (args.size() >= 2 && args[0] == "-n") {
+    char *end = nullptr;
+    iterations = strtoul(args[1].c_str(), &end, 10);
+    if (!end || *end || iterations == 0)
+      return EX_BADUSAGE;
+    pos = 2;
+  }
+  if (pos >= args.size() || args[pos] == "bench")
+    return EX_BADUSAGE;
+  const auto &tools = native_tools();
+  const auto tool = tools.find(args[pos]);
+  if (tool == tools.end()) {
+    get_logger()->errorf("Unknown tool: {0}", args[pos]);
+    return EX_BADUSAGE;
+  }
+  const std::vector<std::string> tool_args{args.begin() + pos + 1, args.end()};
+
+  using clock = std::chrono::steady_clock;
+  clock::duration total{};
+  clock::duration min = clock::duration::max();
+  clock::duration max{};
+  for (size_t i = 0; i < iterations; i++) {
+    std::ostringstream discarded{};
+    const auto start = clock::now();
+    const int ret = tool->second.run(tool_args, discarded);
+    const auto elapsed = clock::now() - start;
+    if (ret != 0) {
+      get_logger()->errorf("{0} failed with status {1}", args[pos], ret);
+      return ret;
+    }
+    total += elapsed;
+    min = std::min(min, elapsed);
+    max = std::max(max, elapsed);
+  }
+  const auto to_ns = [](const clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+  };
+  const json report{{"tool", args[pos]},
+                    {"iterations", iterations},
+                    {"total_ns", to_ns(total)},
+                    {"mean_ns", to_ns(total) / iterations},
+                    {"min_ns", to_ns(min)},
+                    {"max_ns", to_ns(max)}};
+  out << report.dump() << '\n';
+  return 0;
+}
+
+static const std::unordered_map<std::string, NativeTool> &native_tools() {
+  static const std::unordered_map<std::string, NativeTool> tools{
+      {"elfinfo", {"<files...>", tool_elfinfo}},
+      {"spiral", {"<sonames...>", tool_spiral}},
+      {"debver", {"<versions...>", tool_debver}},
+      {"bench", {"[-n <iterations>] <tool> [args...]", tool_bench}},
+  };
+  return tools;
+}
+
+static void native_tools_usage() {
+  std::vector<std::string> names{};
+  for (const auto &it : native_tools()) {
+    names.emplace_back(it.first);
+  }
+  std::sort(names.begin(), names.end());
+  for (const auto &name : names) {
+    std::cerr << "autobuild -E " << name << " "
+              << native_tools().at(name).usage << '\n';
+  }
+}
+
+extern "C" {
+int run_native_tool(const char *name, WORD_LIST *list) {
+  const auto &tools = native_tools();
+  const auto tool = tools.find(name);
+  if (tool == tools.end()) {
+    get_logger()->errorf("Unknown tool: {0}", name);
+    native_tools_usage();
+    return EX_USAGE;
+  }
+  std::vector<std::string> args{};
+  for (; list; list = list->next) {
+    args.emplace_back(list->word->word);
+  }
+  const int ret = tool->second.run(args, std::cout);
+  std::cout.flush();
+  if (ret == EX_BADUSAGE) {
+    std::cerr << "Usage: autobuild -E " << name << " " << tool->second.usage
+              << '\n';
+    return EX_USAGE;
+  }
+  return ret;
+}
+} // extern "C"
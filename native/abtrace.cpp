@@ -0,0 +1,216 @@
+#include "abtrace.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+using trace_clock = std::chrono::steady_clock;
+
+static std::atomic<bool> tracing{false};
+static int trace_options = 0;
+static pid_t trace_pid = 0;
+static trace_clock::time_point trace_epoch{};
+static std::mutex trace_mutex{};
+static std::vector<TraceEvent> trace_events{};
+// spans opened by trace_begin(), main thread only
+static std::vector<TraceEvent> trace_stack{};
+
+static inline int current_tid() {
+  return static_cast<int>(syscall(SYS_gettid));
+}
+
+// sample at trace_begin() of the spans in trace_stack, same order
+static std::vector<ResourceUsage> trace_stack_usage{};
+
+void trace_start(const int flags) {
+  if (tracing.load(std::memory_order_acquire) || flags == 0)
+    return;
+  trace_options = flags;
+  trace_pid = getpid();
+  trace_epoch = trace_clock::now();
+  trace_events.reserve(1024);
+  if (flags & AB_TRACE_RESOURCES)
+    resource_watch_start();
+  tracing.store(true, std::memory_order_release);
+}
+
+bool trace_enabled() { return tracing.load(std::memory_order_acquire); }
+
+int trace_flags() { return trace_enabled() ? trace_options : 0; }
+
+int64_t trace_now_us() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             trace_clock::now() - trace_epoch)
+      .count();
+}
+
+void trace_begin(std::string category, std::string name) {
+  if (!trace_enabled())
+    return;
+  if (trace_options & AB_TRACE_RESOURCES) {
+    trace_stack_usage.push_back(resource_sample());
+    resource_span_begin();
+  }
+  trace_stack.push_back(TraceEvent{std::move(category), std::move(name),
+                                   trace_now_us(), 0, current_tid(), false,
+                                   false, {}, -1});
+}
+
+// pops the innermost span of trace_stack, ending now
+static TraceEvent trace_pop(const int64_t now) {
+  TraceEvent event = std::move(trace_stack.back());
+  trace_stack.pop_back();
+  event.duration_us = now - event.start_us;
+  if (trace_options & AB_TRACE_RESOURCES) {
+    event.usage = resource_delta(trace_stack_usage.back(), resource_sample());
+    resource_span_end(event.usage);
+    event.has_usage = true;
+    trace_stack_usage.pop_back();
+  }
+  return event;
+}
+
+bool trace_end() {
+  if (!trace_enabled())
+    return true;
+  if (trace_stack.empty())
+    return false;
+  trace_record(trace_pop(trace_now_us()));
+  return true;
+}
+
+void trace_record(TraceEvent event) {
+  std::lock_guard<std::mutex> guard(trace_mutex);
+  trace_events.emplace_back(std::move(event));
+}
+
+static json resource_usage_to_json(const ResourceUsage &usage) {
+  json j = json::object();
+  const std::pair<const char *, int64_t> fields[] = {
+      {"user_us", usage.user_us},
+      {"system_us", usage.system_us},
+      {"max_rss_kb", usage.max_rss_kb},
+      {"read_bytes", usage.read_bytes},
+      {"write_bytes", usage.write_bytes},
+      {"cgroup_memory_peak", usage.cgroup_memory_peak},
+      {"cgroup_anon_peak", usage.cgroup_anon_peak},
+      {"cgroup_read_bytes", usage.cgroup_read_bytes},
+      {"cgroup_write_bytes", usage.cgroup_write_bytes},
+  };
+  for (const auto &field : fields) {
+    // unavailable on this system
+    if (field.second >= 0)
+      j[field.first] = field.second;
+  }
+  return j;
+}
+
+static json trace_to_json(const std::vector<TraceEvent> &events) {
+  json trace_array = json::array();
+  const pid_t pid = trace_pid;
+  trace_array.push_back({{"ph", "M"},
+                         {"name", "process_name"},
+                         {"pid", pid},
+                         {"tid", pid},
+                         {"args", {{"name", "autobuild"}}}});
+  trace_array.push_back({{"ph", "M"},
+                         {"name", "thread_name"},
+                         {"pid", pid},
+                         {"tid", pid},
+                         {"args", {{"name", "shell"}}}});
+  for (const auto &event : events) {
+    json line = {{"ph", "X"},
+                 {"cat", event.category},
+                 {"name", event.name},
+                 {"ts", event.start_us},
+                 {"dur", event.duration_us},
+                 {"pid", pid},
+                 {"tid", event.tid}};
+    if (event.incomplete)
+      line["args"]["incomplete"] = true;
+    if (event.has_usage)
+      line["args"]["usage"] = resource_usage_to_json(event.usage);
+    if (event.bytes >= 0)
+      line["args"]["bytes"] = event.bytes;
+    trace_array.push_back(std::move(line));
+  }
+  return {{"traceEvents", std::move(trace_array)},
+          {"displayTimeUnit", "ms"}};
+}
+
+bool trace_finish(const std::string &path, std::vector<TraceEvent> &events) {
+  // subshells share the state of the parent, but not its trace
+  if (!trace_enabled() || getpid() != trace_pid)
+    return true;
+  const int64_t now = trace_now_us();
+  while (!trace_stack.empty()) {
+    TraceEvent event = trace_pop(now);
+    event.incomplete = true;
+    trace_record(std::move(event));
+  }
+  tracing.store(false, std::memory_order_release);
+  if (trace_options & AB_TRACE_RESOURCES)
+    resource_watch_stop();
+
+  {
+    std::lock_guard<std::mutex> guard(trace_mutex);
+    events.swap(trace_events);
+  }
+  if (!(trace_options & AB_TRACE_EXPORT))
+    return true;
+  std::ofstream file(path, std::ios::trunc);
+  if (!file.is_open())
+    return false;
+  file << trace_to_json(events).dump() << '\n';
+  file.close();
+  return !file.fail();
+}
+
+TraceStage::TraceStage(std::string category, std::string name) {
+  trace_begin(std::move(category), std::move(name));
+}
+
+TraceStage::~TraceStage() { trace_end(); }
+
+TraceSpan::TraceSpan(const char *category, const std::string &name)
+    : m_category(category), m_start_us(-1), m_bytes(-1) {
+  if (!trace_enabled())
+    return;
+  m_name = name;
+  m_start_us = trace_now_us();
+}
+
+TraceSpan::~TraceSpan() {
+  if (m_start_us < 0 || !trace_enabled())
+    return;
+  trace_record(TraceEvent{m_category, std::move(m_name), m_start_us,
+                          trace_now_us() - m_start_us, current_tid(), false,
+                          false, {}, m_bytes});
+}
+
+bool trace_write_stats(const std::string &path,
+                       const std::vector<TraceEvent> &events) {
+  json stages = json::array();
+  for (const auto &event : events) {
+    if (!event.has_usage)
+      continue;
+    json stage = resource_usage_to_json(event.usage);
+    stage["category"] = event.category;
+    stage["name"] = event.name;
+    stage["start_us"] = event.start_us;
+    stage["wall_us"] = event.duration_us;
+    stage["incomplete"] = event.incomplete;
+    stages.push_back(std::move(stage));
+  }
+  std::ofstream file(path, std::ios::trunc);
+  if (!file.is_open())
+    return false;
+  file << json{{"stages", std::move(stages)}}.dump() << '\n';
+  file.close();
+  return !file.fail();
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "abresource.hpp"
+
+// Stage-level tracing of a build (ABTRACE=1), exported as a Chrome trace JSON
+// file which can be loaded in Perfetto or chrome://tracing, and/or resource
+// accounting of the stages (ABSTATS=1).
+//
+// The spans of the shell (proc scripts, template steps, filters, QA modules)
+// are opened and closed in order on the main thread with trace_begin() and
+// trace_end(), the ones still open when the build dies are closed by
+// trace_finish(). Native stages on the main thread use TraceStage to do the
+// same, native code on other threads uses TraceSpan, whose spans have no
+// resource usage.
+constexpr int AB_TRACE_EXPORT = 1 << 0;
+constexpr int AB_TRACE_RESOURCES = 1 << 1;
+
+struct TraceEvent {
+  std::string category;
+  std::string name;
+  // microseconds since trace_start()
+  int64_t start_us;
+  int64_t duration_us;
+  int tid;
+  // the span was still open when the trace finished
+  bool incomplete;
+  // with AB_TRACE_RESOURCES, for the spans opened by trace_begin()
+  bool has_usage;
+  ResourceUsage usage;
+  // size of the data processed by the span, -1 if not relevant
+  int64_t bytes;
+};
+
+void trace_start(const int flags);
+int trace_flags();
+bool trace_enabled();
+int64_t trace_now_us();
+void trace_begin(std::string category, std::string name);
+// Closes the innermost span opened by trace_begin(), returns false if there
+// is none.
+bool trace_end();
+void trace_record(TraceEvent event);
+// Closes the remaining spans and moves the recorded events to events, only
+// once and only in the process which started the trace. With AB_TRACE_EXPORT,
+// they are written to path as well, returns false if that failed.
+bool trace_finish(const std::string &path, std::vector<TraceEvent> &events);
+// Writes the resource usage of the stages as JSON, returns false on failure.
+bool trace_write_stats(const std::string &path,
+                       const std::vector<TraceEvent> &events);
+
+// Opens a span with trace_begin() and closes it with trace_end() once out of
+// scope, on the main thread only.
+class TraceStage {
+public:
+  TraceStage(std::string category, std::string name);
+  ~TraceStage();
+  TraceStage(const TraceStage &) = delete;
+  TraceStage &operator=(const TraceStage &) = delete;
+};
+
+class TraceSpan {
+public:
+  TraceSpan(const char *category, const std::string &name);
+  ~TraceSpan();
+  // the span is recorded (tracing was enabled when it started)
+  inline bool active() const { return m_start_us >= 0; }
+  inline void set_bytes(const int64_t bytes) { m_bytes = bytes; }
+
+private:
+  const char *m_category;
+  std::string m_name;
+  int64_t m_start_us;
+  int64_t m_bytes;
+};
@@ -7,6 +7,7 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
 #include <sys/prctl.h>
 
 #include "abnativefunctions.h"
@@ -18,23 +19,38 @@ int autobuild_builtin(WORD_LIST *list) {
   int rval = EXECUTION_SUCCESS;
   prctl(PR_SET_NAME, "autobuild");
 
+  // the native tools do not need the build environment
+  if (!(list && strcmp(list->word->word, "-E") == 0) &&
+      register_builtin_variables() != 0) {
+    return EXECUTION_FAILURE;
+  }
+
   char action = 0;
+  const char *batch_source = NULL;
   reset_internal_getopt();
-  while ((opt = internal_getopt(list, "E:pqa:")) != -1) {
+  while ((opt = internal_getopt(list, "E:pqa:B:S:")) != -1) {
     switch (opt) {
       CASE_HELPOPT;
     case 'E':
-      // TODO: tools
-      return 0;
+      // autobuild -E <tool> [args...]
+      return run_native_tool(list_optarg, loptend);
     case 'p':
       action = opt;
       break;
+    case 'B':
+      // batch metadata dump of a tree or a list of package directories
+      action = opt;
+      batch_source = list_optarg;
+      break;
     case 'q':
       disable_logger();
       break;
     case 'a':
       set_custom_arch(list_optarg);
       break;
+    case 'S':
+      // warm build server, builds are submitted using ab4-client
+      return start_build_server(list_optarg);
     default:
       builtin_usage();
       return (EX_USAGE);
@@ -45,6 +61,8 @@ int autobuild_builtin(WORD_LIST *list) {
     break;
   case 'p':
     return dump_defines();
+  case 'B':
+    return dump_defines_batch(batch_source);
   }
   list = loptend;
   if (!list) {
@@ -58,7 +76,9 @@ int autobuild_builtin(WORD_LIST *list) {
    function returns 0, the load fails. */
 int autobuild_builtin_load(char *name) {
   setup_crash_handler();
-  if (register_builtin_variables() != 0) {
+  // set by ab4.sh for `autobuild -E', the setup is then deferred to the
+  // first build
+  if (!find_variable("AB_NATIVE_TOOLS") && register_builtin_variables() != 0) {
     return 0;
   }
   register_all_native_functions();
@@ -1,20 +1,33 @@
 #include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include "abbuildlog.hpp"
+#include "abbundle.hpp"
+#include "abfileindex.hpp"
+#include "abtrace.hpp"
 #include "bashinterface.hpp"
 #include "common.hpp"
 #include "stdwrapper.hpp"
 
 extern "C" {
 #include "bashincludes.h"
+#include "unwind_prot.h"
 // unexported functions
 extern void with_input_from_string PARAMS((char *, const char *));
 extern int line_number;
 extern int remember_on_history;
+// from evalfile.c and execute_cmd.c
+extern int sourcelevel;
+extern int return_catch_flag;
+extern int return_catch_value;
+extern procenv_t return_catch;
+extern void parse_and_execute_cleanup PARAMS((int));
 }
 
 Diagnostic autobuild_get_backtrace() {
@@ -135,6 +148,70 @@ int autobuild_bool(const char *value) {
   return 2;
 }
 
+// names turned into namerefs by autobuild_alias_array()
+static std::unordered_set<std::string> array_aliases{};
+
+// Turns dst_name into a nameref to the (indexed or associative) array src,
+// so both names share the same storage instead of copying every element.
+// `declare -n' refuses to convert an existing array, hence done by hand.
+static SHELL_VAR *autobuild_alias_array(SHELL_VAR *src, const char *dst_name,
+                                        const int att_type_mask) {
+  auto *dst = find_variable_noref(dst_name);
+  if (!dst) {
+    dst = bind_variable(dst_name, src->name, 0);
+    if (!dst)
+      return {};
+    VSETATTR(dst, att_nameref);
+    array_aliases.emplace(dst_name);
+    return src;
+  }
+  if (dst == src)
+    return src;
+  if (nameref_p(dst)) {
+    // already aliased, e.g. resolved again after reloading the defines
+    if (strcmp(nameref_cell(dst), src->name) != 0) {
+      free(dst->value);
+      dst->value = strdup(src->name);
+    }
+    return src;
+  }
+  if ((src->attributes & att_type_mask) != (dst->attributes & att_type_mask)) {
+    return {};
+  }
+  if (array_p(dst)) {
+    array_dispose(array_cell(dst));
+  } else {
+    assoc_dispose(assoc_cell(dst));
+  }
+  VUNSETATTR(dst, att_array | att_assoc);
+  dst->value = strdup(src->name);
+  VSETATTR(dst, att_nameref);
+  array_aliases.emplace(dst_name);
+  return src;
+}
+
+void autobuild_detach_array_aliases() {
+  for (const auto &name : array_aliases) {
+    auto *dst = find_variable_noref(name.c_str());
+    if (!dst || !nameref_p(dst))
+      continue;
+    const auto *src = find_variable(nameref_cell(dst));
+    if (!src || !(array_p(src) || assoc_p(src)))
+      continue;
+    char *target = dst->value;
+    VUNSETATTR(dst, att_nameref);
+    if (array_p(src)) {
+      dst->value = reinterpret_cast<char *>(array_copy(array_cell(src)));
+      VSETATTR(dst, att_array);
+    } else {
+      dst->value = reinterpret_cast<char *>(assoc_copy(assoc_cell(src)));
+      VSETATTR(dst, att_assoc);
+    }
+    free(target);
+  }
+  array_aliases.clear();
+}
+
 SHELL_VAR *autobuild_copy_variable(SHELL_VAR *src, const char *dst_name,
                                    bool reference) {
   constexpr int att_type_mask =
@@ -143,6 +220,9 @@ SHELL_VAR *autobuild_copy_variable(SHELL_VAR *src, const char *dst_name,
     return {};
   }
   const int src_types = src->attributes;
+  if (reference && (src_types & (att_array | att_assoc))) {
+    return autobuild_alias_array(src, dst_name, att_type_mask);
+  }
   auto *dst = find_variable(dst_name);
   if (!dst) {
     if (src_types & att_array) {
@@ -154,6 +234,10 @@ SHELL_VAR *autobuild_copy_variable(SHELL_VAR *src, const char *dst_name,
   if ((src_types & att_type_mask) != (dst->attributes & att_type_mask)) {
     return {};
   }
+  // dst may be a nameref to src left by a previous aliasing
+  if (dst == src) {
+    return dst;
+  }
   if (src_types & att_array) {
     ARRAY *src_cells = array_cell(src);
     ARRAY *dst_cells = array_cell(dst);
@@ -213,7 +297,139 @@ int autobuild_get_variable_with_suffix(const std::string &name,
   return 0;
 }
 
+static inline void
+collect_suffixed_variables(const HASH_TABLE *table,
+                           const std::unordered_set<std::string> &names,
+                           const std::unordered_set<std::string> &aliases,
+                           std::unordered_set<std::string> &out) {
+  if (!table)
+    return;
+  for (int i = 0; i < table->nbuckets; i++) {
+    for (const BUCKET_CONTENTS *bc = table->bucket_array[i]; bc;
+         bc = bc->next) {
+      const char *var_name = bc->key;
+      // NAME__SUFFIX, NAME itself may contain double underscores as well
+      for (const char *sep = strstr(var_name, "__"); sep;
+           sep = strstr(sep + 1, "__")) {
+        if (aliases.find(sep + 2) == aliases.end())
+          continue;
+        if (names.find(std::string{var_name, sep}) == names.end())
+          continue;
+        out.emplace(var_name);
+        break;
+      }
+    }
+  }
+}
+
+std::vector<SuffixConflict>
+autobuild_get_variables_with_suffix(const std::vector<std::string> &names,
+                                    const std::vector<std::string> &aliases) {
+  std::vector<SuffixConflict> conflicts{};
+  const std::unordered_set<std::string> names_set{names.begin(), names.end()};
+  const std::unordered_set<std::string> aliases_set{aliases.begin(),
+                                                    aliases.end()};
+  // collect all the NAME__ALIAS variables in a single pass over the tables
+  // instead of looking up every combination of names and aliases
+  std::unordered_set<std::string> candidates{};
+  collect_suffixed_variables(temporary_env, names_set, aliases_set,
+                             candidates);
+  for (const VAR_CONTEXT *vc = shell_variables; vc; vc = vc->down) {
+    collect_suffixed_variables(vc->table, names_set, aliases_set, candidates);
+  }
+  if (candidates.empty())
+    return conflicts;
+
+  // same resolution rules as autobuild_get_variable_with_suffix
+  std::string var_name{};
+  for (const auto &name : names) {
+    const std::string *found = nullptr;
+    for (auto it = aliases.begin(); it != aliases.end(); it++) {
+      var_name = name + "__" + *it;
+      if (candidates.find(var_name) == candidates.end())
+        continue;
+      auto *target = find_variable(var_name.c_str());
+      if (!target)
+        continue;
+      if (found) {
+        conflicts.push_back({name, *found, *it});
+        break;
+      }
+      autobuild_copy_variable(target, name.c_str());
+      // the first element in the aliases is the arch name
+      // which should be considered an exact match
+      if (it == aliases.begin())
+        break;
+      found = &(*it);
+    }
+  }
+  return conflicts;
+}
+
+// Sources the script from memory, with the same bookkeeping as
+// source_file(), so the backtraces and the function definitions still refer
+// to the original file name and line numbers.
+static void autobuild_pop_source_arrays(void *) {
+  SHELL_VAR *funcname_v, *bash_source_v, *bash_lineno_v;
+  ARRAY *funcname_a, *bash_source_a, *bash_lineno_a;
+  GET_ARRAY_FROM_VAR("FUNCNAME", funcname_v, funcname_a);
+  GET_ARRAY_FROM_VAR("BASH_SOURCE", bash_source_v, bash_source_a);
+  GET_ARRAY_FROM_VAR("BASH_LINENO", bash_lineno_v, bash_lineno_a);
+  array_pop(bash_source_a);
+  array_pop(bash_lineno_a);
+  array_pop(funcname_a);
+}
+
+// sources the bundled contents of a script the way _evalfile() sources the
+// file for source_file(): non-interactively, catching `return' outside of
+// functions, and restoring the state through an unwind frame so that errors
+// jumping to the top level do not leave it behind
+static int autobuild_source_string(const char *filename,
+                                   const std::string_view contents) {
+  SHELL_VAR *funcname_v, *bash_source_v, *bash_lineno_v;
+  ARRAY *funcname_a, *bash_source_a, *bash_lineno_a;
+  GET_ARRAY_FROM_VAR("FUNCNAME", funcname_v, funcname_a);
+  GET_ARRAY_FROM_VAR("BASH_SOURCE", bash_source_v, bash_source_a);
+  GET_ARRAY_FROM_VAR("BASH_LINENO", bash_lineno_v, bash_lineno_a);
+
+  // parse_and_execute() takes the ownership of the string
+  auto *string = static_cast<char *>(malloc(contents.size() + 1));
+  memcpy(string, contents.data(), contents.size());
+  string[contents.size()] = '\0';
+
+  char frame_name[] = "autobuild_source";
+  begin_unwind_frame(frame_name);
+  unwind_protect_int(return_catch_flag);
+  unwind_protect_jmp_buf(return_catch);
+  unwind_protect_int(sourcelevel);
+
+  array_push(bash_source_a, const_cast<char *>(filename));
+  char *lineno = itos(executing_line_number());
+  array_push(bash_lineno_a, lineno);
+  free(lineno);
+  array_push(funcname_a, const_cast<char *>("source"));
+  add_unwind_protect(autobuild_pop_source_arrays, nullptr);
+
+  return_catch_flag++;
+  sourcelevel++;
+  int result = 0;
+  if (setjmp_nosigs(return_catch)) {
+    parse_and_execute_cleanup(-1);
+    result = return_catch_value;
+  } else {
+    result = parse_and_execute(string, filename,
+                               SEVAL_NONINT | SEVAL_RESETLINE | SEVAL_NOHIST);
+  }
+  run_unwind_frame(frame_name);
+  return result;
+}
+
 int autobuild_load_file(const char *filename, bool validate_only) {
+  // the bundled scripts have been validated when generating the bundle
+  const auto *bundled = script_bundle_find(filename);
+  if (bundled) {
+    return validate_only ? 0 : autobuild_source_string(filename, *bundled);
+  }
   if (validate_only) {
     std::ifstream file(filename);
     if (!file.is_open()) {
@@ -253,9 +469,14 @@ int autobuild_load_all_from_directory(const char *directory) {
   // instead of the file system order
   std::sort(files.begin(), files.end());
   for (const auto &file : files) {
+    const auto filename = fs::path(file).filename().string();
+    build_log_mark("proc/" + filename);
+    trace_begin("proc", filename);
+    autobuild_file_index_expire();
     if (autobuild_load_file(file.c_str(), false)) {
       return 1;
     }
+    trace_end();
   }
   return 0;
 }
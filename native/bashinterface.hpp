@@ -18,12 +18,26 @@ int autobuild_bool(const char *value);
 int autobuild_load_file(const char *filename, bool validate_only);
 int autobuild_get_variable_with_suffix(const std::string &name,
                                        const std::vector<std::string> &aliases);
+struct SuffixConflict {
+  std::string name;
+  std::string assigned_alias;
+  std::string conflicting_alias;
+};
+std::vector<SuffixConflict>
+autobuild_get_variables_with_suffix(const std::vector<std::string> &names,
+                                    const std::vector<std::string> &aliases);
 void autobuild_register_builtins(
     const std::unordered_map<const char *, builtin_func_t>& functions);
 int autobuild_switch_strict_mode(const bool enable);
 int autobuild_copy_variable_value(const char *src_name, const char *dst_name);
+// With reference set, dst_name becomes a nameref to src instead of a copy of
+// its value, writes to either name are seen by both.
 SHELL_VAR *autobuild_copy_variable(SHELL_VAR *src, const char *dst_name,
                                    bool reference = true);
+// Replaces the arrays aliased by autobuild_copy_variable() with copies of
+// their targets, so that assigning them again (e.g. when the defines are
+// sourced again) does not write through to the suffixed variables.
+void autobuild_detach_array_aliases();
 int autobuild_load_all_from_directory(const char *directory);
 void *autobuild_get_utility_variable(const char *name);
 bool autobuild_set_utility_variable(const char *name, void *value);
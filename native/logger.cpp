@@ -1,13 +1,282 @@
 #include "logger.hpp"
 #include "abconfig.h"
 #include "stdwrapper.hpp"
+#include "threadpool.hpp"
 
+#include <atomic>
+#include <condition_variable>
 #include <fstream>
 #include <iostream>
+#include <pthread.h>
+#include <thread>
+#include <unistd.h>
 
 #include <nlohmann/json.hpp>
 
-typedef std::lock_guard<std::mutex> io_lock_guard;
+typedef std::lock_guard<InstrumentedMutex<InstrumentSite::LoggerIO>>
+    io_lock_guard;
+
+// Bounded multi-producer single-consumer ring buffer (after D. Vyukov's
+// bounded queue). Each producer claims its slots in order, so the messages
+// of a thread are written in the order they were logged.
+class AsyncLogQueue {
+public:
+  static constexpr size_t capacity = 1024;
+
+  AsyncLogQueue() {
+    for (size_t i = 0; i < capacity; i++)
+      m_cells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  // Waits for the consumer if the queue is full.
+  void push(std::string text) {
+    size_t pos = m_tail.load(std::memory_order_relaxed);
+    Cell *cell = nullptr;
+    for (;;) {
+      cell = &m_cells[pos % capacity];
+      const size_t seq = cell->sequence.load(std::memory_order_acquire);
+      const intptr_t diff =
+          static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (m_tail.compare_exchange_weak(pos, pos + 1,
+                                         std::memory_order_relaxed))
+          break;
+      } else {
+        if (diff < 0)
+          std::this_thread::yield();
+        pos = m_tail.load(std::memory_order_relaxed);
+      }
+    }
+    cell->text = std::move(text);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+  }
+
+  // Appends the next message to the batch, consumer side only.
+  bool pop_into(std::string &batch) {
+    Cell &cell = m_cells[m_head % capacity];
+    const size_t seq = cell.sequence.load(std::memory_order_acquire);
+    if (seq != m_head + 1)
+      return false;
+    batch += cell.text;
+    cell.text.clear();
+    cell.sequence.store(m_head + capacity, std::memory_order_release);
+    m_head++;
+    return true;
+  }
+
+private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    std::string text;
+  };
+  Cell m_cells[capacity];
+  alignas(64) std::atomic<size_t> m_tail{0};
+  alignas(64) size_t m_head{0};
+};
+
+struct AsyncLogOutput {
+  AsyncLogQueue queue;
+  // held by whoever drains the queue and writes it out
+  std::mutex consumer_mutex;
+  // messages pushed but not yet drained, may briefly go below zero
+  std::atomic<long> pending{0};
+  std::mutex wait_mutex;
+  std::condition_variable wakeup;
+  bool stopping{false};
+  std::thread writer;
+  std::thread::id main_thread;
+};
+
+// never freed, the writer thread may still use it until exit
+static AsyncLogOutput *async_output = nullptr;
+static std::atomic<bool> async_enabled{false};
+// set by logger_enter_crash_mode()
+static std::atomic<bool> crash_mode{false};
+
+// consumer_mutex must be held
+static void async_drain_locked(std::string &batch) {
+  long count = 0;
+  batch.clear();
+  while (async_output->queue.pop_into(batch))
+    count++;
+  if (count == 0)
+    return;
+  async_output->pending.fetch_sub(count, std::memory_order_relaxed);
+  std::cout.write(batch.data(), batch.size());
+  std::cout.flush();
+}
+
+static void async_writer_main(AsyncLogOutput *output) {
+  std::string batch{};
+  for (;;) {
+    {
+      std::lock_guard<std::mutex> guard(output->consumer_mutex);
+      async_drain_locked(batch);
+    }
+    std::unique_lock<std::mutex> lock(output->wait_mutex);
+    output->wakeup.wait(lock, [output] {
+      return output->stopping ||
+             output->pending.load(std::memory_order_relaxed) > 0;
+    });
+    if (output->stopping)
+      return;
+  }
+}
+
+static void async_push(std::string text) {
+  async_output->queue.push(std::move(text));
+  // only the first message after the queue went empty wakes the writer
+  if (async_output->pending.fetch_add(1, std::memory_order_relaxed) == 0) {
+    std::lock_guard<std::mutex> lock(async_output->wait_mutex);
+    async_output->wakeup.notify_one();
+  }
+}
+
+static void async_atfork_prepare() {
+  if (async_enabled.load(std::memory_order_acquire))
+    async_output->consumer_mutex.lock();
+}
+
+static void async_atfork_parent() {
+  if (async_enabled.load(std::memory_order_acquire))
+    async_output->consumer_mutex.unlock();
+}
+
+static void async_atfork_child() {
+  // the writer thread does not exist in the child, the queued messages are
+  // written by the parent
+  if (async_enabled.load(std::memory_order_acquire)) {
+    async_output->consumer_mutex.unlock();
+    async_enabled.store(false, std::memory_order_release);
+  }
+}
+
+static void async_shutdown() {
+  if (!async_enabled.load(std::memory_order_acquire))
+    return;
+  logger_flush();
+  {
+    std::lock_guard<std::mutex> lock(async_output->wait_mutex);
+    async_output->stopping = true;
+  }
+  async_output->wakeup.notify_one();
+  async_output->writer.join();
+  async_enabled.store(false, std::memory_order_release);
+}
+
+void logger_enable_async() {
+  static bool hooks_registered = false;
+  if (async_enabled.load(std::memory_order_acquire))
+    return;
+  if (!hooks_registered) {
+    pthread_atfork(async_atfork_prepare, async_atfork_parent,
+                   async_atfork_child);
+    atexit(async_shutdown);
+    hooks_registered = true;
+  }
+  // the one inherited from a parent process (if any) is abandoned
+  async_output = new AsyncLogOutput();
+  async_output->main_thread = std::this_thread::get_id();
+  async_output->writer =
+      start_background_thread(async_writer_main, async_output);
+  async_enabled.store(true, std::memory_order_release);
+}
+
+void logger_enter_crash_mode() {
+  crash_mode.store(true, std::memory_order_release);
+  if (!async_enabled.load(std::memory_order_acquire))
+    return;
+  // the queue is left as it is if it is being written out, possibly by the
+  // crashed thread; otherwise it stays locked, away from the writer thread
+  if (async_output->consumer_mutex.try_lock()) {
+    std::string batch{};
+    async_drain_locked(batch);
+  }
+  async_enabled.store(false, std::memory_order_release);
+}
+
+void logger_flush() {
+  if (!async_enabled.load(std::memory_order_acquire))
+    return;
+  std::string batch{};
+  std::lock_guard<std::mutex> guard(async_output->consumer_mutex);
+  async_drain_locked(batch);
+}
+
+// Held while writing directly to the standard streams (diagnostics and
+// exceptions), after writing out the queued messages, so that the writer
+// thread does not interleave its batches with the direct writes.
+class OutputGuard {
+public:
+  explicit OutputGuard(InstrumentedMutex<InstrumentSite::LoggerIO> &io_mutex)
+      : m_async_lock(), m_io_lock() {
+    if (crash_mode.load(std::memory_order_acquire))
+      return;
+    if (async_enabled.load(std::memory_order_acquire)) {
+      m_async_lock = std::unique_lock<std::mutex>(async_output->consumer_mutex);
+      std::string batch{};
+      async_drain_locked(batch);
+    }
+    m_io_lock = std::unique_lock<InstrumentedMutex<InstrumentSite::LoggerIO>>(
+        io_mutex);
+  }
+
+private:
+  std::unique_lock<std::mutex> m_async_lock;
+  std::unique_lock<InstrumentedMutex<InstrumentSite::LoggerIO>> m_io_lock;
+};
+
+void BaseLogger::emit(std::string text) {
+  AB_INSTRUMENT_SCOPE(Logger);
+  if (crash_mode.load(std::memory_order_acquire)) {
+    std::cout << text;
+    std::cout.flush();
+    return;
+  }
+  if (async_enabled.load(std::memory_order_acquire)) {
+    if (std::this_thread::get_id() != async_output->main_thread) {
+      async_push(std::move(text));
+      return;
+    }
+    std::string batch{};
+    std::lock_guard<std::mutex> guard(async_output->consumer_mutex);
+    async_drain_locked(batch);
+    std::cout << text;
+    std::cout.flush();
+    return;
+  }
+  io_lock_guard guard(this->m_io_mutex);
+  std::cout << text;
+  std::cout.flush();
+}
+
+std::string BaseLogger::formatProgress(const ProgressEvent &event) {
+  constexpr double mib = 1024.0 * 1024.0;
+  const uint64_t handled = event.processed + event.skipped;
+  auto text = fmt::format("{0}: {1}/{2}{3} files", event.task, handled,
+                          event.discovered, event.eta_s < 0 ? "+" : "");
+  if (event.skipped)
+    text += fmt::format(" ({0} skipped)", event.skipped);
+  text += fmt::format(", {0:.1f}/{1:.1f} MiB at {2:.1f} MiB/s",
+                      event.bytes / mib, event.bytes_total / mib,
+                      event.throughput / mib);
+  if (event.done)
+    text += fmt::format(", done in {0:.1f}s", event.elapsed_s);
+  else if (event.eta_s >= 0)
+    text += fmt::format(", about {0}s left", event.eta_s);
+  return text;
+}
+
+void BaseLogger::logProgress(const ProgressEvent &event) {
+  {
+    std::lock_guard<std::mutex> guard(m_progress_mutex);
+    if (!event.done && m_progress_last_s >= 0 &&
+        event.elapsed_s - m_progress_last_s < 10)
+      return;
+    m_progress_last_s = event.done ? -1 : event.elapsed_s;
+  }
+  info(formatProgress(event));
+}
 
 inline const char *level_to_string(const LogLevel level) {
   switch (level) {
@@ -26,55 +295,57 @@ inline const char *level_to_string(const LogLevel level) {
 }
 
 void NullLogger::log([[maybe_unused]] const LogLevel lvl,
-                     [[maybe_unused]] const std::string message) {}
+                     [[maybe_unused]] const std::string &message) {}
 void NullLogger::logDiagnostic([[maybe_unused]] Diagnostic diagnostic) {}
 void NullLogger::logException([[maybe_unused]] std::string message) {
+  OutputGuard guard(this->m_io_mutex);
   if (!message.empty()) {
     std::cerr << message << std::endl;
   }
 }
 
-void PlainLogger::log(const LogLevel lvl, const std::string message) {
-  io_lock_guard guard(this->m_io_mutex);
+void PlainLogger::log(const LogLevel lvl, const std::string &message) {
+  const char *prefix = "";
   switch (lvl) {
   case LogLevel::Info:
-    std::cout << "[INFO]:  ";
+    prefix = "[INFO]:  ";
     break;
   case LogLevel::Warning:
-    std::cout << "[WARN]:  ";
+    prefix = "[WARN]:  ";
     break;
   case LogLevel::Error:
-    std::cout << "[ERROR]: ";
+    prefix = "[ERROR]: ";
     break;
   case LogLevel::Critical:
-    std::cout << "[CRIT]:  ";
+    prefix = "[CRIT]:  ";
     break;
   case LogLevel::Debug:
-    std::cout << "[DEBUG]: ";
+    prefix = "[DEBUG]: ";
     break;
   }
 
-  std::cout << message << std::endl;
-  std::cout.flush();
+  emit(fmt::format("{0}{1}\n", prefix, message));
 }
 
 void PlainLogger::logDiagnostic(Diagnostic diagnostic) {
+  logger_flush();
   this->error("Build error detected ^o^");
   for (const auto &diag : diagnostic.frames) {
     const auto filename = diag.file.empty() ? "<unknown>" : diag.file;
     const auto function = (diag.function.empty() || diag.function == "source")
                               ? "<unknown>"
                               : diag.function;
-    io_lock_guard guard(this->m_io_mutex);
+    OutputGuard guard(this->m_io_mutex);
     printf("%s(%zu): In function `%s':\n", filename.c_str(), diag.line,
            function.c_str());
   }
+  OutputGuard guard(this->m_io_mutex);
   std::cerr << fmt::format("Command exited with {0}.", diagnostic.code)
             << std::endl;
 }
 
 void PlainLogger::logException(std::string message) {
-  io_lock_guard guard(this->m_io_mutex);
+  OutputGuard guard(this->m_io_mutex);
   std::cerr << "autobuild encountered an error and couldn't continue."
             << std::endl;
   if (!message.empty()) {
@@ -91,11 +362,37 @@ void PlainLogger::logException(std::string message) {
 
 using json = nlohmann::json;
 
-void JsonLogger::log(LogLevel lvl, std::string message) {
+void JsonLogger::log(LogLevel lvl, const std::string &message) {
   const json line = {
       {"event", "log"}, {"level", level_to_string(lvl)}, {"message", message}};
-  io_lock_guard guard(this->m_io_mutex);
-  std::cout << line.dump() << std::endl;
+  emit(line.dump() + '\n');
+}
+
+void JsonLogger::logFields(LogLevel lvl, std::string message,
+                           const LogFields &fields) {
+  json line = {
+      {"event", "log"}, {"level", level_to_string(lvl)}, {"message", message}};
+  line["fields"] = json::object();
+  for (const auto &field : fields) {
+    line["fields"][field.first] = field.second;
+  }
+  emit(line.dump() + '\n');
+}
+
+void JsonLogger::logProgress(const ProgressEvent &event) {
+  json line = {{"event", "progress"},
+               {"task", event.task},
+               {"discovered", event.discovered},
+               {"processed", event.processed},
+               {"skipped", event.skipped},
+               {"bytes", event.bytes},
+               {"bytes_total", event.bytes_total},
+               {"elapsed_s", event.elapsed_s},
+               {"throughput", event.throughput},
+               {"done", event.done}};
+  if (event.eta_s >= 0)
+    line["eta_s"] = event.eta_s;
+  emit(line.dump() + '\n');
 }
 
 void JsonLogger::logDiagnostic(Diagnostic diagnostic) {
@@ -108,39 +405,54 @@ void JsonLogger::logDiagnostic(Diagnostic diagnostic) {
                               {"line", frame.line},
                               {"function", frame.function}});
   }
-  io_lock_guard guard(this->m_io_mutex);
+  OutputGuard guard(this->m_io_mutex);
   std::cout << line.dump() << std::endl;
 }
 
 void JsonLogger::logException(std::string message) {
   const json line = {
       {"event", "exception"}, {"level", "CRIT"}, {"message", message}};
-  io_lock_guard guard(this->m_io_mutex);
+  OutputGuard guard(this->m_io_mutex);
   std::cout << line.dump() << std::endl;
 }
 
-void ColorfulLogger::log(LogLevel lvl, std::string message) {
-  io_lock_guard guard(this->m_io_mutex);
+void ColorfulLogger::log(LogLevel lvl, const std::string &message) {
+  const char *prefix = "";
   switch (lvl) {
   case LogLevel::Info:
-    std::cout << "[\x1b[96mINFO\x1b[0m]:  ";
+    prefix = "[\x1b[96mINFO\x1b[0m]:  ";
     break;
   case LogLevel::Warning:
-    std::cout << "[\x1b[33mWARN\x1b[0m]:  ";
+    prefix = "[\x1b[33mWARN\x1b[0m]:  ";
     break;
   case LogLevel::Error:
-    std::cout << "[\x1b[31mERROR\x1b[0m]: ";
+    prefix = "[\x1b[31mERROR\x1b[0m]: ";
     break;
   case LogLevel::Critical:
-    std::cout << "[\x1b[93mCRIT\x1b[0m]:  ";
+    prefix = "[\x1b[93mCRIT\x1b[0m]:  ";
     break;
   case LogLevel::Debug:
-    std::cout << "[\x1b[32mDEBUG\x1b[0m]: ";
+    prefix = "[\x1b[32mDEBUG\x1b[0m]: ";
     break;
   }
 
-  std::cout << "\x1b[1m" << message << "\x1b[0m" << std::endl;
-  std::cout.flush();
+  // clear the progress line first, it is printed again on the next update
+  const char *clear = m_progress_line.exchange(false) ? "\r\x1b[K" : "";
+  emit(fmt::format("{0}{1}\x1b[1m{2}\x1b[0m\n", clear, prefix, message));
+}
+
+void ColorfulLogger::logProgress(const ProgressEvent &event) {
+  if (!enabled(LogLevel::Info))
+    return;
+  // the line can only be updated in place on a terminal, checked every time
+  // as the output may be redirected in the meantime (e.g. ABCAPTURELOG=1)
+  if (!isatty(STDOUT_FILENO)) {
+    BaseLogger::logProgress(event);
+    return;
+  }
+  m_progress_line.store(!event.done);
+  emit(fmt::format("\r\x1b[K[\x1b[96mPROG\x1b[0m]:  {0}{1}",
+                   formatProgress(event), event.done ? "\n" : ""));
 }
 
 static std::string get_snippet(const std::string &filename, const size_t line) {
@@ -200,12 +512,12 @@ void ColorfulLogger::logDiagnostic(Diagnostic diagnostic) {
                           frame.file, frame.line);
   }
 
-  io_lock_guard guard(this->m_io_mutex);
+  OutputGuard guard(this->m_io_mutex);
   std::cerr << buffer << std::endl;
 }
 
 void ColorfulLogger::logException(std::string message) {
-  io_lock_guard guard(this->m_io_mutex);
+  OutputGuard guard(this->m_io_mutex);
   std::cerr << "\x1b[1;31m"
             << "autobuild encountered an error and couldn't continue."
             << "\x1b[0m" << std::endl;
@@ -1,51 +1,140 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
+#include <iterator>
 #include <mutex>
+#include <string>
+#include <utility>
 #include <vector>
 
+#include "abinstrument.hpp"
 #include "common.hpp"
+#include "stdwrapper.hpp"
+
+using LogFields = std::vector<std::pair<std::string, int64_t>>;
+
+// Progress of a long native stage, see ProgressReporter.
+struct ProgressEvent {
+  std::string task;
+  uint64_t discovered;
+  uint64_t processed;
+  uint64_t skipped;
+  // sizes of the files processed (or skipped) so far, and of all the files
+  // discovered
+  uint64_t bytes;
+  uint64_t bytes_total;
+  double elapsed_s;
+  // bytes per second
+  double throughput;
+  // estimated remaining time, -1 while the files are still being discovered
+  int64_t eta_s;
+  bool done;
+};
 
 class BaseLogger {
 public:
-  BaseLogger() : m_io_mutex(), m_level(LogLevel::Info){};
+  // everything is logged unless ABLOGLEVEL says otherwise
+  BaseLogger() : m_io_mutex(), m_level(LogLevel::Debug){};
   virtual ~BaseLogger() = default;
-  virtual void log(LogLevel lvl, std::string message) = 0;
+  virtual void log(LogLevel lvl, const std::string &message) = 0;
   virtual void logDiagnostic(Diagnostic diagnostic) = 0;
   virtual void logException(std::string message) = 0;
   virtual const char *loggerName() = 0;
+  // Logs the message along with machine-readable fields, which only
+  // JsonLogger keeps apart from the message.
+  virtual void logFields(LogLevel lvl, std::string message,
+                         [[maybe_unused]] const LogFields &fields) {
+    log(lvl, std::move(message));
+  }
+  // Called repeatedly during the stage, then once with event.done set. By
+  // default, logged as an info message at most every 10 seconds.
+  virtual void logProgress(const ProgressEvent &event);
   inline void setLogLevel(const LogLevel lvl) { m_level = lvl; }
-  inline void info(const std::string &message) { log(LogLevel::Info, message); }
+  inline bool enabled(const LogLevel lvl) const { return lvl >= m_level; }
+  inline void info(const std::string &message) {
+    if (enabled(LogLevel::Info))
+      log(LogLevel::Info, message);
+  }
   inline void debug(const std::string &message) {
-    log(LogLevel::Debug, message);
+    if (enabled(LogLevel::Debug))
+      log(LogLevel::Debug, message);
   }
   inline void warning(const std::string &message) {
-    log(LogLevel::Warning, message);
+    if (enabled(LogLevel::Warning))
+      log(LogLevel::Warning, message);
   }
   inline void error(const std::string &message) {
-    log(LogLevel::Error, message);
+    if (enabled(LogLevel::Error))
+      log(LogLevel::Error, message);
+  }
+
+  // Formats the message only if the level is enabled, into a buffer reused
+  // by the thread, e.g. logf(LogLevel::Debug, "Saving to {0}", path).
+  template <typename... Args>
+  void logf(const LogLevel lvl, fmt::format_string<Args...> format,
+            Args &&...args) {
+    if (!enabled(lvl))
+      return;
+    thread_local std::string buffer{};
+    // a message formatted from within log() gets its own buffer
+    thread_local bool buffer_in_use = false;
+    if (buffer_in_use) {
+      log(lvl, fmt::format(format, std::forward<Args>(args)...));
+      return;
+    }
+    buffer_in_use = true;
+    buffer.clear();
+    fmt::format_to(std::back_inserter(buffer), format,
+                   std::forward<Args>(args)...);
+    log(lvl, buffer);
+    buffer_in_use = false;
+  }
+  template <typename... Args>
+  inline void infof(fmt::format_string<Args...> format, Args &&...args) {
+    logf(LogLevel::Info, format, std::forward<Args>(args)...);
+  }
+  template <typename... Args>
+  inline void debugf(fmt::format_string<Args...> format, Args &&...args) {
+    logf(LogLevel::Debug, format, std::forward<Args>(args)...);
+  }
+  template <typename... Args>
+  inline void warningf(fmt::format_string<Args...> format, Args &&...args) {
+    logf(LogLevel::Warning, format, std::forward<Args>(args)...);
+  }
+  template <typename... Args>
+  inline void errorf(fmt::format_string<Args...> format, Args &&...args) {
+    logf(LogLevel::Error, format, std::forward<Args>(args)...);
   }
 
 protected:
-  std::mutex m_io_mutex;
+  static std::string formatProgress(const ProgressEvent &event);
+  // Writes a formatted message to stdout, through the asynchronous queue if
+  // it is enabled.
+  void emit(std::string text);
+
+  InstrumentedMutex<InstrumentSite::LoggerIO> m_io_mutex;
 
 private:
   LogLevel m_level;
+  std::mutex m_progress_mutex;
+  double m_progress_last_s{-1};
 };
 
 class NullLogger final : public BaseLogger {
 public:
   NullLogger() {}
-  void log(LogLevel lvl, std::string message) override;
+  void log(LogLevel lvl, const std::string &message) override;
   void logDiagnostic(Diagnostic diagnostic) override;
   void logException(std::string message) override;
+  void logProgress([[maybe_unused]] const ProgressEvent &event) override {}
   const char *loggerName() override { return "NullLogger"; }
 };
 
 class PlainLogger final : public BaseLogger {
 public:
   PlainLogger() {}
-  void log(LogLevel lvl, std::string message) override;
+  void log(LogLevel lvl, const std::string &message) override;
   void logDiagnostic(Diagnostic diagnostic) override;
   void logException(std::string message) override;
   const char *loggerName() override { return "PlainLogger"; }
@@ -54,17 +143,41 @@ public:
 class JsonLogger final : public BaseLogger {
 public:
   JsonLogger() {}
-  void log(LogLevel lvl, std::string message) override;
+  void log(LogLevel lvl, const std::string &message) override;
   void logDiagnostic(Diagnostic diagnostic) override;
   void logException(std::string message) override;
+  void logFields(LogLevel lvl, std::string message,
+                 const LogFields &fields) override;
+  void logProgress(const ProgressEvent &event) override;
   const char *loggerName() override { return "JsonLogger"; }
 };
 
 class ColorfulLogger final : public BaseLogger {
 public:
   ColorfulLogger() {}
-  void log(LogLevel lvl, std::string message) override;
+  void log(LogLevel lvl, const std::string &message) override;
   void logDiagnostic(Diagnostic diagnostic) override;
   void logException(std::string message) override;
+  // A single line, updated in place until the stage is done, if the output
+  // is a terminal.
+  void logProgress(const ProgressEvent &event) override;
   const char *loggerName() override { return "ColorfulLogger"; }
+
+private:
+  // the progress line is not terminated yet
+  std::atomic<bool> m_progress_line{false};
 };
+
+// Asynchronous log output (ABASYNCLOG=1): messages logged from worker threads
+// are queued and written in batches by a background thread, so the workers do
+// not wait on each other nor on the output. Messages logged from the main
+// thread write out the queue first, keeping the output in order with the
+// shell.
+void logger_enable_async();
+// Writes out the queued messages, called before diagnostics and exceptions
+// and at exit.
+void logger_flush();
+// Called by the crash handler: from then on, the messages are written out
+// without taking the locks of the loggers, which the crashed code may hold,
+// and the writer thread is abandoned.
+void logger_enter_crash_mode();
@@ -1,12 +1,17 @@
 #pragma once
 
 #include <condition_variable>
+#include <csignal>
 #include <deque>
 #include <functional>
 #include <mutex>
+#include <pthread.h>
 #include <thread>
+#include <utility>
 #include <vector>
 
+#include "abinstrument.hpp"
+
 #if __cplusplus >= 201703L && !defined(IFCONSTEXPR)
 #define IFCONSTEXPR constexpr
 #else
@@ -19,8 +24,29 @@
 #define ALLOW_THREADS false
 #endif
 
+// Starts a background thread with all the signals blocked: they are for the
+// shell, which handles them in the main thread.
+template <typename Function, typename... Args>
+std::thread start_background_thread(Function &&function, Args &&...args) {
+  sigset_t all_signals{};
+  sigset_t old_mask{};
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_BLOCK, &all_signals, &old_mask);
+  std::thread thread{};
+  try {
+    thread = std::thread(std::forward<Function>(function),
+                         std::forward<Args>(args)...);
+  } catch (...) {
+    pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+    throw;
+  }
+  pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+  return thread;
+}
+
 template <typename T, typename R> class ThreadPool {
   using processor_func_t = std::function<R(T &)>;
+  using queue_mutex_t = InstrumentedMutex<InstrumentSite::ThreadPoolQueue>;
 
   inline static int process_for_result(std::function<void(T &)> &func,
                                        T &data) {
@@ -39,10 +65,10 @@ public:
                                         : 1)
       : m_waker(), m_queue({}), m_stop(false), m_has_error(false),
         m_processor(std::move(processor)) {
-    for (int i = 0; i < thread_num; ++i) {
+    for (unsigned int i = 0; i < thread_num; ++i) {
       m_workers.emplace_back(std::thread{[&] {
         while (true) {
-          std::unique_lock<std::mutex> lock(m_mutex);
+          std::unique_lock<queue_mutex_t> lock(m_mutex);
           m_waker.wait(lock, [&] { return !m_queue.empty() || m_stop; });
           if (m_queue.empty() && m_stop) {
             lock.unlock();
@@ -50,6 +76,8 @@ public:
           }
           auto task = std::move(m_queue.back());
           m_queue.pop_back();
+          instrument_queue_depth(InstrumentSite::ThreadPoolQueue,
+                                 m_queue.size());
           lock.unlock();
           if (process_for_result(m_processor, task) != 0)
             m_has_error = true;
@@ -59,12 +87,13 @@ public:
   }
   ~ThreadPool() { wait_for_completion(); }
   void enqueue(T &&task) {
-    std::lock_guard<std::mutex> lock(m_mutex);
+    std::lock_guard<queue_mutex_t> lock(m_mutex);
     m_queue.emplace_back(std::move(task));
+    instrument_queue_depth(InstrumentSite::ThreadPoolQueue, m_queue.size());
     m_waker.notify_all();
   }
   void stop() {
-    std::lock_guard<std::mutex> lock(m_mutex);
+    std::lock_guard<queue_mutex_t> lock(m_mutex);
     m_stop = true;
     m_waker.notify_all();
   }
@@ -79,8 +108,8 @@ public:
 
 private:
   std::vector<std::thread> m_workers;
-  std::condition_variable m_waker;
-  std::mutex m_mutex;
+  InstrumentedConditionVariable m_waker;
+  queue_mutex_t m_mutex;
   std::deque<T> m_queue;
   bool m_stop;
   bool m_has_error;
@@ -56,6 +56,7 @@ dpkgfield() {
 	# second-pass: actually fill in the blanks
 	local _buffer=()
 	local _s_arch=()
+	local _debver
 	for _v in "${_string_v[@]}"; do
 		if [[ "${_v}" = '@'* ]]; then
 			continue
@@ -67,24 +68,29 @@ dpkgfield() {
 			name="${1/%_}"
 			_buffer+=("${name/[<>=]=*}");
 		elif [[ "${_v}" =~ [\<\>=]= ]]; then
-			_buffer+=("$(abpm_debver "${_v}")")
+			abpm_debver -v _debver "${_v}"
+			_buffer+=("${_debver}")
 		elif [[ "${_v}" =~ _spiral$ ]]; then
 			# Remove _spiral marker, append version
 			if [[ "${DPKG_ARCH%%_*}" == noarch ]] || [[ "${_v%_spiral}" = *:* ]]; then
-				_buffer+=("$(abpm_debver "${_v%_spiral}==${PKGEPOCH_SPIRAL:-0}:${_ver#*:}")")
+				abpm_debver -v _debver "${_v%_spiral}==${PKGEPOCH_SPIRAL:-0}:${_ver#*:}"
+				_buffer+=("${_debver}")
 			else
-				_s_arch+=($(abpm_deb_arch_name "${DPKG_ARCH%%_*}"))
+				abpm_deb_arch_name -v _s_arch "${DPKG_ARCH%%_*}"
 				for _arch in "${_s_arch[@]}"; do
-					_buffer+=("$(abpm_debver "${_v%_spiral}:${_arch}==${PKGEPOCH_SPIRAL:-0}:${_ver#*:}")")
+					abpm_debver -v _debver "${_v%_spiral}:${_arch}==${PKGEPOCH_SPIRAL:-0}:${_ver#*:}"
+					_buffer+=("${_debver}")
 				done
 			fi
 		elif ((VER_NONE)) || [[ "$_v" =~ _$ ]]; then
 			_buffer+=("${_v%_}");
 		else
-			_buffer+=("$(abpm_debver "${_v}>=$(dpkg_getver "${_v}")")")
+			abpm_debver -v _debver "${_v}>=$(dpkg_getver "${_v}")"
+			_buffer+=("${_debver}")
 		fi
 	done
-	local _content="$(ab_join_elements _buffer $', ')"
+	local _content
+	ab_join_elements -v _content _buffer $', '
 	[ "${_content}" ] && echo "$1: ${_content}"
 }
 
@@ -96,7 +102,7 @@ dpkgctrl() {
 	echo "Architecture: $arch"
 	[ "$PKGSEC" ] && echo "Section: $PKGSEC"
 	echo "Maintainer: $MTER"
-	echo "Installed-Size: $(du -s "$PKGDIR" | cut -f 1)"
+	echo "Installed-Size: $(abmanifest_du)"
 	echo "Description: $PKGDES"
 	echo "Description-md5: $(echo "$PKGDES" | md5sum | cut -d ' ' -f 1)"
 	if ((PKGESS)); then
@@ -124,7 +130,7 @@ dpkgctrl() {
 
 	dpkgfield Suggests "$PKGSUG"
 	local _pkgbreak
-	_pkgbreak="$(ab_get_item_by_key __ABMODIFIERS PKGBREAK 1)"
+	ab_get_item_by_key -v _pkgbreak __ABMODIFIERS PKGBREAK 1
 	if [ "${_pkgbreak}" = '0' ]; then
 		abwarn 'Not emitting PKGBREAK due to modifiers' >&2
 	else
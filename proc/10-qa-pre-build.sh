@@ -5,7 +5,9 @@ if bool "$ABQA"; then
 	abinfo "Running pre-build QA tests ..."
 	for i in "$AB"/qa/pre/*; do
         # shellcheck source=qa/pre/variables.sh
+		abtrace_begin qa "pre/${i##*/}"
 		. "$i"
+		abtrace_end
 	done
 fi
 
@@ -7,5 +7,9 @@ if bool "$NOPARALLEL"; then
 	export MAKEFLAGS="-j1"
 else
 	abinfo "Parallel build ENABLED"
+	if bool "$ABSTATS"; then
+		# fewer jobs if earlier builds would not fit in memory
+		abstats_limit_threads
+	fi
 	export MAKEFLAGS="-j$ABTHREADS"
 fi
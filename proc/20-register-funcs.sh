@@ -49,6 +49,12 @@ ab_register_template() {
 	if [ "$_error" = 1 ]; then
 		abdie "Internal error: Template ${name} contains error. Can't continue."
 	fi
+	# templates declaring their probes are already indexed, and the
+	# executables of their ##@requires header already checked
+	local _registered _indexed=0
+	for _registered in "${AB_TEMPLATES[@]}"; do
+		[ "$_registered" = "${name}" ] && _indexed=1
+	done
 	tmp_function() {
 		abtpl_check_exe "${bins[@]}"
 	}
@@ -57,18 +63,32 @@ ab_register_template() {
 		if ((delayed_check)); then
 		    local bins=("$@")
 			abfp_lambda tmp_function "build_${1}_check" -- name bins
+		elif ((_indexed)); then
+			abdie "Internal error: Template ${name} lists its executables in ##@requires, not after --."
 		else
 			name="${name}" abtpl_check_exe "$@"
 		fi
 	fi
 	abdbg "Registered build template: ${name}"
-    AB_TEMPLATES+=("${name}")
+	if ((!_indexed)); then
+		AB_TEMPLATES+=("${name}")
+	fi
 }
 
-for i in "$AB/templates"/*.sh "$AB/filters"/*.sh
+# Templates declaring ##@probe in their headers are loaded on demand by
+# ab_load_template, the others are loaded here.
+ab_index_templates "$AB/templates"
+for name in "${AB_TEMPLATES[@]}"; do
+	ab_template_requires -v _bins "$name" || continue
+	abtpl_check_exe "${_bins[@]}"
+done
+unset name _bins
+
+# from the script bundle, if installed
+for i in "$AB/filters"/*.sh
 do
-	# shellcheck disable=SC1090
-	. "$i"
+	load_strict "$i" || abdie "Unable to load filter $i: $?."
 done
 
-unset -f ab_register_template ab_register_filter
+# ab_register_template is still needed by the templates loaded later
+unset -f ab_register_filter
@@ -4,17 +4,26 @@
 if [ -z "$ABTYPE" ]; then
 	for i in "${AB_TEMPLATES[@]}"; do
 		# build are all plugins now.
-		if "build_${i}_probe"; then
+		# the declared probes are evaluated natively without loading the
+		# template, otherwise use the probe function of the template
+		ab_probe_template "$i" && _ret=0 || _ret=$?
+		if ((_ret == 2)); then
+			"build_${i}_probe" && _ret=0 || _ret=1
+		fi
+		if ((_ret == 0)); then
 			export ABTYPE=$i
 			break
 		fi
 	done
+	unset _ret
 fi
 
 if [ -z "$ABTYPE" ]; then
 	abdie "Cannot determine build type."
 fi
 
+ab_load_template "$ABTYPE" || abdie "Unable to load build template $ABTYPE."
+
 if [ "$ABTYPE" = 'self' ]; then
 	abinfo 'Using free-formed build script'
 else
@@ -36,10 +36,12 @@ if [ -e "$SRCDIR"/autobuild/hwcaps/build-"$ARCH" ] ; then
 	abinfo "Detected custom build script for HWCAPS subtargets of $ARCH."
 	HWCAPS_BUILD=hwcaps/build-"$ARCH"
 	export ABTYPE=self
+	ab_load_template self
 elif [ -e "$SRCDIR"/autobuild/hwcaps/build ] ; then
 	abinfo "Detected custom build script for HWCAPS subtargets."
 	HWCAPS_BUILD=hwcaps/build
 	export ABTYPE=self
+	ab_load_template self
 fi
 
 if [ "$ABTYPE" = "self" ] && [ -z "$HWCAPS_BUILD" ] ; then
@@ -77,6 +79,7 @@ for cap in "${HWCAPS[@]}" ; do
 	export PKGDIR="$SRCDIR/abdist-hwcaps-$cap"
 
 	abinfo "Building for HWCAPS subtarget $cap ..."
+	abtrace_begin hwcaps "$cap"
 	if arch_findfile hwcaps/prepare > /dev/null; then
 		abinfo 'Running pre-build (prepare) script ...'
 		arch_loadfile_strict hwcaps/prepare
@@ -85,12 +88,16 @@ for cap in "${HWCAPS[@]}" ; do
 	cd "$SRCDIR"
 	if ab_typecheck -f "build_${ABTYPE}_check"; then
 		abinfo "${ABTYPE} > Running check step ..."
+		abtrace_begin template "[$cap] build_${ABTYPE}_check"
 		"build_${ABTYPE}_check"
+		abtrace_end
 	fi
 
 	if ab_typecheck -f "build_${ABTYPE}_audit"; then
 		abinfo "${ABTYPE} > Running audit step ..."
+		abtrace_begin template "[$cap] build_${ABTYPE}_audit"
 		"build_${ABTYPE}_audit" || abdie "Audit failed: $?."
+		abtrace_end
 	fi
 	# Trick autotools into thinking that we are performing a cross
 	# compilation. The resulting $cross_compiling is `maybe', thus
@@ -108,11 +115,17 @@ for cap in "${HWCAPS[@]}" ; do
 	fi
 
 	abinfo "[$cap] ${ABTYPE} > Running configure step ..."
+	abtrace_begin template "[$cap] build_${ABTYPE}_configure"
 	"build_${ABTYPE}_configure" || abdie "Configure failed: $?."
+	abtrace_end
 	abinfo "[$cap] ${ABTYPE} > Running build step ..."
+	abtrace_begin template "[$cap] build_${ABTYPE}_build"
 	"build_${ABTYPE}_build" || abdie "Build failed: $?."
+	abtrace_end
 	abinfo "[$cap] ${ABTYPE} > Running install step ..."
+	abtrace_begin template "[$cap] build_${ABTYPE}_install"
 	"build_${ABTYPE}_install" || abdie "Install failed: $?."
+	abtrace_end
 
 	cd "$SRCDIR" || abdie "Unable to cd $SRCDIR: $?."
 
@@ -137,6 +150,7 @@ for cap in "${HWCAPS[@]}" ; do
 			install -Dvm755 -t "$PKG_PKGDIR"/usr/lib/glibc-hwcaps/"$cap"/ "$f"
 		done
 	fi
+	abtrace_end
 done # for cap in "${HWCAPS[@]}" ; do
 else # if [ "$ABTYPE" != "self" ] ; then
 	if arch_findfile hwcaps/prepare ; then
@@ -144,7 +158,9 @@ else # if [ "$ABTYPE" != "self" ] ; then
 		arch_loadfile_strict hwcaps/prepare || abdie "Failed to run custom build script: $?."
 	fi
 	abinfo "[HWCAPS] Running custom build script ..."
+	abtrace_begin hwcaps "$HWCAPS_BUILD"
 	arch_loadfile_strict hwcaps/$(basename $HWCAPS_BUILD) || abdie "Failed to run custom build script: $?."
+	abtrace_end
 
 	if arch_findfile hwcaps/beyond; then
 		abinfo "[HWCAPS] Running after-build (beyond) script ..."
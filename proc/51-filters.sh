@@ -4,9 +4,15 @@
 
 pushd "$PKGDIR" > /dev/null || exit 127
 
+# PKGDIR is walked once, the filters and the QA modules query the manifest,
+# which picks up the changes made in the meantime
+abmanifest_build "$PKGDIR" || abdie "Failed to scan $PKGDIR: $?."
+
 for ii in "${AB_FILTERS[@]}"; do
 	abinfo "Running post-build filter: $ii ..."
+	abtrace_begin filter "$ii"
 	"$ii"
+	abtrace_end
 done
 
 popd > /dev/null || exit 128
@@ -8,4 +8,10 @@ if arch_findfile -2 overrides __overrides && [ -d "${__overrides}" ]; then
     abinfo "Deploying files in overrides ..."
 	cp -arvT "${__overrides}"/ "$PKGDIR/" || \
 		abdie "Failed to deploy files in overrides: $?."
+	# the files copied over existing ones keep their directory unchanged
+	mapfile -d '' __deployed < <(find "${__overrides}" -mindepth 1 ! -type d \
+		-printf '%P\0')
+	abmanifest_update "${__deployed[@]/#/$PKGDIR/}" || \
+		abdie "Failed to update the manifest of $PKGDIR: $?."
+	unset __deployed
 fi
@@ -14,32 +14,8 @@ if bool "$ABSPIRAL"; then
 			__ABSPIRAL_PROVIDES+=("${SPIRAL_PROV}")
 		done
 	fi
-	if [ -d "$PKGDIR"/usr/lib/girepository-1.0 ]; then
-                while read -r LINE; do
-                    __ABSPIRAL_PROVIDES+=("$LINE")
-                done < <( find "$PKGDIR"/usr/lib/girepository-1.0/ -name '*.typelib' -type f -printf '%f\n' | \
-                   awk '{ sub(/\.typelib$/, "", $1); print "gir1.2-" tolower($1) }' )
-	fi
-	if [ -d "$PKGDIR"/usr/lib/python"$ABPY2VER"/site-packages ]; then
-                while read -r LINE; do
-                    __ABSPIRAL_PROVIDES+=("$LINE")
-                done < <( find "$PKGDIR"/usr/lib/python"$ABPY2VER"/site-packages -mindepth 1 -maxdepth 1 -type d -printf '%f\n' | \
-                   awk '{ split($1, x, "-"); gsub("_", "-", x[1]); print "python2-" tolower(x[1]); }' | sort -u )
-                while read -r LINE; do
-                    __ABSPIRAL_PROVIDES+=("$LINE")
-                done < <( find "$PKGDIR"/usr/lib/python"$ABPY2VER"/site-packages -mindepth 1 -maxdepth 1 -type f -name "*.py" -printf '%f\n' | \
-                   awk '{ split($1, x, "."); gsub("_", "-", x[1]); print "python2-" tolower(x[1]); }' | sort -u )
-	fi
-	if [ -d "$PKGDIR"/usr/lib/python"$ABPY3VER"/site-packages ]; then
-                while read -r LINE; do
-                    __ABSPIRAL_PROVIDES+=("$LINE")
-                done < <( find "$PKGDIR"/usr/lib/python"$ABPY3VER"/site-packages -mindepth 1 -maxdepth 1 -type d -not -name '__pycache__' -printf '%f\n' | \
-                   awk '{ split($1, x, "-"); gsub("_", "-", x[1]); print "python3-" tolower(x[1]); }' | sort -u )
-                while read -r LINE; do
-                    __ABSPIRAL_PROVIDES+=("$LINE")
-                done < <( find "$PKGDIR"/usr/lib/python"$ABPY3VER"/site-packages -mindepth 1 -maxdepth 1 -type f -name "*.py" -printf '%f\n' | \
-                   awk '{ split($1, x, "."); gsub("_", "-", x[1]); print "python3-" tolower(x[1]); }' | sort -u )
-	fi
+	# GObject-introspection (gir1.2-*) and Python (python{2,3}-*) provides
+	abspiral_from_pkgdir "$PKGDIR" "$ABPY2VER" "$ABPY3VER"
 	if [[ "${#__ABSPIRAL_PROVIDES[@]}" != 0 ]]; then
 		abdbg "Generated Debian-compatible (Spiral) provides: ${__ABSPIRAL_PROVIDES[*]}"
 	else
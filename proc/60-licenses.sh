@@ -7,6 +7,8 @@
 mkdir -p "$PKGDIR/usr/share/doc/$PKGNAME"
 find "$SRCDIR" -maxdepth 1 '(' -name 'COPYING*' -or -name 'LICENSE*' -or -name 'LICENCE*' -or -name 'COPYRIGHT*' ')' \
     -exec cp -L -r -v --no-preserve=mode '{}' "$PKGDIR/usr/share/doc/$PKGNAME" ';'
+# the licenses may overwrite those installed by the build
+abmanifest_update "$PKGDIR/usr/share/doc/$PKGNAME"
 
 [ -n "$(ls -A "$PKGDIR/usr/share/doc/$PKGNAME")" ] ||
 	abwarn "This package does not contain a COPYING or LICENCE file!"
@@ -7,8 +7,12 @@ if bool "$ABSTAGE2"; then
     return 0
 fi
 # Generate a cached conffiles.
-find "$PKGDIR"/etc -type f -printf '/etc/%P\n' 2>/dev/null \
-	| sort > "$SRCDIR"/conffiles.ab
+if [ -d "$PKGDIR"/etc ]; then
+	abmanifest_query -r -t f "$PKGDIR"/etc \
+		| sed 's|^|/|' | sort > "$SRCDIR"/conffiles.ab
+else
+	: > "$SRCDIR"/conffiles.ab
+fi
 
 if [[ -d "$PKGDIR"/etc && ! -e "$SRCDIR"/autobuild/conffiles ]]; then
 	abwarn 'Detected /etc in $PKGDIR, but autobuild/conffiles is not found - attempting generation ...'
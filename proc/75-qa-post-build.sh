@@ -4,7 +4,9 @@
 if bool "$ABQA"; then
 	abinfo "Running post-build QA tests ..."
 	for i in "$AB"/qa/post/*; do
+		abtrace_begin qa "post/${i##*/}"
 		. "$i"
+		abtrace_end
 	done
 fi
 
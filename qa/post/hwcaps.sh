@@ -27,7 +27,7 @@ if [ "${#hwcaps_subdirs[@]}" -lt 1 ] ; then
 fi
 
 # Check if any files present in $PKGDIR/$LIBDIR/glibc-hwcaps.
-FILES=($(find "$PKGDIR"/"$LIBDIR"/glibc-hwcaps -maxdepth 1 -type f,l))
+abmanifest_query -v FILES -t fl -p "${LIBDIR#/}/glibc-hwcaps/*"
 if [ "${#FILES[@]}" -ge 1 ] ; then
 	IFS=$'\n'
 	aberr "QA (E333): Stray file(s) found in the glibc-hwcaps directory:\n\n${FILES[*]}\n" | \
@@ -36,18 +36,10 @@ if [ "${#FILES[@]}" -ge 1 ] ; then
 fi
 
 # Check if all installed libraries have correct permissions
+# Non executable .so files, which are ELF files by their magic
 badfiles=()
-for tgt in "${hwcaps_subdirs[@]}" ; do
-	FILES=($(find $tgt -type f,l -name '*.so.*' -not -perm /111))
-	# Non executable .so files found
-	for f in "${FILES[@]}" ; do
-		# Check if it is an ELF file by checking its magic
-		read -N4 content < $f
-		if [ "$content" == $'\x7fELF' ] ; then
-			badfiles+=("$f")
-		fi
-	done
-done
+abmanifest_query -v badfiles -t f -n '*.so.*' -M /111 -c elf \
+	"${hwcaps_subdirs[@]}"
 if [ "${#badfiles[@]}" -ge 1 ] ; then
 	IFS=$'\n'
 	aberr "QA (E333): Non-executable shared object(s) found in glibc-hwcaps subdirectories:\n\n${badfiles[*]}\n" | \
@@ -53,24 +53,23 @@ share
 src
 )
 
-abqa_build_find_expr() {
+abqa_build_query_expr() {
 	local -n _patterns="$1"
 	local -n _expr="$2"
     for pattern in "${_patterns[@]}"; do
-		_expr+=('!' '-name' "${pattern}" '-and')
+		_expr+=('-N' "${pattern}")
 	done
-	_expr[-1]='-print'
 }
 
 EXPR1=()
 EXPR2=()
 EXPR3=()
-abqa_build_find_expr ACCEPTABLE EXPR1
-abqa_build_find_expr ACCEPTABLE2 EXPR2
-abqa_build_find_expr ACCEPTABLE3 EXPR3
-PATHS="$(find "$PKGDIR" -mindepth 1 -maxdepth 1 '(' "${EXPR1[@]}" ')' -type d 2>/dev/null)"
-PATHS2="$(find "$PKGDIR"/usr -mindepth 1 -maxdepth 1 '(' "${EXPR2[@]}" ')' -type d 2>/dev/null || true)"
-PATHS3="$(find "$PKGDIR"/usr/local -mindepth 1 -maxdepth 1 '(' "${EXPR3[@]}" ')' -type d 2>/dev/null || true)"
+abqa_build_query_expr ACCEPTABLE EXPR1
+abqa_build_query_expr ACCEPTABLE2 EXPR2
+abqa_build_query_expr ACCEPTABLE3 EXPR3
+PATHS="$(abmanifest_query -p '*' "${EXPR1[@]}")"
+PATHS2="$(abmanifest_query -p 'usr/*' "${EXPR2[@]}" || true)"
+PATHS3="$(abmanifest_query -p 'usr/local/*' "${EXPR3[@]}" || true)"
 
 if [ -n "$PATHS" ]; then
 	aberr "QA (E321): found unexpected path(s) in package:"
@@ -1,7 +1,10 @@
 #!/bin/bash
 ##permissions: Check for incorrect permissions.
 ##@copyright GPL-2.0+
-FILES="$(find "$PKGDIR/usr/bin" -type f -not -executable -print 2>/dev/null || true)"
+FILES=""
+if [ -d "$PKGDIR/usr/bin" ]; then
+	FILES="$(abmanifest_query -t f -M /111 "$PKGDIR/usr/bin")"
+fi
 if [ -n "$FILES" ]; then
 	aberr "QA (E324): non-executable file(s) found in /usr/bin:\n\n${FILES}\n" | \
 		tee -a "$SRCDIR"/abqaerr.log
@@ -12,21 +15,20 @@ if [ ! -d "$PKGDIR/usr/lib" ]; then
 	return 0
 fi
 
-FILES="$(find "$PKGDIR/usr/lib" -type f -name '*.so.*' -not -executable \
-	-exec bash -c '[[ "`file -bL {}`" == *shared\ object* ]] && exit 0' \; \
-	-print 2>/dev/null)"
+FILES="$(abmanifest_query -t f -n '*.so.*' -M /111 -c elf-dynamic \
+	"$PKGDIR/usr/lib")"
 if [ -n "$FILES" ]; then
 	aberr "QA (E324): non-executable shared object(s) found in /usr/lib:\n\n${FILES}\n" | \
 		tee -a "$SRCDIR"/abqaerr.log
 fi
 
-FILES="$(find "$PKGDIR/usr/lib" -type f -name '*.a' -executable -print 2>/dev/null)"
+FILES="$(abmanifest_query -t f -n '*.a' -m /111 "$PKGDIR/usr/lib")"
 if [ -n "$FILES" ]; then
 	aberr "QA (E324): executable static object(s) found in /usr/lib:\n\n${FILES}\n" | \
 		tee -a "$SRCDIR"/abqaerr.log
 fi
 
-FILES="$(find "$PKGDIR/usr/lib" -type f -name '*.o' -executable -print 2>/dev/null)"
+FILES="$(abmanifest_query -t f -n '*.o' -m /111 "$PKGDIR/usr/lib")"
 if [ -n "$FILES" ]; then
 	aberr "QA (E324): executable binary object(s) found in /usr/lib:\n\n${FILES}\n" | \
 		tee -a "$SRCDIR"/abqaerr.log
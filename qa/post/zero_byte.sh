@@ -1,7 +1,7 @@
 #!/bin/bash
 ##zero_byte: Check for zero-byte files.
 ##@copyright GPL-2.0+
-FILES="$(find "$PKGDIR" -type f -size 0 -print)"
+FILES="$(abmanifest_query -t f -s 0)"
 if [ -n "$FILES" ]; then
 	abwarn "QA (W322): Zero-byte files found:\n\n$FILES\n" | \
 		tee -a "$SRCDIR"/abqawarn.log
@@ -1,6 +1,8 @@
 #!/bin/bash
 # build/00-self.sh: Invokes `build` defs.
 ##@copyright GPL-2.0+
+##@template self
+##@probe -a build
 
 build_self_probe() {
 	arch_findfile -2 build
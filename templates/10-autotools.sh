@@ -1,6 +1,9 @@
 #!/bin/bash
 # 10-autotools.sh: Builds GNU autotools stuff
 ##@copyright GPL-2.0+
+##@template autotools
+##@probe -x autogen.sh || -x bootstrap || -f configure.ac || -f configure.in
+##@requires autoconf automake autoreconf
 
 build_autotools_probe() {
 	[ -x "$SRCDIR"/autogen.sh ] || \
@@ -114,4 +117,4 @@ build_autotools_install() {
 	fi
 }
 
-ab_register_template autotools -- autoconf automake autoreconf
+ab_register_template autotools
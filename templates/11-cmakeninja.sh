@@ -1,6 +1,9 @@
 #!/bin/bash
 # 13-cmakeninja.sh: Builds cmake with Ninja
 ##@copyright GPL-2.0+
+##@template cmakeninja
+##@probe -f CMakeLists.txt
+##@requires cmake ninja
 
 build_cmakeninja_probe(){
 	[ -f "$SRCDIR"/CMakeLists.txt ]
@@ -58,4 +61,4 @@ build_cmakeninja_install() {
 	fi
 }
 
-ab_register_template cmakeninja -- cmake ninja
+ab_register_template cmakeninja
@@ -1,6 +1,9 @@
 #!/bin/bash
 # 12-autosetup.sh: Builds Autosetup sources
 ##@copyright GPL-2.0+
+##@template autosetup
+##@probe -e autosetup/autosetup && -e auto.def && -e configure
+##@requires tclsh
 
 build_autosetup_probe(){
 	[ -e "$SRCDIR"/autosetup/autosetup ] && \
@@ -69,4 +72,4 @@ build_autosetup_install() {
 	fi
 }
 
-ab_register_template autosetup -- tclsh
+ab_register_template autosetup
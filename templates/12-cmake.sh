@@ -1,6 +1,9 @@
 #!/bin/bash
 # 12-cmake.sh: Builds cmake stuff
 ##@copyright GPL-2.0+
+##@template cmake
+##@probe -f CMakeLists.txt
+##@requires cmake make
 
 build_cmake_probe(){
 	[ -f "$SRCDIR"/CMakeLists.txt ]
@@ -62,4 +65,4 @@ build_cmake_install() {
 	fi
 }
 
-ab_register_template cmake -- cmake make
+ab_register_template cmake
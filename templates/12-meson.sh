@@ -1,6 +1,9 @@
 #!/bin/bash
 # 12-meson.sh: Builds Meson sources
 ##@copyright GPL-2.0+
+##@template meson
+##@probe -e meson.build
+##@requires meson
 
 build_meson_probe(){
 	[ -e "$SRCDIR"/meson.build ]
@@ -35,4 +38,4 @@ build_meson_install() {
 		|| abdie "Failed to return to source directory: $?."
 }
 
-ab_register_template meson -- meson
+ab_register_template meson
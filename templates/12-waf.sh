@@ -1,6 +1,9 @@
 #!/bin/bash
 ##12-waf.sh: Builds WAF stuff
 ##@copyright GPL-2.0+
+##@template waf
+##@probe -f waf
+##@requires $PYTHON
 
 build_waf_probe() {
 	[ -f "$SRCDIR"/waf ]
@@ -29,4 +32,4 @@ build_waf_install() {
 		|| abdie "Failed to install binaries: $?."
 }
 
-ab_register_template waf -- "$PYTHON"
+ab_register_template waf
@@ -1,6 +1,8 @@
 #!/bin/bash
 ##15-dune.sh: Builds OCaml projects using Dune
 ##@copyright GPL-2.0+
+##@template dune
+##@probe -f dune-project
 
 build_dune_probe(){
 	[ -f "$SRCDIR"/dune-project ]
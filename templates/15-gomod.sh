@@ -1,6 +1,9 @@
 #!/bin/bash
 ##15-gomod.sh: Builds Go projects using Go Modules and Go 1.11+
 ##@copyright GPL-2.0+
+##@template gomod
+##@probe -f go.mod && -f go.sum
+##@requires go
 
 ab_go_build() {
 	ab_typecheck -a GO_LDFLAGS
@@ -59,4 +62,4 @@ build_gomod_install() {
 	true
 }
 
-ab_register_template gomod -- go
+ab_register_template gomod
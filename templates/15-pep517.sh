@@ -1,6 +1,9 @@
 #!/bin/bash
 ##15-python.sh: Builds Python PEP517 stuff
 ##@copyright GPL-2.0+
+##@template pep517
+##@probe -f pyproject.toml
+##@requires python3 pip3
 
 # PEP517 is only supported in Python 3
 
@@ -62,4 +65,4 @@ build_pep517_install() {
 	BUILD_FINAL
 }
 
-ab_register_template pep517 -- python3 pip3
+ab_register_template pep517
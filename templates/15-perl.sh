@@ -1,6 +1,9 @@
 #!/bin/bash
 ##15-perl.sh: Builds Makefile.PL stuff
 ##@copyright GPL-2.0+
+##@template perl
+##@probe -f Makefile.PL || -h Makefile.PL || -f Build.PL || -h Build.PL
+##@requires perl make
 
 build_perl_probe() {
 	[ -f "$SRCDIR"/Makefile.PL ] || \
@@ -58,4 +61,4 @@ build_perl_install() {
 	fi
 }
 
-ab_register_template perl -- perl make
+ab_register_template perl
@@ -1,6 +1,8 @@
 #!/bin/bash
 ##15-rust.sh: Builds Rust + Cargo projects
 ##@copyright GPL-2.0+
+##@template rust
+##@probe -f Cargo.toml
 
 DEFAULT_CARGO_CONFIG=(
 --config 'profile.release.lto = true'
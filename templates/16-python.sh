@@ -1,6 +1,9 @@
 #!/bin/bash
 ##15-python.sh: Builds Python stuff
 ##@copyright GPL-2.0+
+##@template python
+##@probe -f setup.py
+##@requires python3
 
 build_python_probe() {
 	[ -f "$SRCDIR"/setup.py ]
@@ -36,4 +39,4 @@ build_python_install() {
 	true;
 }
 
-ab_register_template python -- python3
+ab_register_template python
@@ -1,10 +1,14 @@
 #!/bin/bash
 ##20-qtproj.sh: Builds qmake stuff
 ##@copyright GPL-2.0+
+##@template qtproj
+##@probe -g *.pro
 
 build_qtproj_probe() {
+	# like the other probes (and the native -g probe above), this looks in
+	# SRCDIR rather than in the working directory
 	# find can't return 0 on non-matches, so let's do it in reverse
-	if find . -maxdepth 1 -name '*.pro' -type f -exec 'false' '{}' '+'; then
+	if find "$SRCDIR" -maxdepth 1 -name '*.pro' -type f -exec 'false' '{}' '+'; then
 		return 1;
 	else
 		return 0;
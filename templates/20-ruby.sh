@@ -1,6 +1,9 @@
 #!/bin/bash
 ##20-ruby.sh: Builds Ruby GEMs
 ##@copyright GPL-2.0+
+##@template ruby
+##@probe false
+##@requires ruby gem
 
 build_ruby_probe(){
 	# [ -f "$SRCDIR"/*.gem ]
@@ -28,4 +31,4 @@ build_ruby_install() {
     BUILD_FINAL
 }
 
-ab_register_template ruby -- ruby gem
+ab_register_template ruby
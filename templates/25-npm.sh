@@ -1,6 +1,8 @@
 #!/bin/bash
 ##25-npm.sh: Builds NPM registry archives
 ##@copyright GPL-2.0+
+##@template npm
+##@probe -f package.json
 
 build_npm_probe(){
 	[ -f "$SRCDIR"/package.json ]
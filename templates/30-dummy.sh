@@ -1,6 +1,8 @@
 #!/bin/bash
 ##30-dummy.sh: Builds dummy/meta/transitional packages
 ##@copyright GPL-2.0+
+##@template dummy
+##@probe false
 
 build_dummy_probe() {
 	false;
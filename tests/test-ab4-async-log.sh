@@ -0,0 +1,44 @@
+#!/bin/bash -e
+# the ELF workers log from their own threads, through the asynchronous queue
+_elfdir="$(mktemp -d)"
+mkdir "$_elfdir"/bin
+for i in $(seq 16); do
+	cp "$(command -v true)" "$_elfdir"/bin/true"$i"
+done
+ABASYNCLOG=1 ABREPORTER=json bash -c 'source "ab4-prelude.sh"
+abelf_copy_dbg_parallel -x "$0"/bin "$0"/dbg
+abinfo "Workers finished."
+abdie "Stopped."' "$_elfdir" > test-async-log.log 2>&1 && _ret=0 || _ret=$?
+rm -rf "$_elfdir"
+if ((_ret == 0)); then
+	echo 'Async log test failed: abdie did not stop the shell.'
+	exit 1
+fi
+
+_count="$(grep -c '^{"event":"log".*Stripping debug symbols from' test-async-log.log || true)"
+if ((_count != 16)); then
+	cat test-async-log.log
+	echo "Async log test failed: $_count messages from the workers instead of 16."
+	exit 1
+fi
+# each message is written out whole, none of them interleaved with another
+if grep '"event"' test-async-log.log | grep -qv '^{"event"'; then
+	cat test-async-log.log
+	echo 'Async log test failed: messages interleaved.'
+	exit 1
+fi
+_last_worker="$(grep -n 'Stripping debug symbols from' test-async-log.log | tail -n 1 | cut -d: -f1)"
+_main="$(grep -n 'Workers finished.' test-async-log.log | cut -d: -f1)"
+_exception="$(grep -n '^{"event":"exception"' test-async-log.log | cut -d: -f1)"
+if [[ -z "$_main" || -z "$_exception" ]]; then
+	cat test-async-log.log
+	echo 'Async log test failed: messages of the main thread missing.'
+	exit 1
+fi
+# the queue is written out before the main thread and the exception
+if ! ((_last_worker < _main && _main < _exception)); then
+	cat test-async-log.log
+	echo 'Async log test failed: messages out of order.'
+	exit 1
+fi
+echo "Async log test passed."
@@ -0,0 +1,68 @@
+#!/bin/bash -e
+source "ab4-prelude.sh"
+
+_ab4="$PWD/ab4.sh"
+_pkg="$(mktemp -d)"
+cp -r "$AB"/tests/simple-self/autobuild "$_pkg"/
+cat > "$_pkg"/autobuild/build << 'EOF'
+echo 'Compiling foo.c'
+printf '\x1eAB4STAGX is not a stage marker\n'
+echo 'foo.c:1:2: warning: unused variable' >&2
+printf 'foo.c:3:4: error: ' >&2
+echo 'Linking foo'
+echo 'expected expression' >&2
+false
+EOF
+(cd "$_pkg" && ABCAPTURELOG=1 NO_COLOR=1 bash "$_ab4") \
+	> test-build-log.out 2> test-build-log.err && _ret=0 || _ret=$?
+
+if ((_ret == 0)); then
+	abdie 'Build log test failed: the build did not fail.'
+fi
+if [ ! -f "$_pkg"/abbuild.log.index.json ]; then
+	abdie 'Build log test failed: no index saved.'
+fi
+
+# the streams are passed through separately, without the stage markers
+if ! grep -q '^Compiling foo.c$' test-build-log.out; then
+	abdie 'Build log test failed: stdout not passed through.'
+fi
+if ! grep -q '^foo.c:3:4: error: expected expression$' test-build-log.err; then
+	abdie 'Build log test failed: stderr not passed through.'
+fi
+if grep -q 'error: expected expression' test-build-log.out; then
+	abdie 'Build log test failed: stderr passed through to stdout.'
+fi
+if grep -qa $'\x1eAB4STAGE ' test-build-log.out test-build-log.err; then
+	abdie 'Build log test failed: stage markers passed through.'
+fi
+if ! grep -qa 'AB4STAGX is not a stage marker' test-build-log.out; then
+	abdie 'Build log test failed: a line looking like a marker was held back.'
+fi
+
+abjson_load -f index "$_pkg"/abbuild.log.index.json
+abjson_query index "['stages'][0]['name']" _stage
+if [[ "$_stage" != proc/* ]]; then
+	abdie "Build log test failed: first stage is $_stage."
+fi
+abjson_query index "['warnings_total']" _warnings
+abjson_query index "['errors_total']" _errors_total
+if ((_warnings < 1 || _errors_total < 1)); then
+	abdie "Build log test failed: $_errors_total error(s) and $_warnings warning(s) indexed."
+fi
+# the line of stderr is indexed whole, even though stdout was written in the
+# middle of it
+abjson_query index "['errors'][0]['text']" _error
+if [[ "$_error" != 'foo.c:3:4: error: expected expression' ]]; then
+	abdie "Build log test failed: first error is $_error."
+fi
+abjson_query index "['errors'][0]['stage']" _stage
+if [[ -z "$_stage" ]]; then
+	abdie 'Build log test failed: error indexed without its stage.'
+fi
+abjson_free index
+if ! grep -q 'Errors found in the build output' test-build-log.out; then
+	abdie 'Build log test failed: no excerpt shown at the end.'
+fi
+rm -rf "$_pkg"
+echo "Build log test passed."
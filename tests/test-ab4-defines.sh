@@ -0,0 +1,33 @@
+#!/bin/bash -e
+source "ab4-prelude.sh"
+
+_pkg="$(mktemp -d)"
+mkdir "$_pkg"/autobuild
+# the suffixed array is assigned before the plain one, which must not write
+# through the alias left by the previous load
+cat > "$_pkg"/autobuild/defines << 'EOF2'
+PKGNAME=foo
+PKGDEP__AMD64=(glibc amd64-only)
+PKGDEP=(glibc)
+EOF2
+cd "$_pkg"
+ARCH=amd64
+ABHOST=amd64
+ABHOST_GROUP=()
+for _ in 1 2; do
+	arch_loaddefines defines || abdie "Defines test failed: arch_loaddefines returned $?."
+	if [[ "${PKGDEP__AMD64[*]}" != 'glibc amd64-only' ]]; then
+		abdie "Defines test failed: PKGDEP__AMD64 changed to ${PKGDEP__AMD64[*]}."
+	fi
+	if [[ "${PKGDEP[*]}" != 'glibc amd64-only' ]]; then
+		abdie "Defines test failed: PKGDEP resolved to ${PKGDEP[*]}."
+	fi
+done
+# the resolved array is an alias of the suffixed one until the next load
+PKGDEP+=(extra)
+if [[ "${PKGDEP__AMD64[*]}" != 'glibc amd64-only extra' ]]; then
+	abdie 'Defines test failed: PKGDEP is not an alias of PKGDEP__AMD64.'
+fi
+cd - > /dev/null
+rm -rf "$_pkg"
+echo "Defines test passed."
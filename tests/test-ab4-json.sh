@@ -0,0 +1,86 @@
+#!/bin/bash -e
+source "ab4-prelude.sh"
+
+_json="$(mktemp)"
+cat > "$_json" << 'EOF'
+{
+	"name": "foo",
+	"version": 2,
+	"stable": true,
+	"arches": ["amd64", "arm64", "riscv64"],
+	"deps": {"bar": ">= 1.0", "baz": ""},
+	"targets": [{"kind": "lib"}, {"kind": "bin"}]
+}
+EOF
+abjson_load -f test "$_json"
+rm -f "$_json"
+
+abjson_query test "['name']" _name
+abjson_query test "['version']" _version
+abjson_query test "['stable']" _stable
+if [[ "$_name" != 'foo' || "$_version" != 2 || "$_stable" != 1 ]]; then
+	echo "Scalars: $_name $_version $_stable"
+	abdie 'JSON test failed: wrong scalar values.'
+fi
+
+abjson_query test "['arches']" _arches
+if [[ "${#_arches[@]}" != 3 || "${_arches[1]}" != 'arm64' ]]; then
+	echo "Array: ${_arches[*]}"
+	abdie 'JSON test failed: wrong array binding.'
+fi
+declare -A _deps
+abjson_query test "['deps']" _deps
+if [[ "${#_deps[@]}" != 2 || "${_deps[bar]}" != '>= 1.0' || -n "${_deps[baz]}" ]]; then
+	echo "Object: ${!_deps[*]} => ${_deps[*]}"
+	abdie 'JSON test failed: wrong object binding.'
+fi
+abjson_query test "['targets'][1]['kind']" _kind
+if [[ "$_kind" != 'bin' ]]; then
+	abdie "JSON test failed: nested query returned $_kind."
+fi
+
+# missing keys and indices yield null
+_missing=set
+abjson_query test "['targets'][5]['kind']" _missing
+if [[ -n "$_missing" ]]; then
+	abdie 'JSON test failed: missing index did not yield null.'
+fi
+
+# the bindings respect the local variables
+_local_binding() {
+	local -a _local_arches
+	abjson_query test "['arches']" _local_arches
+	[[ "${_local_arches[2]}" = 'riscv64' ]]
+}
+if ! _local_binding || [[ -v _local_arches ]]; then
+	abdie 'JSON test failed: local variable not respected.'
+fi
+
+abjson_query test "['name'][0]" _name && _ret=0 || _ret=$?
+if ((_ret != 3)); then
+	abdie "JSON test failed: type mismatch returned $_ret."
+fi
+abjson_query test "name" _name && _ret=0 || _ret=$?
+if ((_ret != 2)); then
+	abdie "JSON test failed: invalid query returned $_ret."
+fi
+abjson_load broken '{"name": ' && _ret=0 || _ret=$?
+if ((_ret != 1)); then
+	abdie "JSON test failed: invalid document returned $_ret."
+fi
+
+# one-shot queries do not need a handle
+abjson_get_item '{"a": [1, 2]}' "['a'][1]" _item
+if [[ "$_item" != 2 ]]; then
+	abdie "JSON test failed: abjson_get_item returned $_item."
+fi
+
+abjson_free test
+abjson_query test "['name']" _name && _ret=0 || _ret=$?
+if ((_ret != 5)); then
+	abdie "JSON test failed: query on a freed handle returned $_ret."
+fi
+if abjson_free test; then
+	abdie 'JSON test failed: handle freed twice.'
+fi
+echo "JSON test passed."
@@ -0,0 +1,88 @@
+#!/bin/bash -e
+source "ab4-prelude.sh"
+
+PKGDIR="$(mktemp -d)"
+mkdir -p "$PKGDIR"/usr/bin "$PKGDIR"/usr/lib "$PKGDIR"/etc
+printf '#!/bin/sh\ntrue\n' > "$PKGDIR"/usr/bin/foo
+chmod 755 "$PKGDIR"/usr/bin/foo
+ln -s foo "$PKGDIR"/usr/bin/bar
+printf 'plain text\n' > "$PKGDIR"/usr/lib/data
+touch "$PKGDIR"/etc/foo.conf "$PKGDIR"/stray
+abmanifest_build "$PKGDIR"
+
+_query() {
+	abmanifest_query -r -v _found "$@"
+	_results="${_found[*]}"
+}
+
+_query -t f
+if [[ "$_results" != "etc/foo.conf stray usr/bin/foo usr/lib/data" ]]; then
+	abdie "Manifest test failed: wrong files recorded: $_results."
+fi
+_query -t l "$PKGDIR"/usr/bin
+if [[ "$_results" != "usr/bin/bar" ]]; then
+	abdie "Manifest test failed: wrong symlinks in usr/bin: $_results."
+fi
+# the top-level entries of any type, as checked by qa/post/path_issues.sh
+_query -p '*' -N usr -N etc
+if [[ "$_results" != "stray" ]]; then
+	abdie "Manifest test failed: top-level file not listed: $_results."
+fi
+_query -t f -c script
+if [[ "$_results" != "usr/bin/foo" ]]; then
+	abdie "Manifest test failed: wrong scripts: $_results."
+fi
+
+# files added and removed by the filters
+rm "$PKGDIR"/stray
+touch "$PKGDIR"/usr/lib/libfoo.a
+_query -t f
+if [[ "$_results" != "etc/foo.conf usr/bin/foo usr/lib/data usr/lib/libfoo.a" ]]; then
+	abdie "Manifest test failed: added or removed files not seen: $_results."
+fi
+
+# chmod and writes in place leave the directories alone, they are rescanned
+# by the stage which made them
+chmod 644 "$PKGDIR"/usr/bin/foo
+abmanifest_update "$PKGDIR"/usr/bin/foo
+_query -t f -M /111 "$PKGDIR"/usr/bin
+if [[ "$_results" != "usr/bin/foo" ]]; then
+	abdie "Manifest test failed: chmod not seen: $_results."
+fi
+printf '#!/bin/sh\n\n\n' > "$PKGDIR"/usr/lib/data
+abmanifest_update "$PKGDIR"/usr/lib/data
+_query -t f -c script
+if [[ "$_results" != "usr/bin/foo usr/lib/data" ]]; then
+	abdie "Manifest test failed: file written in place not classified again: $_results."
+fi
+_query -t f -s +0 "$PKGDIR"/etc
+if [[ -n "$_results" ]]; then
+	abdie "Manifest test failed: empty file listed as non-empty: $_results."
+fi
+echo 'foo=bar' >> "$PKGDIR"/etc/foo.conf
+abmanifest_update "$PKGDIR"/etc/foo.conf
+_query -t f -s +0 "$PKGDIR"/etc
+if [[ "$_results" != "etc/foo.conf" ]]; then
+	abdie "Manifest test failed: appended file not seen: $_results."
+fi
+
+# like find, the missing directories fail the query, not the others
+abmanifest_query -r -v _found "$PKGDIR"/usr/share "$PKGDIR"/etc \
+	> test-manifest.log && _ret=0 || _ret=$?
+if ((_ret != 1)); then
+	abdie "Manifest test failed: query of a missing directory returned $_ret."
+fi
+if ! grep -q "usr/share: No such file or directory" test-manifest.log; then
+	abdie 'Manifest test failed: no error for the missing directory.'
+fi
+if [[ "${_found[*]}" != "etc etc/foo.conf" ]]; then
+	abdie 'Manifest test failed: existing directory not listed along with the missing one.'
+fi
+abmanifest_query -r -v _found "$PKGDIR"/usr/share > /dev/null && _ret=0 || _ret=$?
+if ((_ret != 1)) || [[ -n "${_found[*]}" ]]; then
+	abdie 'Manifest test failed: query of a missing directory listed the whole tree.'
+fi
+
+abmanifest_free
+rm -rf "$PKGDIR"
+echo "Manifest test passed."
@@ -0,0 +1,49 @@
+#!/bin/bash -e
+_sock="$PWD/test-server.sock"
+_client="$(cd .. && pwd)/ab4-client"
+_srcdir="$(mktemp -d)"
+bash -c 'source "ab4-prelude.sh" && autobuild -S "$0"; echo "Server script resumed."' \
+	"$_sock" > test-server.log 2>&1 &
+_server="$!"
+for _ in $(seq 50); do
+	[ -S "$_sock" ] && break
+	sleep 0.1
+done
+if [ ! -S "$_sock" ]; then
+	cat test-server.log
+	echo 'Server test failed: the socket was not created.'
+	exit 1
+fi
+if [[ "$(stat -c '%a' "$_sock")" != 600 ]]; then
+	echo "Server test failed: the socket is created with mode $(stat -c '%a' "$_sock")."
+	exit 1
+fi
+
+# there is nothing to build in the directory, the build fails, but its status
+# still has to come back to the client
+(cd "$_srcdir" && "$_client" -s "$_sock" < /dev/null) > test-client.log 2>&1 && _ret=0 || _ret=$?
+if ((_ret == 0)); then
+	cat test-client.log
+	echo 'Server test failed: the build of an empty directory succeeded.'
+	exit 1
+fi
+if ! grep -q "started in $_srcdir" test-server.log || ! grep -q 'finished with status' test-server.log; then
+	cat test-server.log
+	echo 'Server test failed: the build was not run by the server.'
+	exit 1
+fi
+
+kill -TERM "$_server"
+wait "$_server" || true
+if [ -e "$_sock" ]; then
+	echo 'Server test failed: the socket was left behind.'
+	exit 1
+fi
+# only the server itself goes back to the script, not the build children
+if [[ "$(grep -c 'Server script resumed.' test-server.log)" != 1 ]]; then
+	cat test-server.log
+	echo 'Server test failed: a build returned into the server script.'
+	exit 1
+fi
+rm -rf "$_srcdir"
+echo "Server test passed."
@@ -27,3 +27,18 @@ else
     echo "Expected names: ${EXPECTED_SONAMES[*]}"
     abdie 'Spiral test failed.'
 fi
+
+_pkgdir="$(mktemp -d)"
+mkdir -p "$_pkgdir"/usr/lib/girepository-1.0 \
+	"$_pkgdir"/usr/lib/python3.99/site-packages/{Foo_Bar-1.0.dist-info,__pycache__}
+touch "$_pkgdir"/usr/lib/girepository-1.0/Gtk-3.0.typelib \
+	"$_pkgdir"/usr/lib/python3.99/site-packages/baz_qux.py
+__ABSPIRAL_PROVIDES=()
+abspiral_from_pkgdir "$_pkgdir" '2.99' '3.99'
+rm -rf "$_pkgdir"
+if [[ "${__ABSPIRAL_PROVIDES[*]}" = 'gir1.2-gtk-3.0 python3-foo-bar python3-baz-qux' ]]; then
+    echo "Spiral test passed."
+else
+    echo "Inferred names: ${__ABSPIRAL_PROVIDES[*]}"
+    abdie 'Spiral test failed.'
+fi
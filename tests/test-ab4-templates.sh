@@ -0,0 +1,75 @@
+#!/bin/bash -e
+source "ab4-prelude.sh"
+
+_tpldir="$(mktemp -d)"
+SRCDIR="$(mktemp -d)"
+cat > "$_tpldir"/10-lazy.sh << 'EOF'
+#!/bin/bash
+##@template lazy
+##@probe -f lazy.build && -d src || -g *.lazy
+##@requires sh $_TEST_EXE
+build_lazy_probe() { false; }
+build_lazy_configure() { true; }
+build_lazy_build() { true; }
+build_lazy_install() { true; }
+ab_register_template lazy
+EOF
+cat > "$_tpldir"/20-eager.sh << 'EOF'
+#!/bin/bash
+build_eager_probe() { [ -f "$SRCDIR"/eager.build ]; }
+ab_register_template eager
+EOF
+# stands in for proc/20-register-funcs.sh
+AB_TEMPLATES=()
+ab_register_template() {
+	AB_TEMPLATES+=("$1")
+}
+
+ab_index_templates "$_tpldir"
+if [[ "${AB_TEMPLATES[*]}" != 'lazy eager' ]]; then
+	echo "Indexed templates: ${AB_TEMPLATES[*]}"
+	abdie 'Template test failed: wrong templates indexed.'
+fi
+if ab_typecheck -f build_lazy_configure || ! ab_typecheck -f build_eager_probe; then
+	abdie 'Template test failed: only the templates without probes should be loaded.'
+fi
+
+_TEST_EXE=true
+ab_template_requires -v _bins lazy
+if [[ "${_bins[*]}" != 'sh true' ]]; then
+	echo "Required executables: ${_bins[*]}"
+	abdie 'Template test failed: wrong required executables.'
+fi
+
+# the probes are evaluated against SRCDIR, not the working directory
+touch lazy.build
+mkdir -p src
+if ab_probe_template lazy; then
+	abdie 'Template test failed: probe matched outside of SRCDIR.'
+fi
+touch "$SRCDIR"/lazy.build
+if ab_probe_template lazy; then
+	abdie 'Template test failed: probe matched without src/.'
+fi
+mkdir "$SRCDIR"/src
+if ! ab_probe_template lazy; then
+	abdie 'Template test failed: probe did not match lazy.build && src/.'
+fi
+rm -rf "$SRCDIR"/lazy.build "$SRCDIR"/src lazy.build src
+touch "$SRCDIR"/foo.lazy
+if ! ab_probe_template lazy; then
+	abdie 'Template test failed: probe did not match *.lazy.'
+fi
+
+# templates without declared probes are probed by their functions
+ab_probe_template eager && _ret=0 || _ret=$?
+if ((_ret != 2)); then
+	abdie "Template test failed: undeclared probe returned $_ret."
+fi
+
+ab_load_template lazy
+if ! ab_typecheck -f build_lazy_configure; then
+	abdie 'Template test failed: template not loaded on demand.'
+fi
+rm -rf "$_tpldir" "$SRCDIR"
+echo "Template test passed."